@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "average.h"
+
+
+// Accepted buffers before outliers are rejected
+#define AVERAGE_MIN_DEVIATIONS 2
+
+
+bool average_init(struct average *avg, uint32_t size, float reject) {
+    memset(avg, 0, sizeof(*avg));
+    avg->size = size;
+    avg->reject = reject;
+    for (int ch = 0; ch < 2; ch++) {
+        avg->ref[ch] = (float *)malloc(size * sizeof(float));
+        avg->sum[ch] = (float *)malloc(size * sizeof(float));
+        avg->sumsq[ch] = (float *)malloc(size * sizeof(float));
+        if (!avg->ref[ch] || !avg->sum[ch] || !avg->sumsq[ch]) {
+            average_free(avg);
+            return false;
+        }
+    }
+    average_reset(avg);
+    return true;
+}
+
+void average_free(struct average *avg) {
+    for (int ch = 0; ch < 2; ch++) {
+        free(avg->ref[ch]);
+        free(avg->sum[ch]);
+        free(avg->sumsq[ch]);
+        avg->ref[ch] = avg->sum[ch] = avg->sumsq[ch] = NULL;
+    }
+}
+
+void average_reset(struct average *avg) {
+    avg->count = avg->rejected = 0;
+    avg->deviation = 0;
+    avg->ndeviation = 0;
+    avg->n[0] = avg->n[1] = avg->size;
+}
+
+
+/** RMS deviation of both buffers from the running mean. */
+static float deviation(
+        const struct average *avg, const float *bufs[2], const uint32_t n[2]) {
+    double sq = 0;
+    for (int ch = 0; ch < 2; ch++) {
+        const float *ref = avg->ref[ch], *sum = avg->sum[ch], *buf = bufs[ch];
+        for (uint32_t i = 0; i < n[ch]; i++) {
+            float d = buf[i] - ref[i] - sum[i] / avg->count;
+            sq += d*d;
+        }
+    }
+    return sqrt(sq / (n[0] + n[1]));
+}
+
+bool average_add(
+        struct average *avg,
+        const float *buf1, uint32_t s1, const float *buf2, uint32_t s2) {
+    const float *bufs[2] = {buf1, buf2};
+    uint32_t n[2] = {s1, s2};
+    for (int ch = 0; ch < 2; ch++) {
+        if (n[ch] > avg->n[ch]) n[ch] = avg->n[ch];
+        avg->n[ch] = n[ch];
+    }
+
+    if (avg->count == 0) {
+        for (int ch = 0; ch < 2; ch++) {
+            memcpy(avg->ref[ch], bufs[ch], n[ch] * sizeof(float));
+            memset(avg->sum[ch], 0, n[ch] * sizeof(float));
+            memset(avg->sumsq[ch], 0, n[ch] * sizeof(float));
+        }
+        avg->count = 1;
+        return true;
+    }
+
+    if (avg->reject > 0) {
+        float d = deviation(avg, bufs, n);
+        if (avg->ndeviation >= AVERAGE_MIN_DEVIATIONS
+                && d > avg->reject * avg->deviation / avg->ndeviation) {
+            avg->rejected++;
+            return false;
+        }
+        avg->deviation += d;
+        avg->ndeviation++;
+    }
+
+    for (int ch = 0; ch < 2; ch++) {
+        const float *ref = avg->ref[ch], *buf = bufs[ch];
+        float *sum = avg->sum[ch], *sumsq = avg->sumsq[ch];
+        for (uint32_t i = 0; i < n[ch]; i++) {
+            float d = buf[i] - ref[i];
+            sum[i] += d;
+            sumsq[i] += d*d;
+        }
+    }
+    avg->count++;
+    return true;
+}
+
+uint32_t average_result(const struct average *avg, int ch, float *mean, float *variance) {
+    if (avg->count == 0) return 0;
+    const float *ref = avg->ref[ch], *sum = avg->sum[ch], *sumsq = avg->sumsq[ch];
+    for (uint32_t i = 0; i < avg->n[ch]; i++) {
+        float m = sum[i] / avg->count;
+        mean[i] = ref[i] + m;
+        if (variance)
+            variance[i] = fmaxf(sumsq[i] / avg->count - m*m, 0);
+    }
+    return avg->n[ch];
+}
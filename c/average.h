@@ -0,0 +1,63 @@
+#ifndef __AVERAGE_H
+#define __AVERAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**
+ * Coherent average of repeated, triggered buffers of both channels,
+ * accumulated in place such that only the mean (and variance) has to
+ * be written out.
+ *
+ * Sums are taken relative to the first buffer, which keeps float
+ * accumulators precise for the variance.  Optionally whole buffers
+ * are rejected as outliers (e.g. a glitched trigger) if their RMS
+ * deviation from the running mean exceeds `reject` times the mean
+ * deviation of the accepted buffers so far.
+ */
+struct average {
+    uint32_t size;               // samples per channel
+    float reject;                // outlier threshold, 0 to accept all
+    long count, rejected;        // accepted and rejected buffers
+    float *ref[2];               // first accepted buffer
+    float *sum[2], *sumsq[2];    // sums of deviations from ref
+    uint32_t n[2];               // valid samples in all buffers
+    double deviation;            // sum of RMS deviations of accepted buffers
+    long ndeviation;
+};
+
+
+/**
+ * Allocate accumulators for buffers of up to `size` samples.
+ *
+ * @return false on allocation failure.
+ */
+bool average_init(struct average *avg, uint32_t size, float reject);
+
+void average_free(struct average *avg);
+
+/**
+ * Start a new average.
+ */
+void average_reset(struct average *avg);
+
+/**
+ * Add one pair of buffers.  Only the first min(s, size) samples of
+ * every added buffer are averaged.
+ *
+ * @return false if rejected as outlier.
+ */
+bool average_add(
+    struct average *avg,
+    const float *buf1, uint32_t s1, const float *buf2, uint32_t s2);
+
+/**
+ * Write mean and (if not NULL) population variance of channel `ch`
+ * (0 or 1) to the buffers.
+ *
+ * @return Number of samples written.
+ */
+uint32_t average_result(const struct average *avg, int ch, float *mean, float *variance);
+
+#endif // __AVERAGE_H
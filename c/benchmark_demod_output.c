@@ -0,0 +1,224 @@
+/**
+ * Benchmark of host side post-processing of recorded text output (see
+ * records.h and demod_output.c).  Runs on the CPU only.
+ *
+ * Usage: benchmark_demod_output FILE [MBYTES [T1,T2,...]]
+ *
+ * If FILE does not exist, about MBYTES (default 2000) of synthetic
+ * records are written to it first, gzip compressed if the name ends
+ * in `.gz`.  Records have the format of u1_drive1:
+ *
+ *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH SAMPLES...
+ *
+ * with 16384 samples of a sine with amplitude AMP / CH and noise.
+ *
+ * Prints the speed of `parse_float` compared to `strtof` and then for
+ * every number of threads (default 1,2,4) the throughput of parsing
+ * and demodulating all records of FILE at the fundamental, like
+ * demod_output does, with output discarded (tab separated):
+ *
+ *     THREADS SECONDS MB/S RECORDS/S MAXERR
+ *
+ * where MB are uncompressed text and MAXERR is the largest relative
+ * deviation of a demodulated amplitude from AMP / CH.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "demodulation.h"
+#include "records.h"
+#include "utility.h"
+
+
+#define SYNTH_SAMPLES 16384
+#define SYNTH_SAMPLERATE 1953125.0
+#define SYNTH_NOISE 0.01
+#define TRIGGER_SAMPLE 200
+#define MAX_THREADS 64
+// Repetitions of the parser benchmark on one record
+#define PARSE_REPEAT 20
+
+
+/**
+ * Uniform random number in [-0.5, 0.5) from a linear congruential
+ * generator, cheap enough for gigabytes of noise.
+ */
+static float uniform(uint32_t *state) {
+    *state = 1664525 * *state + 1013904223;
+    return (float)*state / 4294967296.0f - 0.5f;
+}
+
+
+/**
+ * Print synthetic record `index` (see usage) to `f`.
+ *
+ * @return Number of bytes written.
+ */
+static long write_record(FILE *f, long index, int ch, uint32_t *state) {
+    const long point = index / 2;
+    const float freq = 10e3 + 10 * (point % 9000);
+    const float amp = 0.1 + 0.01 * (point % 91);
+    const float phase = 10 * (point % 36);
+    long n = fprintf(f, "%f\t%f\t%f\t%f\t%f\t%d", SYNTH_SAMPLERATE, freq, amp, phase, 0.0, ch);
+    const double w = 2*M_PI * freq / SYNTH_SAMPLERATE;
+    for (int i = 0; i < SYNTH_SAMPLES; i++) {
+        float noise = SYNTH_NOISE * (uniform(state) + uniform(state) + uniform(state));
+        n += fprintf(f, "\t%f", amp / ch * cos(w * i + phase * M_PI / 180) + noise);
+    }
+    return n + fprintf(f, "\n");
+}
+
+
+/**
+ * Write about `mbytes` of synthetic records to `path`.
+ *
+ * @return false on error (printed).
+ */
+static bool write_synthetic(const char *path, double mbytes) {
+    size_t n = strlen(path);
+    bool gz = n > 3 && strcmp(path + n - 3, ".gz") == 0;
+    FILE *f;
+    if (gz) {
+        char cmd[512];
+        snprintf(cmd, sizeof(cmd), "gzip -1 > '%s'", path);
+        f = popen(cmd, "w");
+    } else {
+        f = fopen(path, "w");
+    }
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    double start = monotonic_seconds();
+    uint32_t state = 1;
+    uint64_t bytes = 0;
+    long nrecords = 0;
+    while (bytes < mbytes * 1e6) {
+        bytes += write_record(f, nrecords, 1 + nrecords % 2, &state);
+        nrecords++;
+    }
+    bool ok = (gz ? pclose(f) == 0 : fclose(f) == 0);
+    fprintf(stderr, "Wrote %ld synthetic records (%.0f MB) in %.1f s.\n",
+            nrecords, 1e-6 * bytes, monotonic_seconds() - start);
+    return ok;
+}
+
+
+/**
+ * Time `parse_float` and `strtof` on all numbers of one record.
+ */
+static void benchmark_parser(void) {
+    FILE *tmp = tmpfile();
+    uint32_t state = 1;
+    long size = write_record(tmp, 0, 1, &state);
+    char *line = (char *)malloc(size + 1);
+    rewind(tmp);
+    if (fread(line, 1, size, tmp) != (size_t)size) size = 0;
+    line[size] = '\0';
+    fclose(tmp);
+
+    double t[2];
+    float sum[2] = {0, 0}, maxdev = 0;
+    long nvalues = 0;
+    for (int method = 0; method < 2; method++) {
+        double start = monotonic_seconds();
+        for (int k = 0; k < PARSE_REPEAT; k++) {
+            const char *p = line;
+            nvalues = 0;
+            while (true) {
+                const char *next;
+                float v = method == 0 ? parse_float(p, &next) : strtof(p, (char **)&next);
+                if (next == p) break;
+                sum[method] += v;
+                if (method == 1) {
+                    float fast = parse_float(p, &next);
+                    maxdev = fmaxf(maxdev, fabsf(fast - v) / fmaxf(fabsf(v), 1e-30));
+                }
+                p = next;
+                nvalues++;
+            }
+        }
+        t[method] = monotonic_seconds() - start;
+    }
+    // strtof additionally includes the comparison
+    printf("parse_float %.1f ns, strtof %.1f ns per value, max relative deviation %.1e\n",
+           1e9 * t[0] / (PARSE_REPEAT * nvalues), 1e9 * t[1] / (PARSE_REPEAT * nvalues) / 2,
+           maxdev);
+    free(line);
+}
+
+
+struct check {
+    float maxerr;
+    pthread_mutex_t lock;
+};
+
+
+/**
+ * Demodulate like demod_output and compare the amplitude to the
+ * synthetic one.
+ */
+static bool check_record(
+        const struct record *r, const float *samples,
+        struct records_output *out, void *ctx) {
+    struct check *c = (struct check *)ctx;
+    if (r->nsamples <= TRIGGER_SAMPLE) return false;
+    const int harmonic = 1;
+    float A, phi, offset, residual;
+    demodulate_harmonics_with_residual(
+        samples + TRIGGER_SAMPLE, r->nsamples - TRIGGER_SAMPLE, r->freq, &harmonic, 1,
+        r->samplerate, &A, &phi, &offset, &residual);
+    float err = fabsf(A / (r->amp / r->ch) - 1);
+    pthread_mutex_lock(&c->lock);
+    c->maxerr = fmaxf(c->maxerr, err);
+    pthread_mutex_unlock(&c->lock);
+    return records_append(out, r->meta, r->metalen)
+        && records_printf(out, "\t%d\t%e\t%e\t%e\t%e\n", harmonic, A, phi, offset, residual);
+}
+
+
+int main(int argc, char **argv) {
+    double mbytes = 2000;
+    int threads[MAX_THREADS] = {1, 2, 4};
+    int nthreads = 3;
+    if (argc >= 3) mbytes = strtod(argv[2], NULL);
+    if (argc == 4) nthreads = parse_cmd_line_int_list(argv[3], threads, MAX_THREADS);
+    if (argc < 2 || argc > 4 || !(mbytes > 0) || nthreads == 0) {
+        fprintf(stderr, "Invalid arguments.\n");
+        exit(1);
+    }
+    const char *path = argv[1];
+    if (access(path, F_OK) != 0 && !write_synthetic(path, mbytes)) exit(2);
+
+    benchmark_parser();
+
+    FILE *devnull = fopen("/dev/null", "w");
+    printf("threads\tseconds\tMB/s\trecords/s\tmaxerr\n");
+    for (int k = 0; k < nthreads; k++) {
+        struct check c = {0};
+        pthread_mutex_init(&c.lock, NULL);
+        FILE *in = records_open(path);
+        if (in == NULL) exit(2);
+        struct records_stats stats;
+        double start = monotonic_seconds();
+        bool ok = records_process(in, threads[k], 0, check_record, &c,
+                                  records_write_stream, devnull, &stats);
+        double duration = monotonic_seconds() - start;
+        ok = records_close(in, path) && ok;
+        if (!ok || stats.skipped > 0) {
+            fprintf(stderr, "Processing failed, %lu records skipped.\n", stats.skipped);
+            exit(2);
+        }
+        printf("%d\t%.2f\t%.1f\t%.1f\t%.1e\n", threads[k], duration,
+               1e-6 * stats.bytes / duration, stats.records / duration, c.maxerr);
+        fflush(stdout);
+        pthread_mutex_destroy(&c.lock);
+    }
+    fclose(devnull);
+    return 0;
+}
@@ -0,0 +1,324 @@
+/**
+ * Benchmarks and checks of the signal processing kernels on synthetic
+ * signals.  Runs on the CPU only, no acquisition.
+ *
+ * Usage: benchmark_dsp MODE [ARGS]
+ *
+ * Modes, each printing a header line and tab separated results:
+ *
+ *     decimate [R1,R2,...]
+ *         Software decimator (see decimate.h) on one full ADC buffer
+ *         at rates R, default 2,4,5,8,10,16,32,64.  For every rate
+ *
+ *             R TAPS MSPS RIPPLE_DB ALIAS_DB
+ *
+ *         with TAPS the number of CIC and FIR taps per output sample,
+ *         the throughput in input samples per second, the largest
+ *         deviation of the gain from 1 up to 0.2 of the output
+ *         samplerate and the largest gain of frequencies that alias
+ *         into that passband, both in dB.
+ *
+ *     demodulate [NSIGNALS]
+ *         `demodulate_iq` against the reference `demodulate` (see
+ *         demodulation.h) on full ADC buffers:
+ *
+ *             KERNEL MSPS_DEMODULATE MSPS_IQ AMP_DEV PHASE_DEV
+ *
+ *         with KERNEL the reference oscillator of `demodulate_iq`
+ *         (NEON, SSE or C), the throughput of both and the largest
+ *         relative deviation of the amplitude and deviation of the
+ *         phase [rad] for NSIGNALS (default 2000) random sines with
+ *         offset and noise.  Fails if a deviation is above the
+ *         documented tolerance of 1e-4.
+ *
+ *     stress [NCALLS [NSAMPLES]]
+ *         Memory leak check: NCALLS (default 1000000) calls on
+ *         signals of NSAMPLES (default 256) samples, taking turns
+ *         between all demodulation routines.
+ *
+ *             CALLS RSS_START_KB RSS_END_KB
+ *
+ *         with the maximum resident set size after the first round of
+ *         calls and at the end.  Fails if it grew by more than
+ *         STRESS_MAX_GROWTH_KB, which a routine leaking even 1 byte
+ *         per call exceeds with the default arguments.  `make stress`
+ *         builds and runs this mode.
+ *
+ * Exit status is 1 for invalid arguments or a failed check.  Build
+ * with CFLAGS+=-DDECIMATE_NO_SIMD or CFLAGS+=-DDEMOD_NO_SIMD to
+ * compare with plain C.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
+
+#include "decimate.h"
+#include "demodulation.h"
+#include "utility.h"
+
+
+#define BENCH_REPEAT 200
+#define BENCH_SAMPLERATE 1.953125e6  // 125MHz / 64
+// Test frequencies per band of the decimator
+#define BENCH_TONES 40
+#define BENCH_TOLERANCE 1e-4
+
+#define STRESS_MAX_GROWTH_KB 512
+#define STRESS_ROUTINES 7
+
+#if defined(DEMOD_NO_SIMD)
+#define BENCH_KERNEL "C"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BENCH_KERNEL "NEON"
+#elif defined(__SSE__)
+#define BENCH_KERNEL "SSE"
+#else
+#define BENCH_KERNEL "C"
+#endif
+
+
+static double uniform(double a, double b) {
+    return a + (b - a) * rand() / RAND_MAX;
+}
+
+
+/**
+ * Fill `buf` with A cos(2 pi f i + phi) + offset plus uniformly
+ * distributed noise in [-noise, noise], with `f` in cycles per
+ * sample.
+ */
+static void synthesize(float *buf, uint32_t n, double f, double A, double phi,
+                       double offset, double noise) {
+    for (uint32_t i = 0; i < n; i++)
+        buf[i] = A * cos(2*M_PI * f * i + phi) + offset + uniform(-noise, noise);
+}
+
+
+/**
+ * Throughput [samples / us] of BENCH_REPEAT calls on full ADC buffers
+ * since `start`.
+ */
+static double msps(double start) {
+    return 1e-6 * BENCH_REPEAT * RP_BUFFER_SIZE / (monotonic_seconds() - start);
+}
+
+
+/**
+ * Gain of the decimator for a sine with `f` cycles per input sample,
+ * demodulated at its (aliased) output frequency.
+ */
+static float gain(struct decimator *d, int rate, double f, float *in, float *out) {
+    synthesize(in, RP_BUFFER_SIZE, f, 1, 0, 0, 0);
+    uint32_t n = decimate(d, in, RP_BUFFER_SIZE, out);
+    double fout = fabs(remainder(f * rate, 1.0));
+    // Skip the edges, which are extended with constant samples
+    const uint32_t edge = DECIMATE_FIR_TAPS;
+    float A, phi, offset;
+    demodulate_iq(out + edge, n - 2*edge, fout, 1, &A, &phi, &offset);
+    return A;
+}
+
+
+static int bench_decimate(int argc, char **argv) {
+    int rates[DECIMATE_MAX_RATE] = {2, 4, 5, 8, 10, 16, 32, 64};
+    int nrates = 8;
+    if (argc == 1)
+        nrates = parse_cmd_line_int_list(argv[0], rates, DECIMATE_MAX_RATE);
+    if (argc > 1 || nrates == 0) {
+        fprintf(stderr, "Invalid arguments.\n");
+        return 1;
+    }
+
+    float *in = (float *)malloc(RP_BUFFER_SIZE * sizeof(float));
+    float *out = (float *)malloc(RP_BUFFER_SIZE * sizeof(float));
+
+    printf("R\ttaps\tMSPS\tripple_dB\talias_dB\n");
+    for (int r = 0; r < nrates; r++) {
+        const int rate = rates[r];
+        struct decimator *d = decimator_create(rate, RP_BUFFER_SIZE);
+        if (d == NULL) {
+            fprintf(stderr, "Invalid rate %d.\n", rate);
+            continue;
+        }
+
+        synthesize(in, RP_BUFFER_SIZE, 0, 0, 0, 0, 0.5);
+        double start = monotonic_seconds();
+        for (int k = 0; k < BENCH_REPEAT; k++)
+            decimate(d, in, RP_BUFFER_SIZE, out);
+        double throughput = msps(start);
+
+        // Passband and aliases of the passband from all Nyquist zones
+        float ripple = 0, alias = 0;
+        for (int t = 1; t <= BENCH_TONES; t++) {
+            double nu = 0.2 * t / BENCH_TONES;  // per output sample
+            ripple = fmaxf(ripple, fabsf(20 * log10f(gain(d, rate, nu / rate, in, out))));
+            for (int z = 1; z <= rate / 2; z++) {
+                for (int s = -1; s <= 1; s += 2) {
+                    double f = (z + s * nu) / rate;
+                    if (f < 0.5)
+                        alias = fmaxf(alias, gain(d, rate, f, in, out));
+                }
+            }
+        }
+        printf("%d\t%d\t%.1f\t%.3f\t%.1f\n", rate,
+               DECIMATE_CIC_ORDER * (rate - 1) + 1 + DECIMATE_FIR_TAPS,
+               throughput, ripple, 20 * log10f(alias));
+        decimator_free(d);
+    }
+    free(in);
+    free(out);
+    return 0;
+}
+
+
+/**
+ * Fill `signal` with a random sine of at least two periods plus
+ * offset and noise, return its frequency [Hz].
+ */
+static float random_signal(float *signal) {
+    const float f = uniform(2 * BENCH_SAMPLERATE / RP_BUFFER_SIZE, 0.4 * BENCH_SAMPLERATE);
+    const double A = uniform(0.01, 1), phi = uniform(-M_PI, M_PI);
+    synthesize(signal, RP_BUFFER_SIZE, f / BENCH_SAMPLERATE, A, phi,
+               uniform(-0.5, 0.5), 1e-3 * A);
+    return f;
+}
+
+
+static int bench_demodulate(int argc, char **argv) {
+    int nsignals = 2000;
+    if (argc == 1)
+        nsignals = atoi(argv[0]);
+    if (argc > 1 || nsignals <= 0) {
+        fprintf(stderr, "Invalid arguments.\n");
+        return 1;
+    }
+
+    float *signal = (float *)malloc(RP_BUFFER_SIZE * sizeof(float));
+    float A, phi, offset;
+
+    const float f = random_signal(signal);
+    double start = monotonic_seconds();
+    for (int k = 0; k < BENCH_REPEAT; k++)
+        demodulate(signal, RP_BUFFER_SIZE, f, BENCH_SAMPLERATE, &A, &phi, &offset);
+    double throughput = msps(start);
+    start = monotonic_seconds();
+    for (int k = 0; k < BENCH_REPEAT; k++)
+        demodulate_iq(signal, RP_BUFFER_SIZE, f, BENCH_SAMPLERATE, &A, &phi, &offset);
+    double throughput_iq = msps(start);
+
+    float ampdev = 0, phasedev = 0;
+    for (int s = 0; s < nsignals; s++) {
+        const float f = random_signal(signal);
+        float A_iq, phi_iq, offset_iq;
+        demodulate(signal, RP_BUFFER_SIZE, f, BENCH_SAMPLERATE, &A, &phi, &offset);
+        demodulate_iq(signal, RP_BUFFER_SIZE, f, BENCH_SAMPLERATE, &A_iq, &phi_iq, &offset_iq);
+        ampdev = fmaxf(ampdev, fabsf(A_iq - A) / A);
+        phasedev = fmaxf(phasedev, fabsf(wrap_phase(phi_iq - phi)));
+    }
+
+    printf("kernel\tMSPS\tMSPS_iq\tamp_dev\tphase_dev\n");
+    printf("%s\t%.1f\t%.1f\t%.1e\t%.1e\n", BENCH_KERNEL, throughput, throughput_iq,
+           ampdev, phasedev);
+    free(signal);
+    if (ampdev > BENCH_TOLERANCE || phasedev > BENCH_TOLERANCE) {
+        fprintf(stderr, "Deviation above tolerance of %g.\n", BENCH_TOLERANCE);
+        return 1;
+    }
+    return 0;
+}
+
+
+static long maxrss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/**
+ * Call demodulation routine `k` on the signals.
+ */
+static void stress_call(int k, const float *s1, const float *s2, size_t n, float f) {
+    static const int harmonics[3] = {1, 2, 3};
+    float A[3], phi[3], offset[3], residual[3];
+    struct phasor p1, p2, p21;
+    switch (k) {
+    case 0:
+        demodulate(s1, n, f, BENCH_SAMPLERATE, A, phi, offset);
+        break;
+    case 1:
+        demodulate_iq(s1, n, f, BENCH_SAMPLERATE, A, phi, offset);
+        break;
+    case 2:
+        demodulate_harmonics(s1, n, f, harmonics, 3, BENCH_SAMPLERATE, A, phi, offset);
+        break;
+    case 3:
+        demodulate_harmonics_with_residual(
+            s1, n, f, harmonics, 3, BENCH_SAMPLERATE, A, phi, offset, residual);
+        break;
+    case 4:
+        demodulate_with_residual(s1, n, f, BENCH_SAMPLERATE, A, phi, offset, residual);
+        break;
+    case 5:
+        p1 = demodulate_phasor(s1, n, f, BENCH_SAMPLERATE);
+        break;
+    case 6:
+        demodulate_pair(s1, s2, n, f, BENCH_SAMPLERATE, &p1, &p2, &p21);
+        break;
+    }
+}
+
+
+static int bench_stress(int argc, char **argv) {
+    long ncalls = 1000000;
+    long nsamples = 256;
+    if (argc >= 1)
+        ncalls = atol(argv[0]);
+    if (argc >= 2)
+        nsamples = atol(argv[1]);
+    if (argc > 2 || ncalls < STRESS_ROUTINES || nsamples <= 0) {
+        fprintf(stderr, "Invalid arguments.\n");
+        return 1;
+    }
+
+    float *s1 = (float *)malloc(nsamples * sizeof(float));
+    float *s2 = (float *)malloc(nsamples * sizeof(float));
+    // Several periods, not a whole number of them
+    const float f = 10.3 * BENCH_SAMPLERATE / nsamples;
+    synthesize(s1, nsamples, f / BENCH_SAMPLERATE, 0.5, 0, 0.1, 0);
+    synthesize(s2, nsamples, f / BENCH_SAMPLERATE, 0.2, 1, -0.1, 0);
+
+    // First round, such that lazy allocations (e.g. of libm) are done
+    for (int k = 0; k < STRESS_ROUTINES; k++)
+        stress_call(k, s1, s2, nsamples, f);
+    const long start = maxrss_kb();
+    for (long c = STRESS_ROUTINES; c < ncalls; c++)
+        stress_call(c % STRESS_ROUTINES, s1, s2, nsamples, f);
+    const long end = maxrss_kb();
+
+    printf("calls\tRSS_start_kB\tRSS_end_kB\n");
+    printf("%ld\t%ld\t%ld\n", ncalls, start, end);
+    free(s1);
+    free(s2);
+    if (end - start > STRESS_MAX_GROWTH_KB) {
+        fprintf(stderr, "Resident set size grew by %ld kB.\n", end - start);
+        return 1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    srand(1);
+    if (argc >= 2 && strcmp(argv[1], "decimate") == 0)
+        return bench_decimate(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "demodulate") == 0)
+        return bench_demodulate(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "stress") == 0)
+        return bench_stress(argc - 2, argv + 2);
+    fprintf(stderr, "Invalid mode.\n");
+    return 1;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "rp.h"
+
+#include "chain.h"
+#include "utility.h"
+
+
+#if defined(READY_BUS) && defined(FOLLOW)
+
+void chain_init(void) {
+    chain_busy();
+}
+
+bool chain_ready(uint32_t timeout_us) {
+    // Release the wired-AND bus
+    rp_DpinSetDirection(CHAIN_READY_PIN, RP_IN);
+    return true;
+}
+
+void chain_busy(void) {
+    // Pull the bus low, state first to avoid a glitch
+    rp_DpinSetState(CHAIN_READY_PIN, RP_LOW);
+    rp_DpinSetDirection(CHAIN_READY_PIN, RP_OUT);
+}
+
+#elif defined(READY_BUS)
+
+void chain_init(void) {
+    rp_DpinSetDirection(CHAIN_READY_PIN, RP_IN);
+}
+
+bool chain_ready(uint32_t timeout_us) {
+    static bool warned = false;
+    double deadline = monotonic_seconds() + 1e-6 * timeout_us;
+    rp_pinState_t state = RP_LOW;
+    while (true) {
+        rp_DpinGetState(CHAIN_READY_PIN, &state);
+        if (state == RP_HIGH) return true;
+        if (monotonic_seconds() >= deadline) break;
+        usleep(CHAIN_READY_POLL_US);
+    }
+    if (!warned) {
+        fprintf(stderr, "Ready bus still low after %uus, firing anyway.\n", timeout_us);
+        warned = true;
+    }
+    return false;
+}
+
+void chain_busy(void) {
+}
+
+#else
+
+void chain_init(void) {
+}
+
+bool chain_ready(uint32_t timeout_us) {
+#ifndef FOLLOW
+    // Leader of a chain of Red Pitayas waits
+    // so that others can catch up to here and are actually
+    // also awaiting the next trigger signal.
+    usleep(timeout_us);
+#endif
+    return true;
+}
+
+void chain_busy(void) {
+}
+
+#endif
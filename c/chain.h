@@ -0,0 +1,56 @@
+/**
+ * Synchronization of a chain of Red Pitayas.
+ *
+ * All devices share the external trigger: the leader fires it on
+ * DIO0_N, which is connected to DIO0_P (EXT_TRIG) of all devices.
+ * Followers are compiled with -DFOLLOW (see run-chain.sh).
+ *
+ * By default the leader waits a fixed time before firing, such that
+ * the followers are armed.  Compiled with -DREADY_BUS the pins
+ * CHAIN_READY_PIN of all devices form a wired-AND ready bus with a
+ * pull-up resistor (e.g. 4.7k to 3.3V).  Followers pull it low while
+ * not armed and release it when armed, the leader fires as soon as
+ * the bus is high.  The fixed time stays as timeout.
+ *
+ * Followers pull the bus low right after detecting the trigger.  The
+ * leader checks it again only after filling and reading its buffer,
+ * which is much longer than the detection latency.  In segmented mode
+ * of oscilloscope_gpio triggers follow faster, so there followers
+ * poll the trigger at most 20us apart and the leader checks the bus
+ * no earlier than 200us after the previous trigger.
+ */
+
+#ifndef __CHAIN_H
+#define __CHAIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Spare DIO line used as ready bus
+#define CHAIN_READY_PIN RP_DIO2_P
+// Leader polling interval of the ready bus
+#define CHAIN_READY_POLL_US 20
+
+
+/**
+ * Set up the ready bus pin.  Followers start as not armed.
+ */
+void chain_init(void);
+
+/**
+ * Call when armed, just before the leader fires the trigger.
+ *
+ * The leader waits until all followers are armed, at most
+ * `timeout_us` microseconds (without ready bus always the full
+ * time).  Followers signal that they are armed.
+ *
+ * @return false if the leader ran into the timeout with ready bus.
+ */
+bool chain_ready(uint32_t timeout_us);
+
+/**
+ * Call after the trigger fired: followers signal not armed.
+ */
+void chain_busy(void);
+
+#endif // __CHAIN_H
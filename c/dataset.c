@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dataset.h"
+
+
+_Static_assert(sizeof(struct dataset_header) == 32, "dataset header must have 32 bytes");
+_Static_assert(sizeof(struct dataset_record) == 40, "dataset record must have 40 bytes");
+_Static_assert(sizeof(struct dataset_axis) == 24, "dataset axis must have 24 bytes");
+_Static_assert(sizeof(struct dataset_entry) == 16, "dataset entry must have 16 bytes");
+_Static_assert(sizeof(struct dataset_trailer) == 32, "dataset trailer must have 32 bytes");
+
+// Largest int16 sample
+#define SAMPLE_MAX 32767
+// Sweep parameters kept per record for `dataset_derive_axes`
+#define NPARAMS 4
+
+
+static size_t padded(size_t n) {
+    return (n + DATASET_ALIGN - 1) / DATASET_ALIGN * DATASET_ALIGN;
+}
+
+
+size_t dataset_record_size(uint32_t nsamples) {
+    return sizeof(struct dataset_record) + padded(nsamples * sizeof(int16_t));
+}
+
+
+void dataset_encode(void *block, const struct dataset_record *meta,
+                    const float *samples, uint32_t n) {
+    struct dataset_record *r = (struct dataset_record *)block;
+    int16_t *out = (int16_t *)(r + 1);
+    float maxabs = 0;
+    for (uint32_t i = 0; i < n; i++)
+        maxabs = fmaxf(maxabs, fabsf(samples[i]));
+    *r = *meta;
+    r->magic = DATASET_RECORD_MAGIC;
+    r->nsamples = n;
+    r->reserved = 0;
+    r->scale = maxabs > 0 && isfinite(maxabs) ? maxabs / SAMPLE_MAX : 1;
+    const float inverse = 1 / r->scale;
+    for (uint32_t i = 0; i < n; i++) {
+        float v = samples[i] * inverse;
+        if (!(v == v)) v = 0;
+        out[i] = lrintf(fminf(fmaxf(v, -SAMPLE_MAX), SAMPLE_MAX));
+    }
+    memset(out + n, 0, dataset_record_size(n) - sizeof(*r) - n * sizeof(int16_t));
+}
+
+
+/**
+ * Records are written right away, axes and index are kept in memory
+ * until `dataset_finish`.  `offset` counts the bytes written, since
+ * the stream may be a pipe.
+ */
+struct dataset_writer {
+    FILE *stream;
+    uint64_t offset;
+    bool ok;
+    struct dataset_header header;
+
+    struct dataset_entry *index;
+    float (*params)[NPARAMS];    // freq, amp, phase, ch2delay per record
+    uint64_t nrecords, capacity;
+
+    int naxes;
+    struct dataset_axis axes[DATASET_MAX_AXES];
+    float *values[DATASET_MAX_AXES];
+
+    void *block;                 // encoded record of `dataset_write`
+    size_t blocksize;
+};
+
+
+static void write_bytes(struct dataset_writer *w, const void *data, size_t n) {
+    if (n > 0 && fwrite(data, 1, n, w->stream) != n) w->ok = false;
+    w->offset += n;
+}
+
+
+static void write_padding(struct dataset_writer *w) {
+    static const char zeros[DATASET_ALIGN];
+    write_bytes(w, zeros, padded(w->offset) - w->offset);
+}
+
+
+struct dataset_writer *dataset_create(FILE *stream, const char *program, uint32_t trigger) {
+    struct dataset_writer *w = (struct dataset_writer *)calloc(1, sizeof(struct dataset_writer));
+    if (w == NULL) return NULL;
+    w->stream = stream;
+    w->ok = true;
+    w->header.magic = DATASET_MAGIC;
+    w->header.version = DATASET_VERSION;
+    w->header.trigger = trigger;
+    strncpy(w->header.program, program, sizeof(w->header.program) - 1);
+    write_bytes(w, &w->header, sizeof(w->header));
+    return w;
+}
+
+
+/**
+ * Declare axis `name` with `npoints` values and return the storage
+ * for them, NULL on allocation failure or too many axes.
+ */
+static float *new_axis(struct dataset_writer *w, const char *name, uint32_t npoints) {
+    if (w->naxes >= DATASET_MAX_AXES) return NULL;
+    // At least one element, so that NULL only means failure
+    float *values = (float *)malloc((npoints > 0 ? npoints : 1) * sizeof(float));
+    if (values == NULL) return NULL;
+    struct dataset_axis *a = &w->axes[w->naxes];
+    memset(a, 0, sizeof(*a));
+    strncpy(a->name, name, sizeof(a->name) - 1);
+    a->npoints = npoints;
+    w->values[w->naxes++] = values;
+    return values;
+}
+
+
+bool dataset_add_axis(
+        struct dataset_writer *w, const char *name, const float *values, uint32_t npoints) {
+    float *copy = new_axis(w, name, npoints);
+    if (copy == NULL) return false;
+    memcpy(copy, values, npoints * sizeof(float));
+    return true;
+}
+
+
+bool dataset_add_sweep(struct dataset_writer *w, const struct sweep *sweep) {
+    for (int a = 0; a < sweep->naxes; a++) {
+        const struct sweep_axis *axis = &sweep->axes[a];
+        float *values = new_axis(w, axis->name, axis->npoints);
+        if (values == NULL) return false;
+        for (int i = 0; i < axis->npoints; i++)
+            values[i] = sweep_axis_value(axis, i);
+    }
+    return true;
+}
+
+
+/**
+ * Add index entry for record `r` at the current offset.
+ */
+static bool add_entry(struct dataset_writer *w, uint32_t point, const struct dataset_record *r) {
+    if (w->nrecords == w->capacity) {
+        uint64_t capacity = w->capacity > 0 ? 2 * w->capacity : 1024;
+        struct dataset_entry *index = (struct dataset_entry *)realloc(
+            w->index, capacity * sizeof(struct dataset_entry));
+        if (index == NULL) return false;
+        w->index = index;
+        float (*params)[NPARAMS] = (float (*)[NPARAMS])realloc(
+            w->params, capacity * sizeof(*params));
+        if (params == NULL) return false;
+        w->params = params;
+        w->capacity = capacity;
+    }
+    struct dataset_entry *e = &w->index[w->nrecords];
+    e->offset = w->offset;
+    e->point = point;
+    e->ch = r->ch;
+    float *p = w->params[w->nrecords];
+    p[0] = r->freq;
+    p[1] = r->amp;
+    p[2] = r->phase;
+    p[3] = r->ch2delay;
+    w->nrecords++;
+    return true;
+}
+
+
+bool dataset_write(
+        struct dataset_writer *w, uint32_t point, const struct dataset_record *meta,
+        const float *samples, uint32_t n) {
+    size_t size = dataset_record_size(n);
+    if (size > w->blocksize) {
+        void *block = realloc(w->block, size);
+        if (block == NULL) return false;
+        w->block = block;
+        w->blocksize = size;
+    }
+    dataset_encode(w->block, meta, samples, n);
+    if (!add_entry(w, point, (const struct dataset_record *)w->block)) return false;
+    write_bytes(w, w->block, size);
+    return w->ok;
+}
+
+
+bool dataset_write_blocks(struct dataset_writer *w, const void *data, size_t n) {
+    const uint8_t *p = (const uint8_t *)data, *end = p + n;
+    while (p < end) {
+        struct dataset_record r;
+        if (end - p < (ptrdiff_t)sizeof(r)) return false;
+        memcpy(&r, p, sizeof(r));
+        size_t size = dataset_record_size(r.nsamples);
+        if (r.magic != DATASET_RECORD_MAGIC || end - p < (ptrdiff_t)size
+                || !add_entry(w, DATASET_NO_POINT, &r))
+            return false;
+        write_bytes(w, p, size);
+        p += size;
+    }
+    return w->ok;
+}
+
+
+/**
+ * Ascending order with NAN after all numbers and equal to NAN.
+ */
+static int compare_floats(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    bool xnan = isnan(x), ynan = isnan(y);
+    if (xnan || ynan) return xnan - ynan;
+    return (x > y) - (x < y);
+}
+
+
+bool dataset_derive_axes(struct dataset_writer *w) {
+    static const char *names[NPARAMS] = {"f", "amp", "phase", "ch2delay"};
+    if (w->naxes > 0) return false;
+    float *values = (float *)malloc((w->nrecords + 1) * sizeof(float));
+    if (values == NULL) return false;
+    for (int k = 0; k < NPARAMS; k++) {
+        uint32_t n = 0;
+        for (uint64_t i = 0; i < w->nrecords; i++)
+            values[i] = w->params[i][k];
+        qsort(values, w->nrecords, sizeof(float), compare_floats);
+        for (uint64_t i = 0; i < w->nrecords; i++)
+            if (n == 0 || compare_floats(&values[i], &values[n-1]) != 0)
+                values[n++] = values[i];
+        if (!dataset_add_axis(w, names[k], values, n)) {
+            free(values);
+            return false;
+        }
+    }
+    free(values);
+
+    // Points must fit into uint32_t, with DATASET_NO_POINT to spare
+    uint64_t npoints = 1;
+    for (int k = 0; k < NPARAMS; k++) {
+        npoints *= w->axes[k].npoints;
+        if (npoints > UINT32_MAX) return false;
+    }
+
+    for (uint64_t i = 0; i < w->nrecords; i++) {
+        uint32_t point = 0;
+        for (int k = 0; k < NPARAMS; k++) {
+            const float *found = (const float *)bsearch(
+                &w->params[i][k], w->values[k], w->axes[k].npoints,
+                sizeof(float), compare_floats);
+            // All values are on the axis, NAN as last value
+            uint32_t idx = found ? found - w->values[k] : w->axes[k].npoints - 1;
+            point = point * w->axes[k].npoints + idx;
+        }
+        w->index[i].point = point;
+    }
+    return true;
+}
+
+
+bool dataset_finish(struct dataset_writer *w) {
+    struct dataset_trailer trailer = {
+        .nrecords = w->nrecords,
+        .naxes = w->naxes,
+        .magic = DATASET_END_MAGIC,
+    };
+    write_padding(w);
+    trailer.axes = w->offset;
+    for (int a = 0; a < w->naxes; a++) {
+        write_bytes(w, &w->axes[a], sizeof(w->axes[a]));
+        write_bytes(w, w->values[a], w->axes[a].npoints * sizeof(float));
+        write_padding(w);
+    }
+    trailer.index = w->offset;
+    write_bytes(w, w->index, w->nrecords * sizeof(struct dataset_entry));
+    write_bytes(w, &trailer, sizeof(trailer));
+    bool ok = fflush(w->stream) == 0 && w->ok;
+
+    for (int a = 0; a < w->naxes; a++)
+        free(w->values[a]);
+    free(w->index);
+    free(w->params);
+    free(w->block);
+    free(w);
+    return ok;
+}
+
+
+static struct dataset *dataset_invalid(struct dataset *d, const char *path) {
+    fprintf(stderr, "%s: invalid dataset.\n", path);
+    dataset_close(d);
+    return NULL;
+}
+
+
+/**
+ * Key of a record for `dataset_find`, sorted by point and channel.
+ */
+struct dataset_key {
+    uint32_t point;
+    int32_t ch;
+    uint64_t record;
+};
+
+static int compare_keys(const void *a, const void *b) {
+    const struct dataset_key *x = (const struct dataset_key *)a;
+    const struct dataset_key *y = (const struct dataset_key *)b;
+    if (x->point != y->point) return x->point < y->point ? -1 : 1;
+    return (x->ch > y->ch) - (x->ch < y->ch);
+}
+
+
+struct dataset *dataset_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    struct dataset *d = (struct dataset *)calloc(1, sizeof(struct dataset));
+    if (d == NULL || fstat(fd, &st) != 0) {
+        perror(path);
+        free(d);
+        close(fd);
+        return NULL;
+    }
+    d->size = st.st_size;
+    if (d->size < sizeof(struct dataset_header) + sizeof(struct dataset_trailer)) {
+        close(fd);
+        return dataset_invalid(d, path);
+    }
+    void *map = mmap(NULL, d->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        free(d);
+        return NULL;
+    }
+    d->map = (const uint8_t *)map;
+
+    d->header = (const struct dataset_header *)d->map;
+    const struct dataset_trailer *t = (const struct dataset_trailer *)
+        (d->map + d->size - sizeof(struct dataset_trailer));
+    if (d->header->magic != DATASET_MAGIC || d->header->version != DATASET_VERSION
+            || t->magic != DATASET_END_MAGIC || t->naxes > DATASET_MAX_AXES
+            || t->index > d->size - sizeof(*t) || t->axes > t->index
+            || t->nrecords != (d->size - sizeof(*t) - t->index) / sizeof(struct dataset_entry))
+        return dataset_invalid(d, path);
+    d->nrecords = t->nrecords;
+    d->index = (const struct dataset_entry *)(d->map + t->index);
+
+    uint64_t offset = t->axes;
+    for (d->naxes = 0; d->naxes < t->naxes; d->naxes++) {
+        if (offset + sizeof(struct dataset_axis) > t->index)
+            return dataset_invalid(d, path);
+        const struct dataset_axis *a = (const struct dataset_axis *)(d->map + offset);
+        offset += sizeof(*a);
+        if (offset + a->npoints * sizeof(float) > t->index)
+            return dataset_invalid(d, path);
+        d->axes[d->naxes] = a;
+        d->values[d->naxes] = (const float *)(d->map + offset);
+        offset = padded(offset + a->npoints * sizeof(float));
+    }
+
+    d->sorted = (struct dataset_key *)malloc(d->nrecords * sizeof(struct dataset_key));
+    if (d->sorted == NULL && d->nrecords > 0) return dataset_invalid(d, path);
+    for (uint64_t i = 0; i < d->nrecords; i++) {
+        d->sorted[i].point = d->index[i].point;
+        d->sorted[i].ch = d->index[i].ch;
+        d->sorted[i].record = i;
+    }
+    qsort(d->sorted, d->nrecords, sizeof(struct dataset_key), compare_keys);
+    return d;
+}
+
+
+void dataset_close(struct dataset *d) {
+    if (d == NULL) return;
+    if (d->map != NULL) munmap((void *)d->map, d->size);
+    free(d->sorted);
+    free(d);
+}
+
+
+const struct dataset_record *dataset_record(const struct dataset *d, uint64_t i) {
+    if (i >= d->nrecords) return NULL;
+    uint64_t offset = d->index[i].offset;
+    if (offset + sizeof(struct dataset_record) > d->size) return NULL;
+    const struct dataset_record *r = (const struct dataset_record *)(d->map + offset);
+    if (r->magic != DATASET_RECORD_MAGIC || offset + dataset_record_size(r->nsamples) > d->size)
+        return NULL;
+    return r;
+}
+
+
+const int16_t *dataset_samples(const struct dataset_record *r) {
+    return (const int16_t *)(r + 1);
+}
+
+
+void dataset_volts(const struct dataset_record *r, float *out) {
+    const int16_t *samples = dataset_samples(r);
+    for (uint32_t i = 0; i < r->nsamples; i++)
+        out[i] = r->scale * samples[i];
+}
+
+
+int64_t dataset_find(const struct dataset *d, uint32_t point, int32_t ch) {
+    const struct dataset_key key = {point, ch, 0};
+    const struct dataset_key *found = (const struct dataset_key *)bsearch(
+        &key, d->sorted, d->nrecords, sizeof(struct dataset_key), compare_keys);
+    return found ? (int64_t)found->record : -1;
+}
@@ -0,0 +1,247 @@
+#ifndef __DATASET_H
+#define __DATASET_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sweep.h"
+
+
+/**
+ * Indexed binary dataset of sweep results, to replace gzip'd text
+ * where single sweep points are needed: every record can be found in
+ * O(1) through the index and read in place from a memory mapped file.
+ *
+ * Layout of a file (all offsets from the start of the file):
+ *
+ *     struct dataset_header
+ *     records: struct dataset_record, nsamples int16 samples
+ *     axes:    struct dataset_axis, npoints float32 values (per axis)
+ *     index:   struct dataset_entry (per record)
+ *     struct dataset_trailer
+ *
+ * Every block is padded with zeros to a multiple of DATASET_ALIGN
+ * bytes.  The axes and the index follow the records, so a dataset can
+ * be written to a pipe like the text output (e.g. through run.sh);
+ * readers start at the trailer at the end of the file.
+ *
+ * All fields are in native byte order, which is little endian on Red
+ * Pitaya as well as on x86 hosts.  The structs have no padding.  See
+ * live-explorer/rpdataset.py for the NumPy reader.
+ */
+
+// Magic numbers ("RPDS", "RPRC" and "RPDE" when read as little endian
+// bytes)
+#define DATASET_MAGIC 0x53445052
+#define DATASET_RECORD_MAGIC 0x43525052
+#define DATASET_END_MAGIC 0x45445052
+#define DATASET_VERSION 1
+
+#define DATASET_ALIGN 8
+#define DATASET_MAX_AXES SWEEP_MAX_AXES
+// Point of records from text without sweep information
+#define DATASET_NO_POINT UINT32_MAX
+
+
+/**
+ * File header, 32 bytes (python struct format "<IHHII16s").
+ */
+struct dataset_header {
+    uint32_t magic;        // DATASET_MAGIC
+    uint16_t version;      // DATASET_VERSION
+    uint16_t reserved;     // 0
+    uint32_t trigger;      // sample index of the trigger position
+    uint32_t reserved2;    // 0
+    char program[16];      // writing program, '\0' padded
+};
+
+
+/**
+ * Header of a record, 40 bytes (python struct format "<IIi6fI"),
+ * followed by `nsamples` int16 samples of one buffer.  Volts are
+ * `scale` times the samples.
+ */
+struct dataset_record {
+    uint32_t magic;        // DATASET_RECORD_MAGIC
+    uint32_t nsamples;
+    int32_t ch;            // channel, negative for variances
+    float samplerate;      // [Hz]
+    float freq;            // [Hz]
+    float amp;             // [V]
+    float phase;           // [deg]
+    float ch2delay;        // [s]
+    float scale;           // [V per LSB]
+    uint32_t reserved;     // 0
+};
+
+
+/**
+ * Sweep axis, 24 bytes (python struct format "<16sI4x"), followed by
+ * `npoints` float32 values.
+ */
+struct dataset_axis {
+    char name[16];         // '\0' padded
+    uint32_t npoints;
+    uint32_t reserved;     // 0
+};
+
+
+/**
+ * Index entry of a record, 16 bytes (python struct format "<QIi").
+ */
+struct dataset_entry {
+    uint64_t offset;       // of the struct dataset_record
+    uint32_t point;        // index of the sweep point in nested order of the axes
+    int32_t ch;            // same as in the record
+};
+
+
+/**
+ * End of the file, 32 bytes (python struct format "<QQQHHI").
+ */
+struct dataset_trailer {
+    uint64_t axes;         // offset of the first struct dataset_axis
+    uint64_t index;        // offset of the index
+    uint64_t nrecords;     // entries in the index
+    uint16_t naxes;
+    uint16_t reserved;     // 0
+    uint32_t magic;        // DATASET_END_MAGIC
+};
+
+
+/**
+ * Bytes of record header and padded samples.
+ */
+size_t dataset_record_size(uint32_t nsamples);
+
+/**
+ * Encode `n` samples [V] with metadata `meta` (magic, nsamples and
+ * scale are set here) into `block` of `dataset_record_size(n)` bytes.
+ * The scale is chosen such that the largest magnitude is 32767, i.e.
+ * the rounding error is below 1.6e-5 of the largest magnitude and
+ * well below the resolution of the 14 bit ADC.  NAN is stored as 0.
+ */
+void dataset_encode(void *block, const struct dataset_record *meta,
+                    const float *samples, uint32_t n);
+
+
+struct dataset_writer;
+
+
+/**
+ * Start writing a dataset to `stream`, which may be a pipe.
+ *
+ * @return NULL on allocation failure.
+ */
+struct dataset_writer *dataset_create(FILE *stream, const char *program, uint32_t trigger);
+
+/**
+ * Declare a sweep axis.  Axes may be declared any time before
+ * `dataset_finish`.
+ *
+ * @return false on allocation failure or too many axes.
+ */
+bool dataset_add_axis(
+    struct dataset_writer *w, const char *name, const float *values, uint32_t npoints);
+
+/**
+ * Declare all axes of `sweep`, whose nested index is the point of
+ * the records.
+ */
+bool dataset_add_sweep(struct dataset_writer *w, const struct sweep *sweep);
+
+/**
+ * Encode and write one record of sweep point `point`.
+ *
+ * @return false on write error.
+ */
+bool dataset_write(
+    struct dataset_writer *w, uint32_t point, const struct dataset_record *meta,
+    const float *samples, uint32_t n);
+
+/**
+ * Write records encoded by `dataset_encode`, one after the other in
+ * `data`, with point DATASET_NO_POINT.
+ *
+ * @return false on invalid records or write error.
+ */
+bool dataset_write_blocks(struct dataset_writer *w, const void *data, size_t n);
+
+/**
+ * Declare the axes `f`, `amp`, `phase` and `ch2delay` from the
+ * distinct values of freq, amp, phase and ch2delay of all records
+ * written so far (in ascending order) and set their points, e.g.
+ * after converting text output.  All NAN values of a parameter
+ * become one value at the end of its axis.
+ *
+ * @return false on allocation failure, if axes were declared or if
+ *     the axes span more than UINT32_MAX points.
+ */
+bool dataset_derive_axes(struct dataset_writer *w);
+
+/**
+ * Write axes, index and trailer and free the writer.  Does not close
+ * the stream.
+ *
+ * @return false if any write failed.
+ */
+bool dataset_finish(struct dataset_writer *w);
+
+
+struct dataset_key;
+
+/**
+ * Dataset opened for reading, memory mapped.  All pointers point into
+ * the mapped file.
+ */
+struct dataset {
+    const struct dataset_header *header;
+    uint64_t nrecords;
+    const struct dataset_entry *index;
+    int naxes;
+    const struct dataset_axis *axes[DATASET_MAX_AXES];
+    const float *values[DATASET_MAX_AXES];
+
+    const uint8_t *map;
+    size_t size;
+    struct dataset_key *sorted;   // records by point and channel
+};
+
+
+/**
+ * Map dataset at `path` and check header, trailer, axes and index.
+ *
+ * @return NULL on error (printed).
+ */
+struct dataset *dataset_open(const char *path);
+
+void dataset_close(struct dataset *d);
+
+/**
+ * Record `i` (in order of writing) in O(1).
+ *
+ * @return NULL if out of range or invalid.
+ */
+const struct dataset_record *dataset_record(const struct dataset *d, uint64_t i);
+
+/**
+ * Samples following record header `r`.
+ */
+const int16_t *dataset_samples(const struct dataset_record *r);
+
+/**
+ * Convert the samples of `r` to volts in `out` (r->nsamples values).
+ */
+void dataset_volts(const struct dataset_record *r, float *out);
+
+/**
+ * Find the record of channel `ch` at sweep point `point` in
+ * O(log(nrecords)).
+ *
+ * @return Number of the record, -1 if there is none.
+ */
+int64_t dataset_find(const struct dataset *d, uint32_t point, int32_t ch);
+
+#endif // __DATASET_H
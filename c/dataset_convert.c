@@ -0,0 +1,148 @@
+/**
+ * Convert recorded text output, e.g. the output.gz of run-chain.sh, to
+ * an indexed binary dataset (see dataset.h) on the host.  Built with
+ * `make SIM=1 dataset_convert.x`.
+ *
+ * Input lines are the full buffer output of u1_drive1:
+ *
+ *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH SAMPLES...
+ *
+ * Lines are converted in parallel on several threads (see records.h)
+ * and stored in input order.  The sweep axes `f`, `amp`, `phase` and
+ * `ch2delay` are the distinct values of the metadata columns, the
+ * point of a record is its nested index along these axes.
+ *
+ * Usage: dataset_convert [OPTIONS] INPUT OUTPUT
+ *
+ * INPUT is read from stdin for `-`, files ending in `.gz` are
+ * decompressed on the fly.
+ *
+ * Options:
+ *
+ *     --trigger N        Trigger position stored in the header,
+ *                        default 200.
+ *     --index            Lines are prefixed with four sweep indices
+ *                        (u1_drive1 --index), which are dropped.
+ *     --threads N        Worker threads, default number of CPUs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "dataset.h"
+#include "records.h"
+#include "utility.h"
+
+
+#define TRIGGER_SAMPLE 200
+#define NINDEX 4
+
+
+/**
+ * Encode one record.  Runs on a worker thread.
+ */
+static bool encode_record(
+        const struct record *r, const float *samples,
+        struct records_output *out, void *ctx) {
+    const struct dataset_record meta = {
+        .ch = r->ch,
+        .samplerate = r->samplerate,
+        .freq = r->freq,
+        .amp = r->amp,
+        .phase = r->phase,
+        .ch2delay = r->ch2delay,
+    };
+    void *block = records_extend(out, dataset_record_size(r->nsamples));
+    if (block == NULL) return false;
+    dataset_encode(block, &meta, samples, r->nsamples);
+    return true;
+}
+
+
+/**
+ * Write encoded records in input order.  Runs on the writer thread.
+ */
+static bool write_blocks(const void *data, size_t n, void *ctx) {
+    return dataset_write_blocks((struct dataset_writer *)ctx, data, n);
+}
+
+
+int main(int argc, char **argv) {
+    uint32_t trigger = TRIGGER_SAMPLE;
+    int nindex = 0;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    static const struct option options[] = {
+        {"trigger", required_argument, NULL, 'T'},
+        {"index", no_argument, NULL, 'i'},
+        {"threads", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 'T':
+            trigger = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            nindex = NINDEX;
+            break;
+        case 't':
+            nthreads = strtol(optarg, NULL, 10);
+            if (nthreads < 1) {
+                fprintf(stderr, "Invalid number of threads.\n");
+                exit(1);
+            }
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc != 3) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        exit(1);
+    }
+    const char *inpath = argv[1], *outpath = argv[2];
+    if (nthreads < 1) nthreads = 1;
+
+    FILE *in = records_open(inpath);
+    if (in == NULL) exit(2);
+    FILE *out = fopen(outpath, "w");
+    if (out == NULL) {
+        perror(outpath);
+        exit(2);
+    }
+    struct dataset_writer *w = dataset_create(out, "dataset_convert", trigger);
+    if (w == NULL) {
+        fprintf(stderr, "Dataset setup failed!\n");
+        exit(2);
+    }
+
+    double start = monotonic_seconds();
+    struct records_stats stats;
+    bool ok = records_process(in, nthreads, nindex, encode_record, NULL,
+                              write_blocks, w, &stats);
+    if (!records_close(in, inpath)) {
+        fprintf(stderr, "Reading %s failed.\n", inpath);
+        ok = false;
+    }
+    if (!dataset_derive_axes(w)) {
+        fprintf(stderr, "Deriving axes failed, more than 2^32 points?\n");
+        ok = false;
+    }
+    ok = dataset_finish(w) && ok;
+    long size = ftell(out);
+    ok = fclose(out) == 0 && ok;
+    if (!ok) fprintf(stderr, "Writing %s failed.\n", outpath);
+
+    double duration = monotonic_seconds() - start;
+    fprintf(stderr, "%lu records, %lu skipped, %.1f MB text to %.1f MB in %.2f s (%.1f MB/s).\n",
+            stats.records, stats.skipped, 1e-6 * stats.bytes, 1e-6 * size, duration,
+            1e-6 * stats.bytes / duration);
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,131 @@
+/**
+ * Print records of an indexed binary dataset (see dataset.h) as text,
+ * e.g. to check a conversion or to feed a single sweep point to text
+ * tools.  Only the selected records are read from the file.
+ *
+ * Usage: dataset_print [OPTIONS] FILE [RECORD...]
+ *
+ * Without RECORD numbers or --point, prints a summary of the dataset
+ * and its sweep axes.
+ *
+ * Options:
+ *
+ *     --point P          Print the records of sweep point P (nested
+ *                        index along the axes).
+ *     --ch C             With --point, only channel C.
+ *
+ * Output data format (tab separated) to stdout, the same as u1_drive1
+ * with samples in volts:
+ *
+ *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH SAMPLES...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "dataset.h"
+
+
+// Channels tried with --point but without --ch, negative for variances
+#define MAX_CHANNEL 16
+
+
+static void print_record(const struct dataset_record *r, float *volts) {
+    printf("%f\t%f\t%f\t%f\t%f\t%d", r->samplerate, r->freq, r->amp, r->phase,
+           r->ch2delay, r->ch);
+    dataset_volts(r, volts);
+    for (uint32_t i = 0; i < r->nsamples; i++)
+        printf("\t%f", volts[i]);
+    printf("\n");
+}
+
+
+static void print_summary(const struct dataset *d) {
+    printf("program %.16s, trigger at sample %u, %" PRIu64 " records\n",
+           d->header->program, d->header->trigger, d->nrecords);
+    for (int a = 0; a < d->naxes; a++) {
+        uint32_t n = d->axes[a]->npoints;
+        printf("axis %.16s: %u points", d->axes[a]->name, n);
+        if (n > 0) printf(" from %g to %g", d->values[a][0], d->values[a][n-1]);
+        printf("\n");
+    }
+}
+
+
+int main(int argc, char **argv) {
+    long point = -1;
+    int channel = 0;
+
+    static const struct option options[] = {
+        {"point", required_argument, NULL, 'p'},
+        {"ch", required_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            point = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            channel = strtol(optarg, NULL, 10);
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc < 2) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        exit(1);
+    }
+
+    struct dataset *d = dataset_open(argv[1]);
+    if (d == NULL) exit(2);
+    // Largest record for the conversion to volts
+    uint32_t maxsamples = 0;
+    float *volts = NULL;
+    int status = 0;
+
+    // Records to print, from the command line or found by point
+    int64_t records[argc + 2*MAX_CHANNEL];
+    int nrecords = 0;
+    for (int i = 2; i < argc; i++)
+        records[nrecords++] = strtoll(argv[i], NULL, 10);
+    if (point >= 0) {
+        for (int ch = -MAX_CHANNEL; ch <= MAX_CHANNEL; ch++) {
+            if (channel != 0 && ch != channel) continue;
+            int64_t found = dataset_find(d, point, ch);
+            if (found >= 0) records[nrecords++] = found;
+        }
+        if (nrecords == 0) {
+            fprintf(stderr, "No records of point %ld.\n", point);
+            status = 3;
+        }
+    } else if (nrecords == 0) {
+        print_summary(d);
+    }
+
+    for (int k = 0; k < nrecords; k++) {
+        const struct dataset_record *r = records[k] >= 0 ? dataset_record(d, records[k]) : NULL;
+        if (r == NULL) {
+            fprintf(stderr, "Invalid record %" PRId64 ".\n", records[k]);
+            status = 3;
+            continue;
+        }
+        if (r->nsamples > maxsamples) {
+            maxsamples = r->nsamples;
+            free(volts);
+            volts = (float *)malloc(maxsamples * sizeof(float));
+            if (volts == NULL) exit(2);
+        }
+        print_record(r, volts);
+    }
+    free(volts);
+    dataset_close(d);
+    return status;
+}
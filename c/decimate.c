@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(DECIMATE_NO_SIMD)
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DECIMATE_NEON
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define DECIMATE_SSE
+#endif
+
+#include "decimate.h"
+
+
+// Band edges of the compensating FIR relative to the output samplerate
+#define DECIMATE_PASS 0.25
+#define DECIMATE_STOP 0.4
+// Frequency grid for the FIR design
+#define DECIMATE_DESIGN_POINTS 1024
+
+
+/**
+ * Kernels are padded with zeros to a multiple of 4 taps.  Input and
+ * intermediate samples are copied to buffers with extended ends, so
+ * every output is a dot product over contiguous memory.
+ */
+struct decimator {
+    uint32_t rate, maxsize;
+    float *cic, *fir;          // kernels, symmetric
+    uint32_t ncic, nfir;       // taps before padding
+    uint32_t ncic4, nfir4;     // taps after padding
+    uint32_t padin;            // extension of the input on each side
+    float *xpad, *ypad;        // extended input and CIC output
+};
+
+
+static uint32_t round4(uint32_t n) {
+    return (n + 3) / 4 * 4;
+}
+
+
+/**
+ * Dot product of `n` (multiple of 4) samples in four lanes.
+ */
+static float dot(const float *a, const float *b, uint32_t n) {
+    float acc[4];
+#if defined(DECIMATE_NEON)
+    float32x4_t v = vdupq_n_f32(0);
+    for (uint32_t i = 0; i < n; i += 4)
+        v = vmlaq_f32(v, vld1q_f32(a + i), vld1q_f32(b + i));
+    vst1q_f32(acc, v);
+#elif defined(DECIMATE_SSE)
+    __m128 v = _mm_setzero_ps();
+    for (uint32_t i = 0; i < n; i += 4)
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    _mm_storeu_ps(acc, v);
+#else
+    acc[0] = acc[1] = acc[2] = acc[3] = 0;
+    for (uint32_t i = 0; i < n; i += 4)
+        for (int l = 0; l < 4; l++)
+            acc[l] += a[i+l] * b[i+l];
+#endif
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+
+/** Amplitude response of the CIC stage at `nu` cycles per output sample. */
+static double cic_response(double nu, uint32_t rate) {
+    if (nu == 0) return 1;
+    double h = sin(M_PI*nu) / (rate * sin(M_PI*nu / rate));
+    return pow(fabs(h), DECIMATE_CIC_ORDER);
+}
+
+
+/**
+ * Windowed frequency sampling design of the compensating FIR: inverse
+ * CIC response in the passband, cosine taper to zero at the stopband.
+ */
+static void design_fir(float *fir, uint32_t ntaps, uint32_t rate) {
+    const int half = ntaps / 2;
+    const double dnu = 0.5 / DECIMATE_DESIGN_POINTS;
+    double sum = 0;
+    for (int k = -half; k <= half; k++) {
+        double h = 0;
+        for (int g = 0; g <= DECIMATE_DESIGN_POINTS; g++) {
+            double nu = g * dnu, d = 0;
+            if (nu <= DECIMATE_PASS)
+                d = 1;
+            else if (nu < DECIMATE_STOP)
+                d = 0.5 * (1 + cos(M_PI * (nu - DECIMATE_PASS) / (DECIMATE_STOP - DECIMATE_PASS)));
+            d /= cic_response(nu, rate);
+            double w = (g == 0 || g == DECIMATE_DESIGN_POINTS) ? 0.5 : 1;
+            h += 2 * w * d * cos(2*M_PI*nu*k) * dnu;
+        }
+        h *= 0.54 + 0.46 * cos(M_PI * k / (half + 1));  // Hamming
+        fir[k + half] = h;
+        sum += h;
+    }
+    for (uint32_t k = 0; k < ntaps; k++)
+        fir[k] /= sum;
+}
+
+
+struct decimator *decimator_create(uint32_t rate, uint32_t maxsize) {
+    if (rate < 2 || rate > DECIMATE_MAX_RATE) return NULL;
+    struct decimator *d = (struct decimator *)calloc(1, sizeof(struct decimator));
+    if (d == NULL) return NULL;
+    d->rate = rate;
+    d->maxsize = maxsize;
+    d->ncic = DECIMATE_CIC_ORDER * (rate - 1) + 1;
+    d->nfir = DECIMATE_FIR_TAPS;
+    d->ncic4 = round4(d->ncic);
+    d->nfir4 = round4(d->nfir);
+    // CIC outputs are needed up to nfir/2 outside of the buffer.
+    d->padin = (d->nfir / 2) * rate + d->ncic4;
+    d->cic = (float *)calloc(d->ncic4, sizeof(float));
+    d->fir = (float *)calloc(d->nfir4, sizeof(float));
+    d->xpad = (float *)malloc((maxsize + 2*d->padin) * sizeof(float));
+    d->ypad = (float *)calloc(maxsize / rate + d->nfir4, sizeof(float));
+    if (!d->cic || !d->fir || !d->xpad || !d->ypad) {
+        decimator_free(d);
+        return NULL;
+    }
+
+    // Cascade of boxcars by repeated convolution, unit DC gain
+    d->cic[0] = 1;
+    uint32_t len = 1;
+    for (int o = 0; o < DECIMATE_CIC_ORDER; o++) {
+        for (uint32_t i = len + rate - 1; i-- > 0; ) {
+            float s = 0;
+            for (uint32_t j = 0; j < rate; j++)
+                if (i >= j && i - j < len) s += d->cic[i-j];
+            d->cic[i] = s / rate;
+        }
+        len += rate - 1;
+    }
+    design_fir(d->fir, d->nfir, rate);
+    return d;
+}
+
+
+void decimator_free(struct decimator *d) {
+    if (d == NULL) return;
+    free(d->cic);
+    free(d->fir);
+    free(d->xpad);
+    free(d->ypad);
+    free(d);
+}
+
+
+uint32_t decimate(struct decimator *d, const float *in, uint32_t n, float *out) {
+    if (n > d->maxsize) n = d->maxsize;
+    const uint32_t nout = n / d->rate;
+    if (nout == 0) return 0;
+    const int half = d->nfir / 2;
+
+    // Input with ends extended by the first and last sample
+    float *x = d->xpad + d->padin;
+    memcpy(x, in, n * sizeof(float));
+    for (uint32_t i = 1; i <= d->padin; i++) {
+        x[-(long)i] = in[0];
+        x[n-1+i] = in[n-1];
+    }
+
+    // CIC at output rate m = -half ... nout-1+half, centred on m*R
+    const long centre = (d->ncic - 1) / 2;
+    for (long m = -half; m < (long)nout + half; m++)
+        d->ypad[m + half] = dot(d->cic, x + m * (long)d->rate + centre - (d->ncic - 1), d->ncic4);
+
+    // Compensating FIR, centred on the same output sample
+    for (uint32_t m = 0; m < nout; m++)
+        out[m] = dot(d->fir, d->ypad + m, d->nfir4);
+    return nout;
+}
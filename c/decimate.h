@@ -0,0 +1,55 @@
+#ifndef __DECIMATE_H
+#define __DECIMATE_H
+
+#include <stdint.h>
+
+
+// Largest software decimation factor
+#define DECIMATE_MAX_RATE 64
+// Order of the CIC stage
+#define DECIMATE_CIC_ORDER 4
+// Taps of the compensating FIR at the output rate (odd)
+#define DECIMATE_FIR_TAPS 21
+
+
+/**
+ * Software decimation by an arbitrary integer factor R, e.g. to reach
+ * sampling rates between the hardware decimation steps.
+ *
+ * Two stages: a CIC filter of order DECIMATE_CIC_ORDER (a cascade of
+ * boxcars of length R, evaluated non-recursively at the output rate
+ * because float integrators lose precision), followed by a FIR at the
+ * output rate that compensates the CIC droop up to 0.25 and suppresses
+ * everything above 0.4 of the output samplerate.  Aliases into the
+ * passband are only suppressed by the CIC stage, by about 48 dB up to
+ * 0.2 of the output samplerate and more towards DC.  Both stages are
+ * symmetric (zero phase): output sample m belongs to input sample m*R
+ * (within half an input sample for even R).  Buffer ends are extended
+ * with the first and last sample.
+ *
+ * Filtering is done in dot products of four float lanes (NEON, SSE or
+ * plain C like demodulation.c).
+ */
+struct decimator;
+
+
+/**
+ * Prepare decimation by `rate` of buffers with up to `maxsize`
+ * samples.  All memory is allocated here.
+ *
+ * @return NULL for invalid rate or on allocation failure.
+ */
+struct decimator *decimator_create(uint32_t rate, uint32_t maxsize);
+
+
+void decimator_free(struct decimator *d);
+
+
+/**
+ * Decimate `n` <= maxsize samples from `in` to n / R samples in `out`.
+ *
+ * @return Number of output samples.
+ */
+uint32_t decimate(struct decimator *d, const float *in, uint32_t n, float *out);
+
+#endif // __DECIMATE_H
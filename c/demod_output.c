@@ -0,0 +1,153 @@
+/**
+ * Demodulate recorded buffers on the host, e.g. the output.gz of
+ * run-chain.sh, instead of parsing the text in Python.  Built on the
+ * host with `make SIM=1 demod_output.x`.
+ *
+ * Input lines are the full buffer output of u1_drive1:
+ *
+ *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH SAMPLES...
+ *
+ * Every buffer is demodulated at harmonics of FREQ like u1_drive1
+ * --demod does on the Red Pitaya, lines are processed in parallel on
+ * several threads (see records.h).
+ *
+ * Usage: demod_output [OPTIONS] [FILE]
+ *
+ * FILE is read from stdin if missing or `-`, files ending in `.gz`
+ * are decompressed on the fly.
+ *
+ * Options:
+ *
+ *     --demod H1,H2,...  Harmonics of FREQ to demodulate, default 1.
+ *     --skip N           Samples before the trigger, not demodulated,
+ *                        default 200.
+ *     --index            Lines are prefixed with four sweep indices
+ *                        (u1_drive1 --index), copied to the output.
+ *     --threads N        Worker threads, default number of CPUs.
+ *
+ * Output data format (tab separated) to stdout, in input order and
+ * the same as u1_drive1 --demod: for every harmonic H the amplitude A,
+ * phase PH (relative to the trigger), DC offset and residual RES (see
+ * demodulation.h):
+ *
+ *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH H1 A1 PH1 DC1 RES1 H2 A2 ...
+ *
+ * The metadata columns are copied unchanged.  Lines of variances
+ * (negative CH) and invalid lines are skipped and counted on stderr,
+ * together with the throughput.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "demodulation.h"
+#include "records.h"
+#include "utility.h"
+
+
+#define TRIGGER_SAMPLE 200
+#define NINDEX 4
+
+
+struct demod_options {
+    int harmonics[DEMOD_BANK_SIZE];
+    int nharmonics;
+    uint32_t skip;
+};
+
+
+/**
+ * Demodulate one buffer.  Runs on a worker thread.
+ */
+static bool demod_record(
+        const struct record *r, const float *samples,
+        struct records_output *out, void *ctx) {
+    const struct demod_options *opts = (const struct demod_options *)ctx;
+    if (r->ch < 0 || r->nsamples <= opts->skip) return false;
+    const int nh = opts->nharmonics;
+    float A[nh], phi[nh], offset[nh], residual[nh];
+    demodulate_harmonics_with_residual(
+        samples + opts->skip, r->nsamples - opts->skip, r->freq, opts->harmonics, nh,
+        r->samplerate, A, phi, offset, residual);
+    bool ok = records_append(out, r->meta, r->metalen);
+    for (int k = 0; k < nh; k++)
+        ok = ok && records_printf(out, "\t%d\t%e\t%e\t%e\t%e",
+                                  opts->harmonics[k], A[k], phi[k], offset[k], residual[k]);
+    return ok && records_append(out, "\n", 1);
+}
+
+
+int main(int argc, char **argv) {
+    struct demod_options opts = {
+        .harmonics = {1},
+        .nharmonics = 1,
+        .skip = TRIGGER_SAMPLE,
+    };
+    int nindex = 0;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    static const struct option options[] = {
+        {"demod", required_argument, NULL, 'm'},
+        {"skip", required_argument, NULL, 's'},
+        {"index", no_argument, NULL, 'i'},
+        {"threads", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            opts.nharmonics = parse_cmd_line_int_list(optarg, opts.harmonics, DEMOD_BANK_SIZE);
+            if (opts.nharmonics == 0) {
+                fprintf(stderr, "Invalid harmonics.\n");
+                exit(1);
+            }
+            break;
+        case 's':
+            opts.skip = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            nindex = NINDEX;
+            break;
+        case 't':
+            nthreads = strtol(optarg, NULL, 10);
+            if (nthreads < 1) {
+                fprintf(stderr, "Invalid number of threads.\n");
+                exit(1);
+            }
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc > 2) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        exit(1);
+    }
+    const char *path = argc == 2 ? argv[1] : "-";
+    if (nthreads < 1) nthreads = 1;
+
+    FILE *in = records_open(path);
+    if (in == NULL) exit(2);
+    double start = monotonic_seconds();
+    struct records_stats stats;
+    bool ok = records_process(in, nthreads, nindex, demod_record, &opts,
+                              records_write_stream, stdout, &stats);
+    ok = fflush(stdout) == 0 && ok;
+    double duration = monotonic_seconds() - start;
+    if (!records_close(in, path)) {
+        fprintf(stderr, "Reading %s failed.\n", path);
+        ok = false;
+    }
+
+    fprintf(stderr, "%lu records, %lu skipped, %.1f MB in %.2f s (%.1f MB/s, %d threads).\n",
+            stats.records, stats.skipped, 1e-6 * stats.bytes, duration,
+            1e-6 * stats.bytes / duration, nthreads);
+    return ok ? 0 : 2;
+}
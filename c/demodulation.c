@@ -1,10 +1,28 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <complex.h>
+// Variables are named I and Q for in-phase and quadrature components.
+#undef I
+
+#if defined(DEMOD_NO_SIMD)
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DEMOD_NEON
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define DEMOD_SSE
+#endif
 
 #include "demodulation.h"
 
 
+// Number of samples after which the float lane oscillators are
+// re-seeded from the double precision master oscillator.  Must be a
+// multiple of 4.
+#define OSC_BLOCK 64
+
+
 float mean(const float *buf, const size_t n) {
     float m = 0;
     for (size_t i = 0; i < n; i++)
@@ -34,7 +52,8 @@ float integrate_trapezoidal(const float *buf, const size_t n, const float dx) {
 
 
 /**
- * Integrate signal after multiplication with harmonic signal.
+ * Integrate signal after removing a DC offset and multiplication with
+ * harmonic signal.
  *
  * Trapezoidal rule: sum(dx * (buf[i] + buf[i+1]) / 2)
  * = dx / 2 * (buf[0] + 2 * buf[1] + ... + 2 * buf[n-2] + buf[n-1])
@@ -44,45 +63,561 @@ float integrate_trapezoidal(const float *buf, const size_t n, const float dx) {
  * @param dx Spacing of data points.
  * @param f Frequency of modulation [per sample]
  * @param phase Phase of modulation [rad].
+ * @param offset Subtracted from every data point.
  */
 float integrate_modulated_trapezoidal(
         const float *buf, const size_t n, const float dx,
-        const float f, const float phase) {
+        const float f, const float phase, const float offset) {
     if (n == 0) return 0;
     else if (n == 1) {
-        return buf[0] * dx * cos(phase);
+        return (buf[0] - offset) * dx * cos(phase);
     } else {
         float ret = 0;
-        ret += buf[0] * cos(phase);
+        ret += (buf[0] - offset) * cos(phase);
         for (size_t i = 1; i < (n-1); i++)
-            ret += 2 * buf[i] * cos(2*M_PI * f * i + phase);
-        ret += buf[n-1] * cos(2*M_PI * f * (n-1) + phase);
+            ret += 2 * (buf[i] - offset) * cos(2*M_PI * f * i + phase);
+        ret += (buf[n-1] - offset) * cos(2*M_PI * f * (n-1) + phase);
         return ret * dx / 2.0;
     }
 }
 
 
+/**
+ * Number of samples in `n` samples covering only complete periods of
+ * frequency `f`.
+ */
+static uint32_t complete_periods(const size_t n, const float f, const float samplerate) {
+    return floor((float)n * f / samplerate) * samplerate / f;
+}
+
+
 void demodulate(
         const float *signal, const size_t n,
         const float f, const float samplerate,
         float *A, float *phi, float *offset) {
     // truncate to complete periods
-    uint32_t nsamples = floor((float)n * f / samplerate) * samplerate / f;
+    uint32_t nsamples = complete_periods(n, f, samplerate);
     float dc = *offset = mean(signal, nsamples);
 
-    float *tmpsignal = (float *)malloc(nsamples * sizeof(float));
-    for (uint32_t i = 0; i < nsamples; i++)
-        tmpsignal[i] = signal[i] - dc;
-
+    // DC offset is subtracted on the fly instead of on a copy of the
+    // signal, the result is the same.
     float I = integrate_modulated_trapezoidal(
-        tmpsignal, nsamples, 1.0, f/samplerate, 0.0);
+        signal, nsamples, 1.0, f/samplerate, 0.0, dc);
     float Q = integrate_modulated_trapezoidal(
-        tmpsignal, nsamples, 1.0, f/samplerate, -M_PI/2.0);
+        signal, nsamples, 1.0, f/samplerate, -M_PI/2.0, dc);
     *A = sqrt(I*I + Q*Q) * 2.0 / nsamples;
     *phi = atan2(-Q, I);
 }
 
 
+/**
+ * Complex oscillator exp(i w k) for sample index k.
+ *
+ * A double precision master oscillator is advanced by one block of
+ * OSC_BLOCK samples by complex multiplication and renormalized to
+ * unit magnitude.  Within a block four float lanes, offset by one
+ * sample each, are advanced by four samples per step.
+ */
+struct oscillator {
+    double c, s;         // exp(i w k) at start of current block
+    double bc, bs;       // exp(i w OSC_BLOCK)
+    float lc[4], ls[4];  // exp(i w l) for lane l
+    float vc, vs;        // exp(i w 4)
+};
+
+
+static void oscillator_init(struct oscillator *osc, const double w, const size_t start) {
+    osc->c = cos(w * start);
+    osc->s = sin(w * start);
+    osc->bc = cos(w * OSC_BLOCK);
+    osc->bs = sin(w * OSC_BLOCK);
+    for (int l = 0; l < 4; l++) {
+        osc->lc[l] = cos(w * l);
+        osc->ls[l] = sin(w * l);
+    }
+    osc->vc = cos(w * 4);
+    osc->vs = sin(w * 4);
+}
+
+
+static void oscillator_normalize(struct oscillator *osc) {
+    // first order correction of magnitude, |z| stays 1 within 1e-15
+    double norm = 1.5 - 0.5 * (osc->c * osc->c + osc->s * osc->s);
+    osc->c *= norm;
+    osc->s *= norm;
+}
+
+
+static void oscillator_next_block(struct oscillator *osc) {
+    double c = osc->c * osc->bc - osc->s * osc->bs;
+    double s = osc->c * osc->bs + osc->s * osc->bc;
+    osc->c = c;
+    osc->s = s;
+    oscillator_normalize(osc);
+}
+
+
+/**
+ * Sum of exp(i w k) for k from 0 to n-1 (geometric series).
+ */
+static void oscillator_sum(const double w, const size_t n, double *c, double *s) {
+    double wr = remainder(w, 2*M_PI);
+    if (fabs(wr) < 1e-12) {
+        *c = n;
+        *s = 0;
+        return;
+    }
+    double g = sin(n * wr / 2) / sin(wr / 2);
+    *c = g * cos(wr * (n-1) / 2);
+    *s = g * sin(wr * (n-1) / 2);
+}
+
+
+/**
+ * Sums of x, x*cos and x*sin accumulated in double precision.
+ */
+struct iq_sums {
+    double x, xc, xs;
+};
+
+
+/**
+ * Accumulate `len` <= OSC_BLOCK samples starting at the current block
+ * of oscillator `osc`.  Does not advance the oscillator.
+ */
+static void iq_block(
+        const float *x, const size_t len,
+        const struct oscillator *osc, struct iq_sums *sums) {
+    float c[4], s[4], ax[4], ac[4], as[4];
+    for (int l = 0; l < 4; l++) {
+        c[l] = osc->c * osc->lc[l] - osc->s * osc->ls[l];
+        s[l] = osc->c * osc->ls[l] + osc->s * osc->lc[l];
+    }
+    const size_t nvec = len / 4;
+
+#if defined(DEMOD_NEON)
+    float32x4_t vc = vld1q_f32(c), vs = vld1q_f32(s);
+    const float32x4_t rc = vdupq_n_f32(osc->vc), rs = vdupq_n_f32(osc->vs);
+    float32x4_t vax = vdupq_n_f32(0), vac = vax, vas = vax;
+    for (size_t m = 0; m < nvec; m++) {
+        float32x4_t v = vld1q_f32(x + 4*m);
+        vax = vaddq_f32(vax, v);
+        vac = vmlaq_f32(vac, v, vc);
+        vas = vmlaq_f32(vas, v, vs);
+        float32x4_t tc = vmlsq_f32(vmulq_f32(vc, rc), vs, rs);
+        vs = vmlaq_f32(vmulq_f32(vc, rs), vs, rc);
+        vc = tc;
+    }
+    vst1q_f32(c, vc);
+    vst1q_f32(s, vs);
+    vst1q_f32(ax, vax);
+    vst1q_f32(ac, vac);
+    vst1q_f32(as, vas);
+#elif defined(DEMOD_SSE)
+    __m128 vc = _mm_loadu_ps(c), vs = _mm_loadu_ps(s);
+    const __m128 rc = _mm_set1_ps(osc->vc), rs = _mm_set1_ps(osc->vs);
+    __m128 vax = _mm_setzero_ps(), vac = vax, vas = vax;
+    for (size_t m = 0; m < nvec; m++) {
+        __m128 v = _mm_loadu_ps(x + 4*m);
+        vax = _mm_add_ps(vax, v);
+        vac = _mm_add_ps(vac, _mm_mul_ps(v, vc));
+        vas = _mm_add_ps(vas, _mm_mul_ps(v, vs));
+        __m128 tc = _mm_sub_ps(_mm_mul_ps(vc, rc), _mm_mul_ps(vs, rs));
+        vs = _mm_add_ps(_mm_mul_ps(vc, rs), _mm_mul_ps(vs, rc));
+        vc = tc;
+    }
+    _mm_storeu_ps(c, vc);
+    _mm_storeu_ps(s, vs);
+    _mm_storeu_ps(ax, vax);
+    _mm_storeu_ps(ac, vac);
+    _mm_storeu_ps(as, vas);
+#else
+    for (int l = 0; l < 4; l++) ax[l] = ac[l] = as[l] = 0;
+    for (size_t m = 0; m < nvec; m++) {
+        for (int l = 0; l < 4; l++) {
+            float v = x[4*m + l];
+            ax[l] += v;
+            ac[l] += v * c[l];
+            as[l] += v * s[l];
+            float tc = c[l] * osc->vc - s[l] * osc->vs;
+            s[l] = c[l] * osc->vs + s[l] * osc->vc;
+            c[l] = tc;
+        }
+    }
+#endif
+
+    // Remaining samples continue in lanes 0 to 2.
+    for (size_t l = 0; l < len % 4; l++) {
+        float v = x[4*nvec + l];
+        ax[l] += v;
+        ac[l] += v * c[l];
+        as[l] += v * s[l];
+    }
+    sums->x += (ax[0] + ax[1]) + (ax[2] + ax[3]);
+    sums->xc += (ac[0] + ac[1]) + (ac[2] + ac[3]);
+    sums->xs += (as[0] + as[1]) + (as[2] + as[3]);
+}
+
+
+/**
+ * Amplitude, phase and DC offset from sums over `nsamples` samples
+ * with oscillator frequency `w` [rad / sample].
+ *
+ * If `subtrahend` is not NULL, the sums are over the difference
+ * signal - subtrahend.
+ */
+static void iq_result(
+        const float *signal, const float *subtrahend,
+        const uint32_t nsamples, const double w,
+        const struct iq_sums *sums,
+        float *A, float *phi, float *offset) {
+    if (nsamples == 0) {
+        *A = *offset = NAN;
+        *phi = 0;
+        return;
+    }
+    double dc = sums->x / nsamples;
+
+    // Trapezoidal rule: half weight for first and last sample.
+    const uint32_t last = nsamples - 1;
+    double xfirst = signal[0], xlast = signal[last];
+    if (subtrahend != NULL) {
+        xfirst -= subtrahend[0];
+        xlast -= subtrahend[last];
+    }
+    const double clast = cos(w * last), slast = sin(w * last);
+    double I = sums->xc - 0.5 * (xfirst + xlast * clast);
+    double Q = sums->xs - 0.5 * xlast * slast;
+    // Subtract contribution of DC offset.
+    double sc, ss;
+    oscillator_sum(w, nsamples, &sc, &ss);
+    I -= dc * (sc - 0.5 * (1 + clast));
+    Q -= dc * (ss - 0.5 * slast);
+
+    *offset = dc;
+    *A = sqrt(I*I + Q*Q) * 2.0 / nsamples;
+    *phi = atan2(-Q, I);
+}
+
+
+void demodulate_bank(
+        const float *signal, const size_t n,
+        const float *f, const size_t nf, const float samplerate,
+        float *A, float *phi, float *offset) {
+    for (size_t k0 = 0; k0 < nf; k0 += DEMOD_BANK_SIZE) {
+        const size_t nbank = (nf - k0 < DEMOD_BANK_SIZE) ? nf - k0 : DEMOD_BANK_SIZE;
+        struct oscillator osc[DEMOD_BANK_SIZE];
+        struct iq_sums sums[DEMOD_BANK_SIZE];
+        uint32_t nsamples[DEMOD_BANK_SIZE];
+        double w[DEMOD_BANK_SIZE];
+        uint32_t nmax = 0;
+        for (size_t k = 0; k < nbank; k++) {
+            nsamples[k] = complete_periods(n, f[k0+k], samplerate);
+            if (nsamples[k] > nmax) nmax = nsamples[k];
+            // Use the same single precision frequency as `demodulate`.
+            const float fs = f[k0+k] / samplerate;
+            w[k] = 2*M_PI * fs;
+            oscillator_init(&osc[k], w[k], 0);
+            sums[k] = (struct iq_sums){0, 0, 0};
+        }
+
+        // One pass over the signal, each block is processed for all
+        // frequencies while it is in cache.
+        for (uint32_t i = 0; i < nmax; i += OSC_BLOCK) {
+            for (size_t k = 0; k < nbank; k++) {
+                if (i >= nsamples[k]) continue;
+                uint32_t len = nsamples[k] - i;
+                iq_block(signal + i, (len < OSC_BLOCK) ? len : OSC_BLOCK, &osc[k], &sums[k]);
+                oscillator_next_block(&osc[k]);
+            }
+        }
+
+        for (size_t k = 0; k < nbank; k++)
+            iq_result(signal, NULL, nsamples[k], w[k], &sums[k],
+                      &A[k0+k], &phi[k0+k], &offset[k0+k]);
+    }
+}
+
+
+void demodulate_iq(
+        const float *signal, const size_t n,
+        const float f, const float samplerate,
+        float *A, float *phi, float *offset) {
+    demodulate_bank(signal, n, &f, 1, samplerate, A, phi, offset);
+}
+
+
+void demodulate_harmonics(
+        const float *signal, const size_t n,
+        const float f, const int *harmonics, const size_t nh,
+        const float samplerate,
+        float *A, float *phi, float *offset) {
+    float freqs[DEMOD_BANK_SIZE];
+    for (size_t k0 = 0; k0 < nh; k0 += DEMOD_BANK_SIZE) {
+        const size_t nbank = (nh - k0 < DEMOD_BANK_SIZE) ? nh - k0 : DEMOD_BANK_SIZE;
+        for (size_t k = 0; k < nbank; k++)
+            freqs[k] = harmonics[k0+k] * f;
+        demodulate_bank(signal, n, freqs, nbank, samplerate,
+                        A + k0, phi + k0, offset + k0);
+    }
+}
+
+
+/**
+ * Sums of x, x^2, x*cos and x*sin accumulated in double precision.
+ */
+struct fit_sums {
+    double x, xx, xc, xs;
+};
+
+
+/**
+ * Accumulate `len` samples with a double precision oscillator that is
+ * advanced by one sample per step.
+ */
+static void fit_run(
+        const float *x, const size_t len,
+        struct oscillator *osc, const double rc, const double rs,
+        struct fit_sums *sums) {
+    double c = osc->c, s = osc->s;
+    double ax = 0, axx = 0, ac = 0, as = 0;
+    for (size_t i = 0; i < len; i++) {
+        double v = x[i];
+        ax += v;
+        axx += v * v;
+        ac += v * c;
+        as += v * s;
+        double tc = c * rc - s * rs;
+        s = c * rs + s * rc;
+        c = tc;
+    }
+    osc->c = c;
+    osc->s = s;
+    sums->x += ax;
+    sums->xx += axx;
+    sums->xc += ac;
+    sums->xs += as;
+}
+
+
+/**
+ * Standard deviation of signal from reconstruction with amplitude A,
+ * phase phi and DC offset o over `n` samples with sums over all
+ * samples.
+ */
+static float fit_residual(
+        const size_t n, const double w, const struct fit_sums *sums,
+        const double A, const double phi, const double o) {
+    double sc, ss, s2c, s2s;
+    oscillator_sum(w, n, &sc, &ss);
+    oscillator_sum(2*w, n, &s2c, &s2s);
+    // sum (x - o)^2
+    double xx = sums->xx - 2 * o * sums->x + n * o * o;
+    // sum (x - o) cos(w i + phi)
+    double xr = cos(phi) * (sums->xc - o * sc) - sin(phi) * (sums->xs - o * ss);
+    // sum cos^2(w i + phi) = n/2 + 1/2 sum cos(2 w i + 2 phi)
+    double rr = 0.5 * n + 0.5 * (cos(2*phi) * s2c - sin(2*phi) * s2s);
+    double d = xx - 2 * A * xr + A * A * rr;
+    return (d > 0) ? sqrt(d / n) : 0;
+}
+
+
+static void demodulate_bank_with_residual(
+        const float *signal, const size_t n,
+        const float *f, const size_t nf, const float samplerate,
+        float *A, float *phi, float *offset, float *residual) {
+    // Demodulation uses the single precision frequency of `demodulate`
+    // on complete periods, the residual the double precision frequency
+    // of `deviation_from_reconstruction` on all samples.
+    struct oscillator osc[DEMOD_BANK_SIZE], oscres[DEMOD_BANK_SIZE];
+    struct fit_sums sums[DEMOD_BANK_SIZE], sumsres[DEMOD_BANK_SIZE];
+    uint32_t nsamples[DEMOD_BANK_SIZE];
+    double w[DEMOD_BANK_SIZE], rc[DEMOD_BANK_SIZE], rs[DEMOD_BANK_SIZE];
+    double wres[DEMOD_BANK_SIZE], rcres[DEMOD_BANK_SIZE], rsres[DEMOD_BANK_SIZE];
+    for (size_t k = 0; k < nf; k++) {
+        nsamples[k] = complete_periods(n, f[k], samplerate);
+        const float fs = f[k] / samplerate;
+        w[k] = 2*M_PI * fs;
+        rc[k] = cos(w[k]);
+        rs[k] = sin(w[k]);
+        oscillator_init(&osc[k], w[k], 0);
+        sums[k] = (struct fit_sums){0, 0, 0, 0};
+
+        wres[k] = 2*M_PI * f[k] / samplerate;
+        rcres[k] = cos(wres[k]);
+        rsres[k] = sin(wres[k]);
+        oscillator_init(&oscres[k], wres[k], 0);
+        sumsres[k] = (struct fit_sums){0, 0, 0, 0};
+    }
+
+    for (size_t i = 0; i < n; i += OSC_BLOCK) {
+        const size_t len = (n - i < OSC_BLOCK) ? n - i : OSC_BLOCK;
+        for (size_t k = 0; k < nf; k++) {
+            if (i < nsamples[k]) {
+                size_t lendemod = (nsamples[k] - i < len) ? nsamples[k] - i : len;
+                fit_run(signal + i, lendemod, &osc[k], rc[k], rs[k], &sums[k]);
+                oscillator_normalize(&osc[k]);
+            }
+            fit_run(signal + i, len, &oscres[k], rcres[k], rsres[k], &sumsres[k]);
+            oscillator_normalize(&oscres[k]);
+        }
+    }
+
+    for (size_t k = 0; k < nf; k++) {
+        struct iq_sums iq = {sums[k].x, sums[k].xc, sums[k].xs};
+        iq_result(signal, NULL, nsamples[k], w[k], &iq, &A[k], &phi[k], &offset[k]);
+        residual[k] = fit_residual(n, wres[k], &sumsres[k], A[k], phi[k], offset[k]);
+    }
+}
+
+
+void demodulate_with_residual(
+        const float *signal, const size_t n,
+        const float f, const float samplerate,
+        float *A, float *phi, float *offset, float *residual) {
+    demodulate_bank_with_residual(signal, n, &f, 1, samplerate, A, phi, offset, residual);
+}
+
+
+void demodulate_harmonics_with_residual(
+        const float *signal, const size_t n,
+        const float f, const int *harmonics, const size_t nh,
+        const float samplerate,
+        float *A, float *phi, float *offset, float *residual) {
+    float freqs[DEMOD_BANK_SIZE];
+    for (size_t k0 = 0; k0 < nh; k0 += DEMOD_BANK_SIZE) {
+        const size_t nbank = (nh - k0 < DEMOD_BANK_SIZE) ? nh - k0 : DEMOD_BANK_SIZE;
+        for (size_t k = 0; k < nbank; k++)
+            freqs[k] = harmonics[k0+k] * f;
+        demodulate_bank_with_residual(
+            signal, n, freqs, nbank, samplerate,
+            A + k0, phi + k0, offset + k0, residual + k0);
+    }
+}
+
+
+static struct phasor make_phasor(float A, float phi, float offset, float residual) {
+    struct phasor p = {A * cexpf(_Complex_I * phi), offset, residual};
+    return p;
+}
+
+
+struct phasor demodulate_phasor(
+        const float *signal, const size_t n,
+        const float f, const float samplerate) {
+    float A, phi, offset, residual;
+    demodulate_with_residual(signal, n, f, samplerate, &A, &phi, &offset, &residual);
+    return make_phasor(A, phi, offset, residual);
+}
+
+
+/**
+ * `demodulate_pair` over the first `nsamples` of `n` samples, the
+ * residuals over all `n`.
+ */
+static void demodulate_pair_samples(
+        const float *signal1, const float *signal2, const size_t n, const uint32_t nsamples,
+        const float f, const float samplerate,
+        struct phasor *p1, struct phasor *p2, struct phasor *p21) {
+    // Frequencies as in `demodulate_bank_with_residual`.
+    const float fs = f / samplerate;
+    const double w = 2*M_PI * fs;
+    const double wres = 2*M_PI * f / samplerate;
+    const double rc = cos(w), rs = sin(w), rcres = cos(wres), rsres = sin(wres);
+
+    struct oscillator osc[2], oscres[2];
+    struct fit_sums sums[2], sumsres[2];
+    const float *signals[2] = {signal1, signal2};
+    double x1x2 = 0;
+    for (int c = 0; c < 2; c++) {
+        oscillator_init(&osc[c], w, 0);
+        oscillator_init(&oscres[c], wres, 0);
+        sums[c] = sumsres[c] = (struct fit_sums){0, 0, 0, 0};
+    }
+
+    for (size_t i = 0; i < n; i += OSC_BLOCK) {
+        const size_t len = (n - i < OSC_BLOCK) ? n - i : OSC_BLOCK;
+        for (int c = 0; c < 2; c++) {
+            if (i < nsamples) {
+                size_t lendemod = (nsamples - i < len) ? nsamples - i : len;
+                fit_run(signals[c] + i, lendemod, &osc[c], rc, rs, &sums[c]);
+                oscillator_normalize(&osc[c]);
+            }
+            fit_run(signals[c] + i, len, &oscres[c], rcres, rsres, &sumsres[c]);
+            oscillator_normalize(&oscres[c]);
+        }
+        for (size_t j = i; j < i + len; j++)
+            x1x2 += (double)signal1[j] * signal2[j];
+    }
+
+    float A, phi, offset;
+    struct phasor *results[2] = {p1, p2};
+    for (int c = 0; c < 2; c++) {
+        struct iq_sums iq = {sums[c].x, sums[c].xc, sums[c].xs};
+        iq_result(signals[c], NULL, nsamples, w, &iq, &A, &phi, &offset);
+        *results[c] = make_phasor(
+            A, phi, offset, fit_residual(n, wres, &sumsres[c], A, phi, offset));
+    }
+
+    // Difference signal2 - signal1, all sums are linear except for x^2.
+    struct iq_sums iq = {
+        sums[1].x - sums[0].x, sums[1].xc - sums[0].xc, sums[1].xs - sums[0].xs};
+    struct fit_sums res = {
+        sumsres[1].x - sumsres[0].x,
+        sumsres[1].xx - 2 * x1x2 + sumsres[0].xx,
+        sumsres[1].xc - sumsres[0].xc,
+        sumsres[1].xs - sumsres[0].xs};
+    iq_result(signal2, signal1, nsamples, w, &iq, &A, &phi, &offset);
+    *p21 = make_phasor(A, phi, offset, fit_residual(n, wres, &res, A, phi, offset));
+}
+
+void demodulate_pair(
+        const float *signal1, const float *signal2, const size_t n,
+        const float f, const float samplerate,
+        struct phasor *p1, struct phasor *p2, struct phasor *p21) {
+    demodulate_pair_samples(signal1, signal2, n, complete_periods(n, f, samplerate),
+                            f, samplerate, p1, p2, p21);
+}
+
+void demodulate_pair_periodic(
+        const float *signal1, const float *signal2, const size_t n,
+        const float f, const float samplerate,
+        struct phasor *p1, struct phasor *p2, struct phasor *p21) {
+    demodulate_pair_samples(signal1, signal2, n, n, f, samplerate, p1, p2, p21);
+}
+
+
+float phasor_amplitude(const struct phasor p) {
+    return cabsf(p.z);
+}
+
+
+float phasor_phase(const struct phasor p) {
+    return cargf(p.z);
+}
+
+
+struct phasor phasor_sub(const struct phasor a, const struct phasor b) {
+    struct phasor p = {a.z - b.z, a.offset - b.offset, NAN};
+    return p;
+}
+
+
+float _Complex phasor_ratio(const struct phasor num, const struct phasor den) {
+    return num.z / den.z;
+}
+
+
+float wrap_phase(const float phase) {
+    return remainderf(phase, 2*M_PI);
+}
+
+
+float phasor_phase_diff(const struct phasor a, const struct phasor b, const int harmonic) {
+    return wrap_phase(phasor_phase(a) - harmonic * phasor_phase(b));
+}
+
+
 float deviation_from_reconstruction(
         const float *signal, const size_t n, const float samplerate, const float freq,
         const float amplitude, const float phase, const float offset) {
@@ -6,6 +6,10 @@
 #include <stdint.h>
 
 
+// Number of frequencies a lock-in bank demodulates in one pass.
+#define DEMOD_BANK_SIZE 8
+
+
 /**
  * Calculate average (arithmetic mean) of data.
  */
@@ -20,7 +24,8 @@ float mean(const float *data, const size_t n);
  * This modulation function internally works with in units of samples,
  * not time.  The result is the same.
  *
- * Remove DC offset before applying this function.
+ * The DC offset is removed before demodulation.  Does not allocate
+ * memory, see also the faster `demodulate_iq`.
  *
  * @param signal Array with input signal.
  * @param n Number of samples.
@@ -36,6 +41,198 @@ void demodulate(
     float *A, float *phi, float *offset);
 
 
+/**
+ * Same as `demodulate`, but faster and without per-sample calls to
+ * `cos()`.
+ *
+ * The reference oscillator is generated by complex rotation in four
+ * float lanes (NEON or SSE if available at compile time, plain C
+ * otherwise), which are re-seeded every 64 samples from a
+ * renormalized double precision oscillator.  I and Q and the DC
+ * offset are accumulated in a single pass, the DC offset is removed
+ * analytically.
+ *
+ * Compared to `demodulate` for n <= 16384 samples and signals with
+ * amplitude well above the noise, the amplitude matches within a
+ * relative deviation of 1e-4 and the phase within 1e-4 rad.
+ *
+ * Parameters are the same as for `demodulate`.
+ */
+void demodulate_iq(
+    const float *signal, const size_t n,
+    const float f, const float samplerate,
+    float *A, float *phi, float *offset);
+
+
+/**
+ * Lock-in bank: demodulate several frequencies in a single pass over
+ * the signal.
+ *
+ * Each frequency is evaluated on its own number of complete periods,
+ * such that the results are the same as from separate calls to
+ * `demodulate_iq`.  Up to DEMOD_BANK_SIZE frequencies share one pass,
+ * more frequencies are processed in additional passes.
+ *
+ * @param signal Array with input signal.
+ * @param n Number of samples.
+ * @param f Array of `nf` frequencies to isolate [Hz].
+ * @param nf Number of frequencies.
+ * @param samplerate Samplerate of signal [samples / s].
+ * @param A Array of `nf` results for amplitude.
+ * @param phi Array of `nf` results for phase in rad.
+ * @param offset Array of `nf` results for DC offset.
+ */
+void demodulate_bank(
+    const float *signal, const size_t n,
+    const float *f, const size_t nf, const float samplerate,
+    float *A, float *phi, float *offset);
+
+
+/**
+ * Lock-in bank for harmonics `harmonics[k] * f` of a fundamental
+ * frequency `f`, see `demodulate_bank`.
+ *
+ * @param harmonics Array of `nh` harmonic numbers, 1 for `f`.
+ * @param nh Number of harmonics.
+ */
+void demodulate_harmonics(
+    const float *signal, const size_t n,
+    const float f, const int *harmonics, const size_t nh,
+    const float samplerate,
+    float *A, float *phi, float *offset);
+
+
+/**
+ * Fused `demodulate_iq` and `deviation_from_reconstruction` in a
+ * single pass over the signal.
+ *
+ * The residual is not computed from the reconstructed signal but from
+ * accumulated sums of x, x^2, x*cos and x*sin over all `n` samples.
+ * Because it results from a difference of large sums, the sums are
+ * accumulated in double precision with scalar oscillators.  Like
+ * the two-step computation, the reconstruction uses the exact (double
+ * precision) frequency.  The residual matches the two-step result
+ * within 1e-3 (relative) for signal to noise ratios up to 1e3; at
+ * higher ratios the single precision accumulation in
+ * `deviation_from_reconstruction` is the larger error.
+ *
+ * @param residual Result for standard deviation of signal from its
+ *     reconstruction over all `n` samples.
+ *
+ * Other parameters are the same as for `demodulate`.
+ */
+void demodulate_with_residual(
+    const float *signal, const size_t n,
+    const float f, const float samplerate,
+    float *A, float *phi, float *offset, float *residual);
+
+
+/**
+ * Fused lock-in bank for harmonics of `f` with residuals, see
+ * `demodulate_harmonics` and `demodulate_with_residual`.  The
+ * residual of each harmonic is the deviation from the reconstruction
+ * of this harmonic alone.
+ *
+ * @param residual Array of `nh` results for residuals.
+ */
+void demodulate_harmonics_with_residual(
+    const float *signal, const size_t n,
+    const float f, const int *harmonics, const size_t nh,
+    const float samplerate,
+    float *A, float *phi, float *offset, float *residual);
+
+
+/**
+ * Result of demodulation at one frequency as complex phasor
+ * z = A exp(i phi) of the signal component A cos(2 pi f t + phi).
+ *
+ * Use <complex.h> to work with `z`.  It is not included here because
+ * it defines the macro `I`.
+ */
+struct phasor {
+    float _Complex z;
+    float offset;    // DC offset
+    float residual;  // deviation from reconstruction, NAN if unknown
+};
+
+
+/**
+ * Demodulate signal at frequency f, see `demodulate_with_residual`.
+ */
+struct phasor demodulate_phasor(
+    const float *signal, const size_t n,
+    const float f, const float samplerate);
+
+
+/**
+ * Demodulate two signals at frequency f and their difference
+ * signal2 - signal1 in a single pass.
+ *
+ * Because demodulation is linear, the phasor of the difference is
+ * computed from the sums of both signals.  Its residual uses the
+ * additionally accumulated cross term sum(signal1 * signal2), such
+ * that no difference buffer is needed.
+ *
+ * @param signal1 Array with first input signal.
+ * @param signal2 Array with second input signal.
+ * @param n Number of samples in both signals.
+ * @param f Frequency to isolate [Hz].
+ * @param samplerate Samplerate of signals [samples / s].
+ * @param p1 Result for signal1.
+ * @param p2 Result for signal2.
+ * @param p21 Result for signal2 - signal1.
+ */
+void demodulate_pair(
+    const float *signal1, const float *signal2, const size_t n,
+    const float f, const float samplerate,
+    struct phasor *p1, struct phasor *p2, struct phasor *p21);
+
+/**
+ * `demodulate_pair` for signals holding a whole number of periods of
+ * f by construction (e.g. a multisine repeating once per buffer): all
+ * n samples are demodulated.  `demodulate_pair` truncates to complete
+ * periods in single precision, which may drop the last period when
+ * n * f / samplerate is an integer.
+ */
+void demodulate_pair_periodic(
+    const float *signal1, const float *signal2, const size_t n,
+    const float f, const float samplerate,
+    struct phasor *p1, struct phasor *p2, struct phasor *p21);
+
+
+/**
+ * Amplitude A of phasor.
+ */
+float phasor_amplitude(const struct phasor p);
+
+/**
+ * Phase of phasor in range [-pi, pi].
+ */
+float phasor_phase(const struct phasor p);
+
+/**
+ * Phasor of difference signal a - b.  The residual is unknown (NAN).
+ */
+struct phasor phasor_sub(const struct phasor a, const struct phasor b);
+
+/**
+ * Complex ratio num / den, e.g. transfer function output / input.
+ */
+float _Complex phasor_ratio(const struct phasor num, const struct phasor den);
+
+/**
+ * Wrap phase to range [-pi, pi].
+ */
+float wrap_phase(const float phase);
+
+/**
+ * Phase of a relative to `harmonic` times the phase of b, wrapped to
+ * [-pi, pi].  Use harmonic 1 for phase differences at the same
+ * frequency.
+ */
+float phasor_phase_diff(const struct phasor a, const struct phasor b, const int harmonic);
+
+
 /**
  * Calculate standard deviation of reconstruction from signal.
  *
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+
+
+struct fft {
+    uint32_t n;
+    float _Complex *twiddle;   // exp(-2 pi i k / n) for k < n/2
+    float _Complex *scratch;   // n samples for fft_real_pair
+};
+
+
+struct fft *fft_create(uint32_t n) {
+    if (n < 2 || (n & (n-1)) != 0) return NULL;
+    struct fft *fft = (struct fft *)calloc(1, sizeof(struct fft));
+    if (fft == NULL) return NULL;
+    fft->n = n;
+    fft->twiddle = (float _Complex *)malloc(n/2 * sizeof(float _Complex));
+    fft->scratch = (float _Complex *)malloc(n * sizeof(float _Complex));
+    if (fft->twiddle == NULL || fft->scratch == NULL) {
+        fft_free(fft);
+        return NULL;
+    }
+    for (uint32_t k = 0; k < n/2; k++)
+        fft->twiddle[k] = cexp(-2*M_PI*I*k / n);
+    return fft;
+}
+
+
+void fft_free(struct fft *fft) {
+    if (fft == NULL) return;
+    free(fft->twiddle);
+    free(fft->scratch);
+    free(fft);
+}
+
+
+void fft_complex(const struct fft *fft, float _Complex *x) {
+    const uint32_t n = fft->n;
+    // Bit reversal permutation
+    for (uint32_t i = 1, j = 0; i < n; i++) {
+        uint32_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j) {
+            float _Complex t = x[i];
+            x[i] = x[j];
+            x[j] = t;
+        }
+    }
+    // Butterflies, twiddle stride halves with every stage
+    for (uint32_t len = 2; len <= n; len <<= 1) {
+        const uint32_t half = len / 2, stride = n / len;
+        for (uint32_t i = 0; i < n; i += len) {
+            for (uint32_t k = 0; k < half; k++) {
+                float _Complex t = fft->twiddle[k*stride] * x[i+k+half];
+                x[i+k+half] = x[i+k] - t;
+                x[i+k] += t;
+            }
+        }
+    }
+}
+
+
+void fft_real_pair(
+        struct fft *fft, const float *x1, const float *x2, const float *window,
+        float _Complex *X1, float _Complex *X2) {
+    const uint32_t n = fft->n;
+    float _Complex *z = fft->scratch;
+    for (uint32_t j = 0; j < n; j++) {
+        float w = window ? window[j] : 1;
+        z[j] = w*x1[j] + I*w*x2[j];
+    }
+    fft_complex(fft, z);
+    // Spectra of real signals are hermitian: separate the real and
+    // imaginary part of z by symmetry.
+    for (uint32_t k = 0; k <= n/2; k++) {
+        float _Complex a = z[k], b = conjf(z[(n-k) % n]);
+        X1[k] = (a + b) / 2;
+        X2[k] = (a - b) / (2*I);
+    }
+}
+
+
+float hann_window(float *window, uint32_t n) {
+    float sum = 0;
+    for (uint32_t j = 0; j < n; j++) {
+        window[j] = 0.5f - 0.5f*cosf(2*M_PI*j / n);
+        sum += window[j];
+    }
+    return sum;
+}
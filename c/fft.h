@@ -0,0 +1,50 @@
+#ifndef __FFT_H
+#define __FFT_H
+
+#include <stdint.h>
+#include <complex.h>
+
+
+/**
+ * Precomputed twiddle factors and scratch memory for FFTs of one
+ * length (a power of two), e.g. RP_BUFFER_SIZE.
+ */
+struct fft;
+
+
+/**
+ * Prepare FFTs of length `n`.  All memory is allocated here.
+ *
+ * @return NULL if n is not a power of two or on allocation failure.
+ */
+struct fft *fft_create(uint32_t n);
+
+
+void fft_free(struct fft *fft);
+
+
+/**
+ * In-place forward FFT of `n` complex samples (radix 2, no scaling):
+ * X[k] = sum_j x[j] exp(-2 pi i j k / n).
+ */
+void fft_complex(const struct fft *fft, float _Complex *x);
+
+
+/**
+ * FFTs of two real signals with one complex FFT, after multiplying
+ * both with `window` (may be NULL).  Writes the bins 0 ... n/2 of
+ * each spectrum to `X1` and `X2` (n/2+1 values each).
+ */
+void fft_real_pair(
+    struct fft *fft, const float *x1, const float *x2, const float *window,
+    float _Complex *X1, float _Complex *X2);
+
+
+/**
+ * Write periodic Hann window of length `n` to `window`.
+ *
+ * @return Sum of the window, i.e. the gain for a sine on a bin.
+ */
+float hann_window(float *window, uint32_t n);
+
+#endif // __FFT_H
@@ -0,0 +1,39 @@
+#include "frame.h"
+
+
+_Static_assert(sizeof(struct frame_header) == 28,
+               "frame header must not contain padding");
+
+
+void frame_header_init(
+        struct frame_header *header, uint32_t index, uint8_t channel,
+        uint8_t format, uint32_t decimation, uint32_t trigger,
+        uint32_t nsamples, float scale) {
+    header->magic = FRAME_MAGIC;
+    header->index = index;
+    header->channel = channel;
+    header->format = format;
+    header->reserved = 0;
+    header->decimation = decimation;
+    header->trigger = trigger;
+    header->nsamples = nsamples;
+    header->scale = (format == FRAME_FORMAT_FLOAT32) ? 1 : scale;
+}
+
+
+size_t frame_sample_size(uint8_t format) {
+    switch (format) {
+    case FRAME_FORMAT_INT16: return sizeof(int16_t);
+    case FRAME_FORMAT_FLOAT32: return sizeof(float);
+    default: return 0;
+    }
+}
+
+
+bool frame_write(
+        FILE *stream, const struct frame_header *header, const void *samples) {
+    size_t samplesize = frame_sample_size(header->format);
+    if (fwrite(header, sizeof(struct frame_header), 1, stream) != 1)
+        return false;
+    return fwrite(samples, samplesize, header->nsamples, stream) == header->nsamples;
+}
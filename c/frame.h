@@ -0,0 +1,62 @@
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Magic number at the start of every binary frame ("RPFR" when read
+// as little endian bytes).
+#define FRAME_MAGIC 0x52465052
+
+// Sample encodings following a frame header.
+#define FRAME_FORMAT_INT16 1
+#define FRAME_FORMAT_FLOAT32 2
+
+
+/**
+ * Fixed size header of a binary frame.  It is followed directly by
+ * `nsamples` samples encoded as given by `format`.
+ *
+ * All fields are in native byte order, which is little endian on Red
+ * Pitaya as well as on x86 hosts.  The struct has no padding, its
+ * size is 28 bytes (python struct format "<IIBBHIIIf").
+ */
+struct frame_header {
+    uint32_t magic;       // FRAME_MAGIC
+    uint32_t index;       // running frame (trigger) index
+    uint8_t channel;      // input channel, 1 or 2
+    uint8_t format;       // FRAME_FORMAT_INT16 or FRAME_FORMAT_FLOAT32
+    uint16_t reserved;    // always 0
+    uint32_t decimation;  // decimation factor relative to 125Msps
+    uint32_t trigger;     // sample index of trigger position
+    uint32_t nsamples;    // number of samples following the header
+    float scale;          // volts per LSB for int16 samples, else 1
+};
+
+
+/**
+ * Fill header fields.  The scale is set to 1 for float32 frames.
+ */
+void frame_header_init(
+    struct frame_header *header, uint32_t index, uint8_t channel,
+    uint8_t format, uint32_t decimation, uint32_t trigger,
+    uint32_t nsamples, float scale);
+
+
+/**
+ * Write header and samples of one frame to `stream`.  Does not flush.
+ *
+ * @return true if the complete frame was written.
+ */
+bool frame_write(
+    FILE *stream, const struct frame_header *header, const void *samples);
+
+
+/**
+ * Size of one sample in bytes for given format, 0 for unknown formats.
+ */
+size_t frame_sample_size(uint8_t format);
+
+#endif // __FRAME_H
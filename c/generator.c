@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp.h"
+
+#include "generator.h"
+
+
+void gen_cache_reset(struct gen_cache *cache) {
+    rp_GenReset();
+    cache->valid[0] = cache->valid[1] = false;
+}
+
+void gen_cache_free(struct gen_cache *cache) {
+    for (int ch = 0; ch < 2; ch++) {
+        free(cache->arb[ch]);
+        cache->arb[ch] = NULL;
+    }
+    cache->valid[0] = cache->valid[1] = false;
+}
+
+
+/** Waveform samples differ from the uploaded ones. */
+static bool arb_changed(const struct gen_cache *cache, int ch, const struct gen_config *c) {
+    const struct gen_config *a = &cache->applied[ch];
+    return a->arb_length != c->arb_length
+        || memcmp(cache->arb[ch], c->arb, c->arb_length * sizeof(float)) != 0;
+}
+
+bool gen_apply(struct gen_cache *cache, rp_channel_t channel, const struct gen_config *config) {
+    const int ch = channel;
+    const bool all = !cache->valid[ch];
+    const struct gen_config *a = &cache->applied[ch];
+    const struct gen_config *c = config;
+
+    rp_GenTriggerSource(channel, c->trigger);
+    if (all || a->waveform != c->waveform)
+        rp_GenWaveform(channel, c->waveform);
+    bool ok = true;
+    if (c->waveform == RP_WAVEFORM_ARBITRARY && (all || arb_changed(cache, ch, c))) {
+        rp_GenArbWaveform(channel, (float *)c->arb, c->arb_length);
+        if (cache->arb[ch] == NULL)
+            cache->arb[ch] = (float *)malloc(BUFFER_LENGTH * sizeof(float));
+        if (cache->arb[ch] != NULL && c->arb_length <= BUFFER_LENGTH)
+            memcpy(cache->arb[ch], c->arb, c->arb_length * sizeof(float));
+        else
+            ok = false;
+    }
+    if (all || a->freq != c->freq)
+        rp_GenFreq(channel, c->freq);
+    if (all || a->amp != c->amp)
+        rp_GenAmp(channel, c->amp);
+    if (all || a->phase != c->phase)
+        rp_GenPhase(channel, c->phase);
+    if (all || a->offset != c->offset)
+        rp_GenOffset(channel, c->offset);
+    if (all || a->mode != c->mode)
+        rp_GenMode(channel, c->mode);
+    if (c->mode == RP_GEN_MODE_BURST && (all || a->burst_count != c->burst_count))
+        rp_GenBurstCount(channel, c->burst_count);
+
+    cache->applied[ch] = *c;
+    cache->valid[ch] = ok;
+    return ok;
+}
@@ -0,0 +1,64 @@
+#ifndef __GENERATOR_H
+#define __GENERATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rp.h"
+
+
+/**
+ * Settings of one generator channel.
+ */
+struct gen_config {
+    rp_trig_src_t trigger;
+    rp_waveform_t waveform;
+    const float *arb;              // samples for RP_WAVEFORM_ARBITRARY
+    uint32_t arb_length;
+    float freq, amp, phase, offset;
+    rp_gen_mode_t mode;
+    int burst_count;               // with RP_GEN_MODE_BURST
+};
+
+
+/**
+ * Last applied settings of both generator channels.  Reprogramming
+ * all settings for every sweep point is slow, mostly because of the
+ * arbitrary waveform upload, so only the settings that changed are
+ * written.
+ */
+struct gen_cache {
+    bool valid[2];
+    struct gen_config applied[2];
+    float *arb[2];                 // copy of the uploaded waveform
+};
+
+
+/**
+ * Reset the generators (`rp_GenReset`) and forget all settings.
+ */
+void gen_cache_reset(struct gen_cache *cache);
+
+/**
+ * Free the waveform copies.
+ */
+void gen_cache_free(struct gen_cache *cache);
+
+/**
+ * Apply settings to a channel, in the same order as a full
+ * configuration after `rp_GenReset`, but skipping values that did not
+ * change.
+ *
+ * The trigger source is always written, assuming that this re-arms a
+ * finished burst for the next trigger, as a full configuration did
+ * before.  This is not verified on hardware: the simulation (sim/)
+ * models it, but librp does not document it.  `rp_GenTrigger` is no
+ * alternative, it starts the output right away instead of arming it
+ * for an external trigger.
+ *
+ * @return false if copying the waveform failed (all settings are
+ * written next time).
+ */
+bool gen_apply(struct gen_cache *cache, rp_channel_t channel, const struct gen_config *config);
+
+#endif // __GENERATOR_H
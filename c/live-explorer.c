@@ -7,9 +7,24 @@
  *
  *     FREQ AMP\n
  *
- * Output data format (tab separated) to stdout:
+ * Usage: live-explorer [text|float|int16] [stream]
  *
- *     CH SAMPLES...
+ * Output data format in default `text` mode (tab separated) to stdout:
+ *
+ *     IDX CH SAMPLES...
+ *
+ * In `float` and `int16` mode each buffer is written as binary frame
+ * (see frame.h) with raw float32 samples in volts or int16 ADC counts
+ * respectively.  The int16 scale in the frame header is the nominal
+ * (uncalibrated) LSB voltage for the selected input gain.
+ *
+ * In `stream` mode the ADC ring buffer is read continuously after
+ * each trigger instead of once per trigger (see `struct stream` in
+ * utility.h): consecutive buffers (IDX) follow each other without
+ * gaps.  Only the first buffer after a trigger has the trigger at
+ * sample 200 (frame trigger field 0 for the others).  Samples lost in
+ * an overrun, e.g. if the output is too slow, are reported on stderr.
+ * The acquisition is re-triggered after 2**31 samples.
  *
  * Trigger position at sample 200
  */
@@ -17,39 +32,158 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
 
 #include "rp.h"
 
+#include "chain.h"
+#include "frame.h"
+#include "pipeline.h"
 #include "utility.h"
 
 
 // Delay in us between triggers / buffer dumps
+// Fixed wait for followers, timeout with ready bus (see chain.h)
 #define CHAIN_LEADER_DELAY_US 300000
+// Trigger timeout [s] and re-arms before giving up
+#define TRIGGER_TIMEOUT 1.0
+#define TRIGGER_RETRIES 3
 
-int main(int argc, char **argv) {
-    // Initialize IO.
-    if (rp_Init() != RP_OK) {
-        fprintf(stderr, "RP api init failed!\n");
+#define DECIMATION RP_DEC_64
+#define DECIMATION_FACTOR 64
+#define TRIGGER_SAMPLE 200
+// Nominal LSB voltage of 14 bit ADC with RP_HIGH gain (+-20V)
+#define INT16_SCALE (20.0 / 8192)
+// Buffers queued for output in stream mode
+#define STREAM_SLOTS 8
+
+// Metadata of pipeline items in stream mode
+enum { META_TRIGGER };
+
+// Context of the writer thread in stream mode
+struct stream_output {
+    uint8_t format;
+    bool failed;  // writing failed, set by the writer thread
+};
+
+
+/**
+ * Print one buffer as text line.
+ *
+ * @return false if writing to stdout failed.
+ */
+static bool print_text(long int idx, int ch, const float *buf, uint32_t bufsize) {
+    printf("%ld\t%d", idx, ch);
+    for(uint32_t i = 0; i < bufsize; i++) {
+        printf("\t%.3f", buf[i]);
+    }
+    printf("\n");
+    return !ferror(stdout);
+}
+
+
+/**
+ * Write both channels of one buffer in stream mode, on the writer
+ * thread of the pipeline.
+ */
+static void write_stream_buffer(const struct pipeline_item *item, void *ctx) {
+    struct stream_output *out = (struct stream_output *)ctx;
+    const uint8_t format = out->format;
+    if (__atomic_load_n(&out->failed, __ATOMIC_ACQUIRE)) return;
+    bool written = true;
+    static int16_t rawbuf[ADC_BUFFER_SIZE];
+    struct frame_header header;
+    timing_point(item->index);
+    const float *bufs[2] = {item->buf2, item->buf1};
+    const uint32_t sizes[2] = {item->size2, item->size1};
+    for (int c = 0; c < 2; c++) {
+        const int ch = 2 - c;
+        if (format == FRAME_FORMAT_INT16) {
+            // Raw stream, samples are ADC counts.
+            for (uint32_t i = 0; i < sizes[c]; i++)
+                rawbuf[i] = bufs[c][i];
+            frame_header_init(&header, item->index, ch, format, DECIMATION_FACTOR,
+                              item->meta[META_TRIGGER], sizes[c], INT16_SCALE);
+            written = frame_write(stdout, &header, rawbuf) && written;
+        } else if (format == FRAME_FORMAT_FLOAT32) {
+            frame_header_init(&header, item->index, ch, format, DECIMATION_FACTOR,
+                              item->meta[META_TRIGGER], sizes[c], 1);
+            written = frame_write(stdout, &header, bufs[c]) && written;
+        } else {
+            written = print_text(item->index, ch, bufs[c], sizes[c]) && written;
+        }
+    }
+    if (fflush(stdout) != 0 || !written) {
+        fprintf(stderr, "Writing output failed, stopping.\n");
+        __atomic_store_n(&out->failed, true, __ATOMIC_RELEASE);
+    }
+    timing_mark(TIMING_OUTPUT);
+    timing_done();
+}
+
+
+/**
+ * Stream mode: after every trigger, hand consecutive buffers to the
+ * writer thread until the acquisition stops.  Returns when writing
+ * the output failed.
+ */
+static void stream_buffers(uint8_t format, struct trigger_wait *trigger) {
+    struct stream_output out = {.format = format, .failed = false};
+    struct pipeline *pipeline = pipeline_create(
+        STREAM_SLOTS, ADC_BUFFER_SIZE, write_stream_buffer, &out);
+    if (pipeline == NULL) {
+        fprintf(stderr, "Pipeline setup failed!\n");
         exit(2);
     }
+    struct stream stream;
+    long int idx = 0;
+    while (!__atomic_load_n(&out.failed, __ATOMIC_ACQUIRE)) {
+        rp_DpinSetState(RP_DIO0_N, RP_HIGH);
+        if (!stream_start(&stream, DECIMATION, format == FRAME_FORMAT_INT16,
+                          RP_TRIG_SRC_EXT_NE, TRIGGER_SAMPLE, 0)) {
+            fprintf(stderr, "Stream setup failed!\n");
+            exit(2);
+        }
+        chain_ready(CHAIN_LEADER_DELAY_US);
+        rp_DpinSetState(RP_DIO0_N, RP_LOW);
+        if (!stream_wait_trigger(&stream, trigger)) {
+            fprintf(stderr, "Trigger lost, stopping.\n");
+            exit(3);
+        }
+        chain_busy();
 
-    // Prepare trigger
-    // DIO0_P is trigger input line / EXT_TRIg
-    rp_DpinSetDirection(RP_DIO0_P, RP_IN);
-    // DIO0_N is trigger output line
-    rp_DpinSetDirection(RP_DIO0_N, RP_OUT);
-    // DIO1_P is GND reference for initializer pre-stage
-    // and always set to LOW.
-    rp_DpinSetDirection(RP_DIO1_P, RP_OUT);
-    rp_DpinSetState(RP_DIO0_N, RP_LOW);
-    rp_DpinSetState(RP_DIO1_P, RP_LOW);
+        while (!__atomic_load_n(&out.failed, __ATOMIC_ACQUIRE)) {
+            struct pipeline_item *item = pipeline_next(pipeline);
+            uint32_t n = stream_fill(&stream, item->buf1, item->buf2, ADC_BUFFER_SIZE);
+            if (n == 0) break;
+            if (stream.gap > 0)
+                fprintf(stderr, "Overrun: %llu samples lost before buffer %ld.\n",
+                        (unsigned long long)stream.gap, idx);
+            item->index = idx++;
+            item->meta[META_TRIGGER] = stream.first == 0 ? TRIGGER_SAMPLE : 0;
+            item->size1 = item->size2 = n;
+            pipeline_submit(pipeline, item);
+        }
+        stream_stop(&stream);
+    }
+    pipeline_finish(pipeline);
+}
 
-    uint32_t buffertime = ADC_BUFFER_SIZE * 64 / 125; // us
+
+/**
+ * Hand one buffer per trigger to stdout until writing the output
+ * failed.
+ */
+static void trigger_buffers(uint8_t format, struct trigger_wait *trigger) {
+    uint32_t buffertime = ADC_BUFFER_SIZE * DECIMATION_FACTOR / 125; // us
 
     uint32_t bufsize = ADC_BUFFER_SIZE;
     float *buf = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    int16_t *rawbuf = (int16_t *)malloc(ADC_BUFFER_SIZE * sizeof(int16_t));
+
+    struct frame_header header;
 
     long int idx = 0;
     while (true) {
@@ -57,56 +191,133 @@ int main(int argc, char **argv) {
         //if (DUMP_SPEED > buffertime)
         //    usleep(DUMP_SPEED - buffertime);
 
+        timing_point(idx);
         rp_DpinSetState(RP_DIO0_N, RP_HIGH);
 
         // Setup both ADC channels
         rp_AcqReset();
         rp_AcqSetGain(RP_CH_1, RP_HIGH);
         rp_AcqSetGain(RP_CH_2, RP_HIGH);
-        rp_AcqSetDecimation(RP_DEC_64);
-        rp_AcqSetTriggerDelay(7992); // trigger at sample 200
+        rp_AcqSetDecimation(DECIMATION);
+        rp_AcqSetTriggerDelay(8192 - TRIGGER_SAMPLE);
         rp_AcqSetAveraging(1);
         rp_AcqStart();
 
         rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
-#ifndef FOLLOW
-        // Leader of a chain of Red Pitayas waits
-        // so that others can catch up to here and are actually
-        // also awaiting the next trigger signal.
-        usleep(CHAIN_LEADER_DELAY_US);
-#endif
+        timing_mark(TIMING_CONFIGURE);
+        // Leader of a chain of Red Pitayas waits until the others
+        // are actually also awaiting the next trigger signal.
+        chain_ready(CHAIN_LEADER_DELAY_US);
         rp_DpinSetState(RP_DIO0_N, RP_LOW);
 
         // Wait until acquisition trigger fired
-        rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
-        while (1) {
-            rp_AcqGetTriggerState(&state);
-            if(state == RP_TRIG_STATE_TRIGGERED){
-                break;
-            }
+        if (!wait_for_trigger(trigger)) {
+            fprintf(stderr, "Trigger lost, stopping.\n");
+            exit(3);
         }
+        chain_busy();
+        timing_mark(TIMING_TRIGGER);
         // Wait until ADC buffer is full
         usleep(buffertime);
+        timing_mark(TIMING_FILL);
 
-        rp_AcqGetOldestDataV(RP_CH_2, &bufsize, buf);
-        printf("%ld\t2", idx);
-        for(uint32_t i = 0; i < bufsize; i++) {
-            printf("\t%.3f", buf[i]);
+        rp_channel_t channels[2] = {RP_CH_2, RP_CH_1};
+        bool written = true;
+        for (int c = 0; c < 2; c++) {
+            int ch = (channels[c] == RP_CH_1) ? 1 : 2;
+            bufsize = ADC_BUFFER_SIZE;
+            if (format == FRAME_FORMAT_INT16) {
+                rp_AcqGetOldestDataRaw(channels[c], &bufsize, rawbuf);
+                timing_mark(TIMING_READOUT);
+                frame_header_init(&header, idx, ch, format, DECIMATION_FACTOR,
+                                  TRIGGER_SAMPLE, bufsize, INT16_SCALE);
+                written = frame_write(stdout, &header, rawbuf) && written;
+            } else if (format == FRAME_FORMAT_FLOAT32) {
+                rp_AcqGetOldestDataV(channels[c], &bufsize, buf);
+                timing_mark(TIMING_READOUT);
+                frame_header_init(&header, idx, ch, format, DECIMATION_FACTOR,
+                                  TRIGGER_SAMPLE, bufsize, 1);
+                written = frame_write(stdout, &header, buf) && written;
+            } else {
+                rp_AcqGetOldestDataV(channels[c], &bufsize, buf);
+                timing_mark(TIMING_READOUT);
+                written = print_text(idx, ch, buf, bufsize) && written;
+            }
+            timing_mark(TIMING_OUTPUT);
         }
-        printf("\n");
 
-        rp_AcqGetOldestDataV(RP_CH_1, &bufsize, buf);
-        printf("%ld\t1", idx);
-        for(uint32_t i = 0; i < bufsize; i++) {
-            printf("\t%.3f", buf[i]);
+        // Stop when the reader is gone, e.g. the ssh connection closed
+        if (fflush(stdout) != 0 || !written) {
+            fprintf(stderr, "Writing output failed, stopping.\n");
+            break;
         }
-        printf("\n");
-
-        fflush(stdout);
+        timing_mark(TIMING_OUTPUT);
+        timing_done();
         idx ++;
     }
 
     free(buf);
+    free(rawbuf);
+}
+
+
+int main(int argc, char **argv) {
+    uint8_t format = 0; // 0: text
+    bool stream = false;
+    if (argc == 3) {
+        stream = strcmp(argv[2], "stream") == 0;
+        if (!stream) {
+            fprintf(stderr, "Invalid mode.\n");
+            exit(1);
+        }
+    }
+    if (argc == 2 || argc == 3) {
+        if (strcmp(argv[1], "float") == 0) format = FRAME_FORMAT_FLOAT32;
+        else if (strcmp(argv[1], "int16") == 0) format = FRAME_FORMAT_INT16;
+        else if (strcmp(argv[1], "text") != 0) {
+            fprintf(stderr, "Invalid output format.\n");
+            exit(1);
+        }
+    } else if (argc > 3) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        exit(1);
+    }
+
+    // Initialize IO.
+    timing_init();
+    if (rp_Init() != RP_OK) {
+        fprintf(stderr, "RP api init failed!\n");
+        exit(2);
+    }
+
+    // Prepare trigger
+    // DIO0_P is trigger input line / EXT_TRIg
+    rp_DpinSetDirection(RP_DIO0_P, RP_IN);
+    // DIO0_N is trigger output line
+    rp_DpinSetDirection(RP_DIO0_N, RP_OUT);
+    // DIO1_P is GND reference for initializer pre-stage
+    // and always set to LOW.
+    rp_DpinSetDirection(RP_DIO1_P, RP_OUT);
+    rp_DpinSetState(RP_DIO0_N, RP_LOW);
+    rp_DpinSetState(RP_DIO1_P, RP_LOW);
+    chain_init();
+
+    // Leader re-fires a lost trigger, followers wait for the leader
+    // as long as it takes.
+    struct trigger_wait trigger;
+    trigger_wait_init(&trigger, TRIGGER_TIMEOUT);
+#ifdef FOLLOW
+    trigger.rearm = rearm_ext_trigger;
+    trigger.retries = -1;
+#else
+    trigger.rearm = refire_ext_trigger;
+    trigger.retries = TRIGGER_RETRIES;
+#endif
+    if (stream)
+        stream_buffers(format, &trigger);
+    else
+        trigger_buffers(format, &trigger);
+
     rp_GenReset();
     rp_Release();
     return 0;
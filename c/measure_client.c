@@ -0,0 +1,226 @@
+/**
+ * Client of the measurement server (measure_server.c), e.g. on the
+ * host or on the Red Pitaya itself as loopback test.  Sends one job
+ * and prints its results.
+ *
+ * Usage: measure_client [OPTIONS] JOB [RANGE]
+ *
+ * JOB is `ping`, `acquire` or `sweep`.  A sweep needs the frequency
+ * RANGE as START,NPOINTS,END [Hz].
+ *
+ * Options:
+ *
+ *     --address A      Server address `HOST:PORT` or `unix:PATH`,
+ *                      default localhost:5100.
+ *     --count N        Pings or buffers to acquire, default 1.
+ *     --decimation D   1, 8, 64, 1024, 8192 or 65536, default 64 for
+ *                      acquire and automatic for sweep.
+ *     --ext            Acquire on the external trigger.
+ *     --int16          Acquire raw ADC counts.
+ *     --frames         Write the binary frames of acquire to stdout
+ *                      (see frame.h) instead of text.
+ *     --amp A          Sweep amplitude [V], default 0.5.
+ *     --settle T       Wait before every sweep point [s], default 0.01,
+ *                      at most 10.
+ *     --log            Log-scaled sweep.
+ *
+ * Output data format (tab separated) to stdout.  For acquire:
+ *
+ *     SAMPLERATE IDX CH SAMPLES...
+ *
+ * with samples in volts (ADC counts with --int16) and the trigger at
+ * sample 200.  For sweep, per point and channel:
+ *
+ *     FREQ SAMPLERATE CH AMP PHASE OFFSET
+ *
+ * Ping prints the round trip time [us] of every ping.  The latency of
+ * the first result and the duration of the job are printed on stderr.
+ *
+ * Exit status is 3 if the job failed on the server.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "frame.h"
+#include "protocol.h"
+#include "utility.h"
+
+
+/**
+ * Print one frame payload as text.
+ */
+static void print_frame(const struct frame_header *header, const void *samples) {
+    printf("%f\t%u\t%u", RP_BASE_SAMPLERATE / header->decimation,
+           header->index, header->channel);
+    for (uint32_t i = 0; i < header->nsamples; i++) {
+        if (header->format == FRAME_FORMAT_INT16)
+            printf("\t%d", ((const int16_t *)samples)[i]);
+        else
+            printf("\t%f", ((const float *)samples)[i]);
+    }
+    printf("\n");
+}
+
+
+/**
+ * Read and print the messages of the answer to request `id` up to
+ * PROTOCOL_DONE.
+ *
+ * @return Status of the job, or PROTOCOL_EINVAL for a broken stream.
+ */
+static int read_answer(FILE *in, uint32_t id, bool frames, double *first) {
+    size_t capacity = 0;
+    char *payload = NULL;
+    int status = PROTOCOL_EINVAL;
+    struct protocol_message m;
+    while (protocol_read(in, &m, sizeof(m))) {
+        if (m.magic != PROTOCOL_MESSAGE_MAGIC || m.id != id) {
+            fprintf(stderr, "Invalid message.\n");
+            break;
+        }
+        if (*first == 0) *first = monotonic_seconds();
+        if (m.size > capacity) {
+            capacity = m.size;
+            payload = (char *)realloc(payload, capacity);
+            if (payload == NULL) break;
+        }
+        if (!protocol_read(in, payload, m.size)) break;
+
+        if (m.type == PROTOCOL_DONE) {
+            status = m.status;
+            break;
+        } else if (m.type == PROTOCOL_FRAME && m.size >= sizeof(struct frame_header)) {
+            const struct frame_header *header = (const struct frame_header *)payload;
+            if (frames)
+                fwrite(payload, m.size, 1, stdout);
+            else
+                print_frame(header, payload + sizeof(*header));
+        } else if (m.type == PROTOCOL_POINT && m.size == sizeof(struct protocol_point)) {
+            const struct protocol_point *p = (const struct protocol_point *)payload;
+            for (int c = 0; c < 2; c++)
+                printf("%f\t%f\t%d\t%f\t%f\t%f\n", p->freq, p->samplerate, c + 1,
+                       p->amp[c], p->phase[c], p->offset[c]);
+        }
+    }
+    free(payload);
+    return status;
+}
+
+
+int main(int argc, char **argv) {
+    char address[64];
+    snprintf(address, sizeof(address), "localhost:%d", PROTOCOL_DEFAULT_PORT);
+    struct protocol_request req = {
+        .magic = PROTOCOL_REQUEST_MAGIC,
+        .count = 1,
+        .format = FRAME_FORMAT_FLOAT32,
+        .trigger = PROTOCOL_TRIGGER_NOW,
+        .amplitude = 0.5,
+        .settle = 0.01,
+    };
+    bool frames = false;
+
+    static const struct option options[] = {
+        {"address", required_argument, NULL, 'A'},
+        {"count", required_argument, NULL, 'n'},
+        {"decimation", required_argument, NULL, 'd'},
+        {"ext", no_argument, NULL, 'e'},
+        {"int16", no_argument, NULL, 'i'},
+        {"frames", no_argument, NULL, 'F'},
+        {"amp", required_argument, NULL, 'a'},
+        {"settle", required_argument, NULL, 's'},
+        {"log", no_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 'A':
+            snprintf(address, sizeof(address), "%s", optarg);
+            break;
+        case 'n':
+            req.count = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            req.decimation = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            req.trigger = PROTOCOL_TRIGGER_EXT;
+            break;
+        case 'i':
+            req.format = FRAME_FORMAT_INT16;
+            break;
+        case 'F':
+            frames = true;
+            break;
+        case 'a':
+            req.amplitude = strtof(optarg, NULL);
+            break;
+        case 's':
+            req.settle = strtof(optarg, NULL);
+            break;
+        case 'l':
+            req.flags |= PROTOCOL_FLAG_LOG;
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc < 2) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        exit(1);
+    }
+    if (strcmp(argv[1], "ping") == 0 && argc == 2) {
+        req.job = PROTOCOL_PING;
+    } else if (strcmp(argv[1], "acquire") == 0 && argc == 2) {
+        req.job = PROTOCOL_ACQUIRE;
+    } else if (strcmp(argv[1], "sweep") == 0 && argc == 3) {
+        int npoints;
+        if (!parse_cmd_line_range(argv[2], &req.start, &req.stop, &npoints)) {
+            fprintf(stderr, "Invalid range.\n");
+            exit(1);
+        }
+        req.job = PROTOCOL_SWEEP;
+        req.count = npoints;
+    } else {
+        fprintf(stderr, "Invalid job.\n");
+        exit(1);
+    }
+
+    int fd = protocol_connect(address);
+    if (fd < 0) exit(2);
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+
+    // Pings are separate requests, all other jobs a single one.
+    const uint32_t nrequests = req.job == PROTOCOL_PING ? req.count : 1;
+    int status = PROTOCOL_OK;
+    for (uint32_t i = 0; i < nrequests && status == PROTOCOL_OK; i++) {
+        req.id = i;
+        double start = monotonic_seconds(), first = 0;
+        fwrite(&req, sizeof(req), 1, out);
+        fflush(out);
+        status = read_answer(in, req.id, frames, &first);
+        double end = monotonic_seconds();
+        if (req.job == PROTOCOL_PING)
+            printf("%.1f\n", 1e6 * (end - start));
+        else
+            fprintf(stderr, "First result after %.2f ms, job done after %.2f ms.\n",
+                    1e3 * (first - start), 1e3 * (end - start));
+    }
+    fflush(stdout);
+    fclose(in);
+    fclose(out);
+    if (status != PROTOCOL_OK) {
+        fprintf(stderr, "Job failed with status %d.\n", status);
+        exit(3);
+    }
+    return 0;
+}
@@ -0,0 +1,292 @@
+/**
+ * Measurement server: keeps librp initialized and runs acquisition and
+ * sweep jobs sent by clients over a socket (see protocol.h and
+ * measure_client.c), instead of a new program started over ssh for
+ * every run.  The generator settings and all buffers are kept between
+ * jobs.
+ *
+ * Usage: measure_server [ADDRESS]
+ *
+ * ADDRESS is `[HOST:]PORT` for TCP (default port 5100 on all
+ * interfaces) or `unix:PATH` for a Unix socket.  One client is served
+ * at a time and its jobs one after the other.  Every job is logged on
+ * stderr with its duration.  A job is aborted as soon as writing to
+ * the client fails, e.g. after the client disconnected.
+ *
+ * Jobs (see enum protocol_job):
+ *
+ *     PING     Answered right away.
+ *     ACQUIRE  `count` buffers of both channels, each triggered
+ *              immediately or by the external trigger DIO0_P (negative
+ *              edge), as binary frames (see frame.h) with the trigger
+ *              at sample 200.
+ *     SWEEP    Sine on OUT1 at `count` frequencies from `start` to
+ *              `stop`, after `settle` seconds (at most 10) a full
+ *              buffer is taken and both channels are demodulated at
+ *              the frequency.
+ *
+ * Note: Default setting of digital IO pins is OUT, LOW.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+
+#include "rp.h"
+
+#include "demodulation.h"
+#include "frame.h"
+#include "generator.h"
+#include "protocol.h"
+#include "utility.h"
+
+
+// Trigger timeout [s] and re-arms before a job is aborted
+#define TRIGGER_TIMEOUT 1.0
+#define TRIGGER_RETRIES 3
+#define TRIGGER_SAMPLE 200
+// Nominal LSB voltage of 14 bit ADC with RP_HIGH gain (+-20V)
+#define INT16_SCALE (20.0 / 8192)
+// Largest OUT1 amplitude [V]
+#define MAX_AMPLITUDE 1.0
+// Longest settle time per sweep point [s], the server is blocked
+#define MAX_SETTLE 10.0
+
+
+/**
+ * State kept between jobs.
+ */
+struct server {
+    struct gen_cache generators;
+    struct trigger_wait trigger;
+    float *buf1, *buf2;
+    int16_t *raw1, *raw2;
+};
+
+
+/**
+ * Acquire a full buffer of both channels with the trigger at
+ * TRIGGER_SAMPLE, as volts or (`raw`) ADC counts.
+ *
+ * @return false if the trigger was lost.
+ */
+static bool acquire_buffer(
+        struct server *srv, rp_acq_decimation_t decimation, bool ext, bool raw,
+        float *samplerate) {
+    rp_AcqReset();
+    rp_AcqSetGain(RP_CH_1, RP_HIGH);
+    rp_AcqSetGain(RP_CH_2, RP_HIGH);
+    rp_AcqSetDecimation(decimation);
+    rp_AcqSetTriggerDelay(ADC_BUFFER_SIZE/2 - TRIGGER_SAMPLE);
+    rp_AcqSetAveraging(1);
+    rp_AcqStart();
+    rp_AcqGetSamplingRateHz(samplerate);
+
+    // Wait for "look ahead" buffer to fill up
+    uint32_t buffertime = 1e6 * ADC_BUFFER_SIZE / *samplerate;
+    usleep(buffertime);
+
+    srv->trigger.rearm = ext ? rearm_ext_trigger : rearm_trigger_now;
+    rp_AcqSetTriggerSrc(ext ? RP_TRIG_SRC_EXT_NE : RP_TRIG_SRC_NOW);
+    if (!wait_for_trigger(&srv->trigger)) return false;
+    // Wait until ADC buffer is full
+    usleep(buffertime);
+
+    uint32_t s1 = ADC_BUFFER_SIZE, s2 = ADC_BUFFER_SIZE;
+    if (raw) {
+        rp_AcqGetOldestDataRaw(RP_CH_1, &s1, srv->raw1);
+        rp_AcqGetOldestDataRaw(RP_CH_2, &s2, srv->raw2);
+    } else {
+        rp_AcqGetOldestDataV(RP_CH_1, &s1, srv->buf1);
+        rp_AcqGetOldestDataV(RP_CH_2, &s2, srv->buf2);
+    }
+    return true;
+}
+
+
+static int job_acquire(struct server *srv, const struct protocol_request *req, FILE *out) {
+    rp_acq_decimation_t decimation;
+    if (req->count == 0
+            || (req->format != FRAME_FORMAT_FLOAT32 && req->format != FRAME_FORMAT_INT16)
+            || !decimation_from_factor(req->decimation ? req->decimation : 64, &decimation))
+        return PROTOCOL_EINVAL;
+    const bool raw = req->format == FRAME_FORMAT_INT16;
+    const size_t samplesize = frame_sample_size(req->format);
+
+    for (uint32_t i = 0; i < req->count; i++) {
+        float samplerate;
+        if (!acquire_buffer(srv, decimation, req->trigger == PROTOCOL_TRIGGER_EXT, raw, &samplerate))
+            return PROTOCOL_ETRIGGER;
+        const void *bufs[2] = {raw ? (void *)srv->raw1 : srv->buf1,
+                               raw ? (void *)srv->raw2 : srv->buf2};
+        for (int ch = 1; ch <= 2; ch++) {
+            struct frame_header header;
+            frame_header_init(&header, i, ch, req->format,
+                              RP_BASE_SAMPLERATE / samplerate, TRIGGER_SAMPLE,
+                              ADC_BUFFER_SIZE, INT16_SCALE);
+            if (!protocol_write(out, req->id, PROTOCOL_FRAME, PROTOCOL_OK, NULL,
+                                sizeof(header) + ADC_BUFFER_SIZE * samplesize)
+                    || !frame_write(out, &header, bufs[ch-1]))
+                return PROTOCOL_EWRITE;
+        }
+        if (fflush(out) != 0) return PROTOCOL_EWRITE;
+    }
+    return PROTOCOL_OK;
+}
+
+
+static int job_sweep(struct server *srv, const struct protocol_request *req, FILE *out) {
+    const bool logarithmic = req->flags & PROTOCOL_FLAG_LOG;
+    rp_acq_decimation_t fixed;
+    if (req->count == 0 || !(req->start > 0) || !(req->stop > 0)
+            || !(req->amplitude >= 0 && req->amplitude <= MAX_AMPLITUDE)
+            || !(req->settle >= 0 && req->settle <= MAX_SETTLE)
+            || (req->decimation != 0 && !decimation_from_factor(req->decimation, &fixed)))
+        return PROTOCOL_EINVAL;
+
+    struct gen_config sine = {
+        .trigger = RP_GEN_TRIG_SRC_INTERNAL,
+        .waveform = RP_WAVEFORM_SINE,
+        .amp = req->amplitude,
+        .mode = RP_GEN_MODE_CONTINUOUS,
+    };
+    int status = PROTOCOL_OK;
+    for (uint32_t i = 0; i < req->count; i++) {
+        struct protocol_point p;
+        p.freq = logarithmic ? log_scale_steps(i, req->count, req->start, req->stop)
+            : lin_scale_steps(i, req->count, req->start, req->stop);
+        rp_acq_decimation_t decimation = best_decimation_factor(p.freq, &p.samplerate);
+        if (req->decimation != 0) decimation = fixed;
+
+        sine.freq = p.freq;
+        gen_apply(&srv->generators, RP_CH_1, &sine);
+        rp_GenOutEnable(RP_CH_1);
+        usleep(req->settle * 1e6);
+        if (!acquire_buffer(srv, decimation, false, false, &p.samplerate)) {
+            status = PROTOCOL_ETRIGGER;
+            break;
+        }
+        const float *bufs[2] = {srv->buf1, srv->buf2};
+        for (int c = 0; c < 2; c++)
+            demodulate_iq(bufs[c], ADC_BUFFER_SIZE, p.freq, p.samplerate,
+                          &p.amp[c], &p.phase[c], &p.offset[c]);
+        if (!protocol_write(out, req->id, PROTOCOL_POINT, PROTOCOL_OK, &p, sizeof(p))
+                || fflush(out) != 0) {
+            status = PROTOCOL_EWRITE;
+            break;
+        }
+    }
+    rp_GenOutDisable(RP_CH_1);
+    return status;
+}
+
+
+/**
+ * Serve the jobs of one client until it disconnects.
+ */
+static void serve(struct server *srv, int fd) {
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    if (in == NULL || out == NULL) {
+        perror("fdopen");
+        if (in) fclose(in); else close(fd);
+        if (out) fclose(out);
+        return;
+    }
+
+    struct protocol_request req;
+    while (protocol_read(in, &req, sizeof(req))) {
+        if (req.magic != PROTOCOL_REQUEST_MAGIC) {
+            fprintf(stderr, "Invalid request, closing connection.\n");
+            break;
+        }
+        double start = monotonic_seconds();
+        int status;
+        switch (req.job) {
+        case PROTOCOL_PING:
+            status = PROTOCOL_OK;
+            break;
+        case PROTOCOL_ACQUIRE:
+            status = job_acquire(srv, &req, out);
+            break;
+        case PROTOCOL_SWEEP:
+            status = job_sweep(srv, &req, out);
+            break;
+        default:
+            status = PROTOCOL_EINVAL;
+        }
+        if (req.job != PROTOCOL_PING)
+            fprintf(stderr, "Job %u (%u): status %d, %.1f ms\n",
+                    req.id, req.job, status, 1e3 * (monotonic_seconds() - start));
+        if (status == PROTOCOL_EWRITE) break;
+        protocol_write(out, req.id, PROTOCOL_DONE, status, NULL, 0);
+        if (fflush(out) != 0) break;
+    }
+    fclose(in);
+    fclose(out);
+}
+
+
+int main(int argc, char **argv) {
+    char address[64];
+    snprintf(address, sizeof(address), "%d", PROTOCOL_DEFAULT_PORT);
+    if (argc == 2) {
+        snprintf(address, sizeof(address), "%s", argv[1]);
+    } else if (argc > 2) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        exit(1);
+    }
+
+    if (rp_Init() != RP_OK) {
+        fprintf(stderr, "RP api init failed!\n");
+        exit(2);
+    }
+    // DIO0_P is trigger input line / EXT_TRIG
+    rp_DpinSetDirection(RP_DIO0_P, RP_IN);
+    rp_DpinSetDirection(RP_DIO0_N, RP_OUT);
+    // DIO1_P is GND reference for initializer pre-stage
+    // and always set to LOW.
+    rp_DpinSetDirection(RP_DIO1_P, RP_OUT);
+    rp_DpinSetState(RP_DIO0_N, RP_LOW);
+    rp_DpinSetState(RP_DIO1_P, RP_LOW);
+
+    struct server srv = {0};
+    gen_cache_reset(&srv.generators);
+    trigger_wait_init(&srv.trigger, TRIGGER_TIMEOUT);
+    srv.trigger.retries = TRIGGER_RETRIES;
+    srv.buf1 = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    srv.buf2 = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    srv.raw1 = (int16_t *)malloc(ADC_BUFFER_SIZE * sizeof(int16_t));
+    srv.raw2 = (int16_t *)malloc(ADC_BUFFER_SIZE * sizeof(int16_t));
+    if (!srv.buf1 || !srv.buf2 || !srv.raw1 || !srv.raw2) {
+        fprintf(stderr, "Buffer allocation failed!\n");
+        exit(2);
+    }
+
+    // A client closing early must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+    int listener = protocol_listen(address);
+    if (listener < 0) exit(2);
+    fprintf(stderr, "Listening on %s\n", address);
+
+    while (true) {
+        int fd = protocol_accept(listener);
+        if (fd < 0) {
+            perror("accept");
+            continue;
+        }
+        fprintf(stderr, "Client connected.\n");
+        serve(&srv, fd);
+        fprintf(stderr, "Client disconnected.\n");
+    }
+
+    close(listener);
+    gen_cache_free(&srv.generators);
+    rp_GenReset();
+    rp_Release();
+    return 0;
+}
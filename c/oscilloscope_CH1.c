@@ -9,8 +9,7 @@
 
 #include "rp.h"
 
-// Number of samples in ADC buffer, equal to 2**14.
-#define RP_BUFFER_SIZE 16384
+#include "utility.h"
 
 
 int main(int argc, char **argv){
@@ -33,14 +32,11 @@ int main(int argc, char **argv){
 
     // wait for "look ahead" buffer to fill up
     uint32_t buffertime = RP_BUFFER_SIZE * 8 / 125; // us
-    rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
     usleep(buffertime);
-    while (1) {
-        rp_AcqGetTriggerState(&state);
-        if(state == RP_TRIG_STATE_TRIGGERED){
-            break;
-        }
-    }
+    // Wait for the signal as long as it takes
+    struct trigger_wait trigger;
+    trigger_wait_init(&trigger, 0);
+    wait_for_trigger(&trigger);
     usleep(buffertime);
 
     // Retrieve data
@@ -12,15 +12,60 @@
  * cmd line argument.  This trigger has an additional latency
  * of 0.2 to 0.3 microseconds.
  *
- * Usage: oscilloscope_gpio CH2DELAY [CHNUMOFFSET]
+ * Usage: oscilloscope_gpio [OPTIONS] CH2DELAY [CHNUMOFFSET]
  *
  * You may give a range for for CH2DELAY by using
- * START,NPOINTS,END.
+ * START,NPOINTS,END or a list of values by `list:V1,V2,...`.
+ *
+ * Options:
+ *
+ *     --freq F           Frequency for --demod [Hz].
+ *     --demod H1,H2,...  Demodulate on the Red Pitaya at the given
+ *                        harmonics of F instead of printing buffers.
+ *     --keep N           With --demod, also print the full buffers of
+ *                        every Nth sweep point.
+ *     --average N        Trigger N times per sweep point and print only
+ *                        the mean buffers (or their demodulation).
+ *     --reject K         With --average, drop buffers that deviate from
+ *                        the running mean by more than K times the
+ *                        typical deviation (e.g. 5), default off.
+ *     --variance         With --average, print the variance of every
+ *                        sample after each buffer, with negative CH.
+ *     --decimate R       Decimate the buffers by R (2 to 64) in software
+ *                        with an anti-aliasing filter (see decimate.h)
+ *                        before output and demodulation.  SAMPLERATE is
+ *                        divided by R and the trigger is at sample 200/R.
+ *                        Not with --variance.
+ *     --segments M,S     Segmented mode for short pulses: capture only
+ *                        S samples after each of M consecutive
+ *                        triggers per sweep point (M*S <= 16384) and
+ *                        print them as one batch.  Skips look-ahead and
+ *                        full buffer readout, so triggers follow each
+ *                        other within about 1ms.  Chains need the ready
+ *                        bus (see chain.h).
+ *     --dataset          Write the full buffers (and variances) to
+ *                        stdout as indexed binary dataset with int16
+ *                        samples (see dataset.h) instead of text, with
+ *                        F as frequency.  Not with --demod or
+ *                        --segments.
  *
  * Output data format (tab separated) to stdout:
  *
  *     SAMPLERATE CH2DELAY CH SAMPLES...
  *
+ * With --demod, samples after the trigger are demodulated and for
+ * every harmonic H the amplitude A, phase PH (relative to trigger),
+ * DC offset and residual RES (see demodulation.h) are printed:
+ *
+ *     SAMPLERATE CH2DELAY CH H1 A1 PH1 DC1 RES1 H2 A2 ...
+ *
+ * With --segments, one line per segment and channel with the index
+ * of the segment within the point and the time of its trigger [s]
+ * since the first trigger, followed by the samples from the trigger
+ * on:
+ *
+ *     SAMPLERATE CH2DELAY CH SEGMENT TIME SAMPLES...
+ *
  * Trigger position at sample 200
  *
  * Note: Default setting of digital IO pins is OUT, LOW.
@@ -29,33 +74,395 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <math.h>
 
 #include "rp.h"
 
+#include "average.h"
+#include "chain.h"
+#include "dataset.h"
+#include "decimate.h"
+#include "demodulation.h"
+#include "generator.h"
+#include "pipeline.h"
+#include "sweep.h"
 #include "utility.h"
 
 
 #define RP_GEN_SAMPLERATE 125e6
+// Fixed wait for followers, timeout with ready bus (see chain.h)
 #define CHAIN_LEADER_DELAY_US 100000
+// Trigger timeout [s] and re-arms before giving up
+#define TRIGGER_TIMEOUT 1.0
+#define TRIGGER_RETRIES 3
+#define TRIGGER_SAMPLE 200
+// Fixed wait for followers between segments.  With the ready bus the
+// leader fires as soon as all are armed, timeout as for full buffers.
+#ifdef READY_BUS
+#define CHAIN_SEGMENT_DELAY_US CHAIN_LEADER_DELAY_US
+#else
+#define CHAIN_SEGMENT_DELAY_US 500
+#endif
+// Longest trigger poll sleep in segmented mode, such that followers
+// pull the ready bus low soon after a trigger
+#define SEGMENT_MAX_SLEEP_US 20
+// Leader checks the ready bus at least this long after a trigger [us]
+#define SEGMENT_DETECT_US 200
+
+
+// Output settings, shared with the writer thread.
+struct output_options {
+    int chnumoffset;
+    float demodfreq;
+    int harmonics[DEMOD_BANK_SIZE];
+    int nharmonics;
+    int keepevery;
+    int naverage;
+    bool printvariance;
+    struct average *average;
+    float *mean[2], *variance[2];    // results of average
+    int decimation;
+    struct decimator *decimator;
+    float *decimated[2];
+    int nsegments;
+    uint32_t segmentsize;
+    // Trigger times of the segments of two points, one per pipeline
+    // slot (indexed by point index % 2).
+    double *segmenttimes;
+    double firsttrigger;
+    struct dataset_writer *dataset;
+};
+
+// Metadata of pipeline items, META_AVERAGE is the index of the
+// trigger within the point.
+enum { META_SAMPLERATE, META_TTLCH2_DELAY, META_AVERAGE };
+
+
+/**
+ * Add buffers of one trigger to the average of its sweep point.
+ *
+ * @return true after the last trigger of the point.
+ */
+static bool accumulate(const struct output_options *opts, const struct pipeline_item *item) {
+    const int a = item->meta[META_AVERAGE];
+    struct average *avg = opts->average;
+    if (a == 0) average_reset(avg);
+    average_add(avg, item->buf1, item->size1, item->buf2, item->size2);
+    timing_mark(TIMING_ANALYSIS);
+    if (a < opts->naverage - 1) return false;
+    if (avg->rejected > 0)
+        fprintf(stderr, "Point %ld: %ld of %d buffers rejected.\n",
+                item->index, avg->rejected, opts->naverage);
+    return true;
+}
+
+
+/**
+ * Print the segments of one sweep point.
+ */
+static void write_segments(const struct output_options *opts, const struct pipeline_item *item) {
+    const float *m = item->meta;
+    const double *times = opts->segmenttimes + (item->index % 2) * opts->nsegments;
+    const float *bufs[2] = {item->buf1, item->buf2};
+    for (int s = 0; s < opts->nsegments; s++) {
+        for (int ch = 1; ch <= 2; ch++) {
+            const float *buf = bufs[ch-1] + s * opts->segmentsize;
+            printf("%f\t%f\t%d\t%d\t%.7f", m[META_SAMPLERATE], m[META_TTLCH2_DELAY],
+                   ch+opts->chnumoffset, s, times[s] - opts->firsttrigger);
+            for (uint32_t i = 0; i < opts->segmentsize; i++) {
+                printf("\t%f", buf[i]);
+            }
+            printf("\n");
+        }
+    }
+}
+
+
+/**
+ * Write buffer of channel `ch` (negative for variances) to the
+ * dataset.
+ */
+static void write_dataset(const struct output_options *opts, const struct pipeline_item *item,
+                          float samplerate, int ch, const float *buf, uint32_t size) {
+    const struct dataset_record meta = {
+        .ch = ch,
+        .samplerate = samplerate,
+        .freq = opts->demodfreq,
+        .ch2delay = item->meta[META_TTLCH2_DELAY],
+    };
+    if (!dataset_write(opts->dataset, item->index, &meta, buf, size))
+        fprintf(stderr, "Writing dataset failed.\n");
+}
+
+
+/**
+ * Print data of one sweep point to stdout.  Runs on the writer thread
+ * of the pipeline while the next point is acquired.
+ */
+void write_point(const struct pipeline_item *item, void *ctx) {
+    const struct output_options *opts = (const struct output_options *)ctx;
+    const float *m = item->meta;
+    timing_point(item->index);
+    if (opts->nsegments > 0) {
+        write_segments(opts, item);
+        timing_mark(TIMING_OUTPUT);
+        timing_done();
+        return;
+    }
+    const float *bufs[2] = {item->buf1, item->buf2};
+    uint32_t sizes[2] = {item->size1, item->size2};
+    if (opts->naverage > 1) {
+        if (!accumulate(opts, item)) return;
+        for (int c = 0; c < 2; c++) {
+            sizes[c] = average_result(opts->average, c, opts->mean[c], opts->variance[c]);
+            bufs[c] = opts->mean[c];
+        }
+    }
+    float samplerate = m[META_SAMPLERATE];
+    uint32_t trigger = TRIGGER_SAMPLE;
+    if (opts->decimator) {
+        for (int c = 0; c < 2; c++) {
+            sizes[c] = decimate(opts->decimator, bufs[c], sizes[c], opts->decimated[c]);
+            bufs[c] = opts->decimated[c];
+        }
+        samplerate /= opts->decimation;
+        trigger = (TRIGGER_SAMPLE + opts->decimation/2) / opts->decimation;
+        timing_mark(TIMING_ANALYSIS);
+    }
+    bool fullbuffers = opts->nharmonics == 0
+        || (opts->keepevery > 0 && item->index % opts->keepevery == 0);
+    for (int ch = 1; ch <= 2; ch++) {
+        const float *buf = bufs[ch-1];
+        uint32_t bufsize = sizes[ch-1];
+        if (fullbuffers && opts->dataset) {
+            write_dataset(opts, item, samplerate, ch+opts->chnumoffset, buf, bufsize);
+            if (opts->printvariance)
+                write_dataset(opts, item, samplerate, -(ch+opts->chnumoffset),
+                              opts->variance[ch-1], bufsize);
+            continue;
+        }
+        if (fullbuffers) {
+            printf("%f\t%f\t%d", samplerate, m[META_TTLCH2_DELAY],
+                   ch+opts->chnumoffset);
+            for(uint32_t i = 0; i < bufsize; i++) {
+                printf("\t%f", buf[i]);
+            }
+            printf("\n");
+        }
+        if (fullbuffers && opts->printvariance) {
+            printf("%f\t%f\t%d", samplerate, m[META_TTLCH2_DELAY],
+                   -(ch+opts->chnumoffset));
+            for(uint32_t i = 0; i < bufsize; i++) {
+                printf("\t%e", opts->variance[ch-1][i]);
+            }
+            printf("\n");
+        }
+        if (opts->nharmonics > 0 && bufsize > trigger) {
+            printf("%f\t%f\t%d", samplerate, m[META_TTLCH2_DELAY],
+                   ch+opts->chnumoffset);
+            print_harmonics(buf + trigger, bufsize - trigger, opts->demodfreq,
+                            samplerate, opts->harmonics, opts->nharmonics);
+            printf("\n");
+        }
+    }
+    timing_mark(TIMING_OUTPUT);
+    timing_done();
+}
+
+
+/**
+ * Segmented mode: capture the segments of one sweep point into `item`
+ * and their trigger times into `times`.  The acquisition is re-armed
+ * without look-ahead as soon as the samples of a segment are read.
+ * The CH2 burst is re-armed by writing its trigger source
+ * `ttltrigger` (an assumption, see `gen_apply`).
+ *
+ * Segments follow each other faster than a buffer time, so with the
+ * ready bus the leader waits SEGMENT_DETECT_US after the previous
+ * trigger before checking the bus, when all followers (polling at
+ * most SEGMENT_MAX_SLEEP_US apart) have pulled it low.
+ *
+ * @return false if a trigger was lost.
+ */
+static bool acquire_segments(
+        const struct output_options *opts, struct trigger_wait *trigger,
+        rp_trig_src_t ttltrigger, float ttlCH2_delay,
+        struct pipeline_item *item, double *times) {
+    const uint32_t n = opts->segmentsize;
+    rp_AcqReset();
+    rp_AcqSetGain(RP_CH_1, RP_HIGH);
+    rp_AcqSetGain(RP_CH_2, RP_HIGH);
+    rp_AcqSetDecimation(RP_DEC_64);
+    // Keep writing a whole buffer after the trigger, such that its
+    // time can be found from the write pointer.
+    rp_AcqSetTriggerDelay(ADC_BUFFER_SIZE/2);
+    rp_AcqSetAveraging(1);
+    float samplerate;
+    rp_AcqGetSamplingRateHz(&samplerate);
+    timing_mark(TIMING_CONFIGURE);
+
+    for (int s = 0; s < opts->nsegments; s++) {
+        rp_DpinSetState(RP_DIO0_N, RP_HIGH);
+        rp_AcqStop();
+        rp_AcqStart();
+        rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
+        rp_GenTriggerSource(RP_CH_2, ttltrigger);
+        rp_GenOutEnable(RP_CH_2);
+#if defined(READY_BUS) && !defined(FOLLOW)
+        if (s > 0) {
+            double wait = times[s-1] + 1e-6 * SEGMENT_DETECT_US - monotonic_seconds();
+            if (wait > 0) usleep(1e6 * wait);
+        }
+#endif
+        chain_ready(CHAIN_SEGMENT_DELAY_US);
+        rp_DpinSetState(RP_DIO0_N, RP_LOW);
+        if (!wait_for_trigger(trigger)) return false;
+        chain_busy();
+        uint32_t written;
+        times[s] = acquisition_trigger_time(samplerate, &written);
+        timing_mark(TIMING_TRIGGER);
+        usleep(ttlCH2_delay * 1e6);
+        rp_GenOutDisable(RP_CH_2);
+        if (written < n)
+            usleep(1e6 * (n - written) / samplerate);
+        timing_mark(TIMING_FILL);
+
+        uint32_t pos, s1 = n, s2 = n;
+        rp_AcqGetWritePointerAtTrig(&pos);
+        rp_AcqGetDataV(RP_CH_1, pos, &s1, item->buf1 + s * n);
+        rp_AcqGetDataV(RP_CH_2, pos, &s2, item->buf2 + s * n);
+        timing_mark(TIMING_READOUT);
+    }
+    item->meta[META_SAMPLERATE] = samplerate;
+    item->size1 = item->size2 = opts->nsegments * n;
+    return true;
+}
 
 
 int main(int argc, char **argv){
-    float ttlCH2_start = 0, ttlCH2_end = 0;
-    int ttlCH2_npoints = 1;
-    int chnumoffset = 0;
+    // Parse options
+    struct output_options opts = {0};
+    opts.naverage = 1;
+    float reject = 0;
+    static const struct option options[] = {
+        {"freq", required_argument, NULL, 'f'},
+        {"demod", required_argument, NULL, 'd'},
+        {"keep", required_argument, NULL, 'k'},
+        {"average", required_argument, NULL, 'a'},
+        {"reject", required_argument, NULL, 'r'},
+        {"variance", no_argument, NULL, 'v'},
+        {"decimate", required_argument, NULL, 'D'},
+        {"segments", required_argument, NULL, 's'},
+        {"dataset", no_argument, NULL, 'X'},
+        {NULL, 0, NULL, 0}
+    };
+    bool dataset = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            opts.demodfreq = strtof(optarg, NULL);
+            break;
+        case 'd':
+            opts.nharmonics = parse_cmd_line_int_list(optarg, opts.harmonics, DEMOD_BANK_SIZE);
+            if (opts.nharmonics == 0) {
+                fprintf(stderr, "Invalid harmonics.\n");
+                exit(1);
+            }
+            break;
+        case 'k':
+            opts.keepevery = strtol(optarg, NULL, 10);
+            break;
+        case 'a':
+            opts.naverage = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            reject = strtof(optarg, NULL);
+            break;
+        case 'v':
+            opts.printvariance = true;
+            break;
+        case 'D':
+            opts.decimation = strtol(optarg, NULL, 10);
+            break;
+        case 's': {
+            int values[2];
+            if (parse_cmd_line_int_list(optarg, values, 2) != 2
+                    || values[0] < 1 || values[1] < 1
+                    || (long)values[0] * values[1] > ADC_BUFFER_SIZE) {
+                fprintf(stderr, "Invalid --segments.\n");
+                exit(1);
+            }
+            opts.nsegments = values[0];
+            opts.segmentsize = values[1];
+            break;
+        }
+        case 'X':
+            dataset = true;
+            break;
+        default:
+            exit(1);
+        }
+    }
+    if (opts.nharmonics > 0 && opts.demodfreq <= 0) {
+        fprintf(stderr, "Option --demod requires --freq.\n");
+        exit(1);
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (opts.naverage < 1 || (opts.printvariance && opts.naverage < 2)) {
+        fprintf(stderr, "Invalid --average.\n");
+        exit(1);
+    }
+    if (opts.decimation > 0) {
+        opts.decimator = decimator_create(opts.decimation, ADC_BUFFER_SIZE);
+        if (opts.decimator == NULL || opts.printvariance) {
+            fprintf(stderr, "Invalid --decimate.\n");
+            exit(1);
+        }
+        for (int c = 0; c < 2; c++)
+            opts.decimated[c] = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    }
+    if (opts.nsegments > 0) {
+        if (opts.naverage > 1 || opts.decimation > 0 || opts.nharmonics > 0) {
+            fprintf(stderr, "Option --segments is not combinable.\n");
+            exit(1);
+        }
+        opts.segmenttimes = (double *)malloc(2 * opts.nsegments * sizeof(double));
+    }
+    if (dataset && (opts.nharmonics > 0 || opts.nsegments > 0)) {
+        fprintf(stderr, "Invalid --dataset.\n");
+        exit(1);
+    }
+
+    struct sweep sweep;
+    sweep_init(&sweep);
     if (argc >= 2) {
-        if (!parse_cmd_line_range(argv[1], &ttlCH2_start, &ttlCH2_end, &ttlCH2_npoints)) {
+        if (!sweep_axis(&sweep, "ch2delay", argv[1], SWEEP_LIN, 0)) {
             fprintf(stderr, "Invalid argument.\n");
             exit(1);
         }
     }
     if (argc == 3) {
-        chnumoffset = strtol(argv[2], NULL, 10);
+        opts.chnumoffset = strtol(argv[2], NULL, 10);
     }
     if (argc < 2 || argc > 3) {
         fprintf(stderr, "Invalid number of arguments.\n");
         exit(1);
     }
+    if (dataset) {
+        uint32_t trigger = opts.decimation > 0 ?
+            (TRIGGER_SAMPLE + opts.decimation/2) / opts.decimation : TRIGGER_SAMPLE;
+        opts.dataset = dataset_create(stdout, "oscilloscope_gpio", trigger);
+        if (opts.dataset == NULL || !dataset_add_sweep(opts.dataset, &sweep)) {
+            fprintf(stderr, "Dataset setup failed!\n");
+            exit(2);
+        }
+    }
+
+    timing_init();
 
     // Print error, if rp_Init() function failed
     if (rp_Init() != RP_OK) {
@@ -71,94 +478,172 @@ int main(int argc, char **argv){
     rp_DpinSetDirection(RP_DIO1_P, RP_OUT);
     rp_DpinSetState(RP_DIO0_N, RP_LOW);
     rp_DpinSetState(RP_DIO1_P, RP_LOW);
+    chain_init();
 
-    uint32_t bufsize = ADC_BUFFER_SIZE;
-    float *buf = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    // Double buffered output: the next point is acquired while the
+    // writer thread prints the previous one.
+    struct pipeline *pipeline = pipeline_create(2, ADC_BUFFER_SIZE, write_point, &opts);
+    if (pipeline == NULL) {
+        fprintf(stderr, "Pipeline setup failed!\n");
+        exit(2);
+    }
+    struct average average;
+    if (opts.naverage > 1) {
+        if (!average_init(&average, ADC_BUFFER_SIZE, reject)) {
+            fprintf(stderr, "Average setup failed!\n");
+            exit(2);
+        }
+        opts.average = &average;
+        for (int c = 0; c < 2; c++) {
+            opts.mean[c] = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+            if (opts.printvariance)
+                opts.variance[c] = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+        }
+    }
     float *trigwaveform = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    float ttl_delay = NAN;  // of the waveform in trigwaveform
+    struct gen_cache generators = {0};
+    gen_cache_reset(&generators);
+    struct gen_config ttl = {
+        .trigger = RP_GEN_TRIG_SRC_EXT_NE,
+        .waveform = RP_WAVEFORM_ARBITRARY,
+        .arb = trigwaveform,
+        .arb_length = ADC_BUFFER_SIZE,
+        .freq = RP_GEN_SAMPLERATE/ADC_BUFFER_SIZE,
+        .amp = 1,
+        .mode = RP_GEN_MODE_BURST,
+        .burst_count = 1,
+    };
+
+    // Leader re-fires a lost trigger, followers wait for the leader
+    // as long as it takes.
+    struct trigger_wait trigger;
+    trigger_wait_init(&trigger, TRIGGER_TIMEOUT);
+#ifdef FOLLOW
+    trigger.rearm = rearm_ext_trigger;
+    trigger.retries = -1;
+#else
+    trigger.rearm = refire_ext_trigger;
+    trigger.retries = TRIGGER_RETRIES;
+#endif
+    if (opts.nsegments > 0) trigger.maxsleep = SEGMENT_MAX_SLEEP_US;
 
-    for (int ttlCH2_i = 0; ttlCH2_i < ttlCH2_npoints; ttlCH2_i++) {
-        float ttlCH2_delay = lin_scale_steps(
-            ttlCH2_i, ttlCH2_npoints, ttlCH2_start, ttlCH2_end);
+    // Exit status 3 if a trigger was lost, the points acquired so far
+    // are still written.
+    int status = 0;
+    while (status == 0 && sweep_next(&sweep)) {
+        float ttlCH2_delay = sweep_value(&sweep, 0);
         fprintf(stderr, "%3.0f%% %.2fus\n",
-                100.0*ttlCH2_i/(ttlCH2_npoints-1), ttlCH2_delay*1e6);
+                100.0*sweep.index/(sweep.npoints-1), ttlCH2_delay*1e6);
+        timing_point(sweep.index);
 
-        rp_DpinSetState(RP_DIO0_N, RP_HIGH);
+        // Prepare CH2 trigger using arbitrary waveform, only changed
+        // settings are written.
+        if (ttlCH2_delay != ttl_delay) {
+            ttl_arb_waveform(RP_GEN_SAMPLERATE, ttlCH2_delay, trigwaveform, ADC_BUFFER_SIZE);
+            ttl_delay = ttlCH2_delay;
+        }
 
-        // Setup both ADC channels
-        rp_AcqReset();
-        rp_AcqSetGain(RP_CH_1, RP_HIGH);
-        rp_AcqSetGain(RP_CH_2, RP_HIGH);
-        rp_AcqSetDecimation(RP_DEC_64);
-        rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
-        rp_AcqSetTriggerDelay(7992); // trigger at sample 200
-        rp_AcqSetAveraging(1);
-        rp_AcqStart();
+        if (opts.nsegments > 0) {
+            gen_apply(&generators, RP_CH_2, &ttl);
+            struct pipeline_item *item = pipeline_next(pipeline);
+            double *times = opts.segmenttimes + (sweep.index % 2) * opts.nsegments;
+            if (!acquire_segments(&opts, &trigger, ttl.trigger, ttlCH2_delay, item, times)) {
+                fprintf(stderr, "Trigger lost, stopping.\n");
+                status = 3;
+                break;
+            }
+            if (sweep.index == 0) opts.firsttrigger = times[0];
+            item->index = sweep.index;
+            item->meta[META_TTLCH2_DELAY] = ttlCH2_delay;
+            pipeline_submit(pipeline, item);
+            continue;
+        }
 
-        // Prepare CH2 trigger using arbitrary waveform
-        rp_GenReset();
-        ttl_arb_waveform(RP_GEN_SAMPLERATE, ttlCH2_delay, trigwaveform, ADC_BUFFER_SIZE);
-        rp_GenReset();
-        rp_GenTriggerSource(RP_CH_2, RP_GEN_TRIG_SRC_EXT_NE);
-        rp_GenWaveform(RP_CH_2, RP_WAVEFORM_ARBITRARY);
-        rp_GenArbWaveform(RP_CH_2, trigwaveform, ADC_BUFFER_SIZE);
-        rp_GenFreq(RP_CH_2, RP_GEN_SAMPLERATE/ADC_BUFFER_SIZE);
-        rp_GenAmp(RP_CH_2, 1);
-        rp_GenMode(RP_CH_2, RP_GEN_MODE_BURST);
-        rp_GenBurstCount(RP_CH_2, 1);
-        // Enable output (first sample always high) before `usleep`
-        // to let ringing dissipate.
-        rp_GenOutEnable(RP_CH_2);
+        // Repeated triggers of one point are averaged by the writer
+        // thread.
+        for (int a = 0; a < opts.naverage; a++) {
+            rp_DpinSetState(RP_DIO0_N, RP_HIGH);
 
-        // Wait for "look ahead" buffer to fill up
-        float samplerate;
-        rp_AcqGetSamplingRateHz(&samplerate);
-        uint32_t buffertime = (uint32_t)(1e6 * ADC_BUFFER_SIZE / samplerate); // us
-        rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
-        usleep(buffertime);
-
-        // Fire trigger
-#ifndef FOLLOW
-        // Leader of a chain of Red Pitayas waits
-        // so that others can catch up to here and are actually
-        // also awaiting the next trigger signal.
-        usleep(CHAIN_LEADER_DELAY_US);
-#endif
-        rp_DpinSetState(RP_DIO0_N, RP_LOW);
+            // Setup both ADC channels
+            rp_AcqReset();
+            rp_AcqSetGain(RP_CH_1, RP_HIGH);
+            rp_AcqSetGain(RP_CH_2, RP_HIGH);
+            rp_AcqSetDecimation(RP_DEC_64);
+            rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
+            rp_AcqSetTriggerDelay(7992); // trigger at sample 200
+            rp_AcqSetAveraging(1);
+            rp_AcqStart();
+
+            gen_apply(&generators, RP_CH_2, &ttl);
+            // Enable output (first sample always high) before `usleep`
+            // to let ringing dissipate.
+            rp_GenOutEnable(RP_CH_2);
 
-        // Wait until acquisition trigger fired
-        while (1) {
-            rp_AcqGetTriggerState(&state);
-            if(state == RP_TRIG_STATE_TRIGGERED){
+            // Wait for "look ahead" buffer to fill up
+            float samplerate;
+            rp_AcqGetSamplingRateHz(&samplerate);
+            uint32_t buffertime = (uint32_t)(1e6 * ADC_BUFFER_SIZE / samplerate); // us
+            timing_mark(TIMING_CONFIGURE);
+            usleep(buffertime);
+            timing_mark(TIMING_LOOKAHEAD);
+
+            // Fire trigger
+            // Leader of a chain of Red Pitayas waits until the others
+            // are actually also awaiting the next trigger signal.
+            chain_ready(CHAIN_LEADER_DELAY_US);
+            rp_DpinSetState(RP_DIO0_N, RP_LOW);
+
+            // Wait until acquisition trigger fired
+            if (!wait_for_trigger(&trigger)) {
+                fprintf(stderr, "Trigger lost, stopping.\n");
+                status = 3;
                 break;
             }
-        }
-        // Wait for delayed CH2 trigger
-        usleep(ttlCH2_delay * 1e6);
-        // Prevent CH2 trigger from returning to high
-        rp_GenOutDisable(RP_CH_2);
+            chain_busy();
+            timing_mark(TIMING_TRIGGER);
+            // Wait for delayed CH2 trigger
+            usleep(ttlCH2_delay * 1e6);
+            // Prevent CH2 trigger from returning to high
+            rp_GenOutDisable(RP_CH_2);
 
-        // Wait until ADC buffer is full
-        usleep(buffertime);
+            // Wait until ADC buffer is full
+            usleep(buffertime);
+            timing_mark(TIMING_FILL);
 
-        // Retrieve data and print data to stdout
-        rp_AcqGetOldestDataV(RP_CH_1, &bufsize, buf);
-        printf("%f\t%f\t%d", samplerate, ttlCH2_delay, 1+chnumoffset);
-        for(uint32_t i = 0; i < bufsize; i++) {
-            printf("\t%f", buf[i]);
+            // Retrieve data and pass it to writer thread
+            struct pipeline_item *item = pipeline_next(pipeline);
+            item->index = sweep.index;
+            item->meta[META_AVERAGE] = a;
+            item->meta[META_SAMPLERATE] = samplerate;
+            item->meta[META_TTLCH2_DELAY] = ttlCH2_delay;
+            item->size1 = item->size2 = ADC_BUFFER_SIZE;
+            rp_AcqGetOldestDataV(RP_CH_1, &item->size1, item->buf1);
+            rp_AcqGetOldestDataV(RP_CH_2, &item->size2, item->buf2);
+            timing_mark(TIMING_READOUT);
+            pipeline_submit(pipeline, item);
         }
-        printf("\n");
+    }
 
-        rp_AcqGetOldestDataV(RP_CH_2, &bufsize, buf);
-        printf("%f\t%f\t%d", samplerate, ttlCH2_delay, 2+chnumoffset);
-        for(uint32_t i = 0; i < bufsize; i++) {
-            printf("\t%f", buf[i]);
+    pipeline_finish(pipeline);
+    if (opts.dataset && !dataset_finish(opts.dataset))
+        fprintf(stderr, "Writing dataset failed.\n");
+    timing_summary();
+    if (opts.naverage > 1) {
+        average_free(&average);
+        for (int c = 0; c < 2; c++) {
+            free(opts.mean[c]);
+            free(opts.variance[c]);
         }
-        printf("\n");
     }
-
+    decimator_free(opts.decimator);
+    free(opts.segmenttimes);
+    free(opts.decimated[0]);
+    free(opts.decimated[1]);
+    gen_cache_free(&generators);
     free(trigwaveform);
-    free(buf);
     rp_GenReset();
+    sweep_free(&sweep);
     rp_Release();
-    return 0;
+    return status;
 }
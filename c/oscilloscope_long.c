@@ -0,0 +1,181 @@
+/**
+ * Acquire a long record of both RF analog inputs, e.g. a ring-down
+ * much longer than one ADC buffer.  The ring buffer is read while it
+ * is written (see `struct stream` in utility.h), so the record length
+ * is only limited by the time and not by the buffer size.
+ *
+ * Triggered immediately, or with --ext at the negative edge of the
+ * external trigger DIO0_P of extension connector E1 (3.3V).
+ *
+ * Usage: oscilloscope_long [OPTIONS] LENGTH
+ *
+ * LENGTH is the number of samples per channel including the 200
+ * samples before the trigger.
+ *
+ * Options:
+ *
+ *     --decimation D   Hardware decimation 1, 8, 64 (default), 1024,
+ *                      8192 or 65536.  Both channels can be streamed
+ *                      up to about 2Msps (64).
+ *     --ext            Wait for the external trigger.
+ *     --block N        Samples per output line, default 16384.
+ *
+ * Output data format (tab separated) to stdout, one line per block
+ * and channel:
+ *
+ *     SAMPLERATE FIRST CH SAMPLES...
+ *
+ * where FIRST is the index of the first sample relative to the
+ * trigger.  Blocks are gap free.  Samples lost in an overrun (not
+ * read before they were overwritten) are reported on stderr and show
+ * as a jump of FIRST; the exit status is then 4.
+ *
+ * Trigger position at sample 200
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "rp.h"
+
+#include "pipeline.h"
+#include "utility.h"
+
+
+// Trigger timeout [s] and re-arms before giving up
+#define TRIGGER_TIMEOUT 1.0
+#define TRIGGER_RETRIES 3
+#define TRIGGER_SAMPLE 200
+// Blocks queued for output, to bridge stalls of stdout
+#define OUTPUT_SLOTS 8
+
+// Metadata of pipeline items, the index is the first sample of the
+// block within the record.
+enum { META_SAMPLERATE };
+
+
+/**
+ * Print one block of both channels.  Runs on the writer thread of
+ * the pipeline while the next block is read.
+ */
+void write_block(const struct pipeline_item *item, void *ctx) {
+    timing_point(item->index);
+    const float *bufs[2] = {item->buf1, item->buf2};
+    uint32_t sizes[2] = {item->size1, item->size2};
+    for (int ch = 1; ch <= 2; ch++) {
+        printf("%f\t%ld\t%d", item->meta[META_SAMPLERATE],
+               item->index - TRIGGER_SAMPLE, ch);
+        for (uint32_t i = 0; i < sizes[ch-1]; i++) {
+            printf("\t%f", bufs[ch-1][i]);
+        }
+        printf("\n");
+    }
+    timing_mark(TIMING_OUTPUT);
+    timing_done();
+}
+
+
+int main(int argc, char **argv) {
+    rp_acq_decimation_t decimation = RP_DEC_64;
+    bool ext = false;
+    uint32_t blocksize = ADC_BUFFER_SIZE;
+
+    static const struct option options[] = {
+        {"decimation", required_argument, NULL, 'd'},
+        {"ext", no_argument, NULL, 'e'},
+        {"block", required_argument, NULL, 'b'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            if (!decimation_from_factor(strtol(optarg, NULL, 10), &decimation)) {
+                fprintf(stderr, "Invalid decimation.\n");
+                exit(1);
+            }
+            break;
+        case 'e':
+            ext = true;
+            break;
+        case 'b':
+            blocksize = strtoul(optarg, NULL, 10);
+            if (blocksize == 0 || blocksize > ADC_BUFFER_SIZE) {
+                fprintf(stderr, "Invalid block size.\n");
+                exit(1);
+            }
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc != 2) {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        exit(1);
+    }
+    uint64_t length = strtoull(argv[1], NULL, 10);
+    if (length <= TRIGGER_SAMPLE) {
+        fprintf(stderr, "Invalid length.\n");
+        exit(1);
+    }
+
+    timing_init();
+    if (rp_Init() != RP_OK) {
+        fprintf(stderr, "RP api init failed!\n");
+        exit(2);
+    }
+    rp_DpinSetDirection(RP_DIO0_P, RP_IN);
+
+    struct pipeline *pipeline = pipeline_create(OUTPUT_SLOTS, blocksize, write_block, NULL);
+    if (pipeline == NULL) {
+        fprintf(stderr, "Pipeline setup failed!\n");
+        exit(2);
+    }
+
+    struct trigger_wait trigger;
+    trigger_wait_init(&trigger, TRIGGER_TIMEOUT);
+    trigger.rearm = ext ? rearm_ext_trigger : rearm_trigger_now;
+    trigger.retries = ext ? -1 : TRIGGER_RETRIES;
+
+    struct stream stream;
+    if (!stream_start(&stream, decimation, false,
+                      ext ? RP_TRIG_SRC_EXT_NE : RP_TRIG_SRC_NOW,
+                      TRIGGER_SAMPLE, length)) {
+        fprintf(stderr, "Stream setup failed!\n");
+        exit(2);
+    }
+    if (!stream_wait_trigger(&stream, &trigger)) {
+        fprintf(stderr, "Trigger lost, stopping.\n");
+        pipeline_finish(pipeline);
+        exit(3);
+    }
+
+    uint64_t recorded = 0;
+    while (true) {
+        struct pipeline_item *item = pipeline_next(pipeline);
+        uint32_t n = stream_fill(&stream, item->buf1, item->buf2, blocksize);
+        if (n == 0) break;
+        if (stream.gap > 0)
+            fprintf(stderr, "Overrun: %" PRIu64 " samples lost before sample %" PRId64 ".\n",
+                    stream.gap, (int64_t)stream.first - TRIGGER_SAMPLE);
+        item->index = stream.first;
+        item->meta[META_SAMPLERATE] = stream.samplerate;
+        item->size1 = item->size2 = n;
+        pipeline_submit(pipeline, item);
+        recorded += n;
+    }
+    stream_stop(&stream);
+
+    pipeline_finish(pipeline);
+    timing_summary();
+    fprintf(stderr, "Recorded %" PRIu64 " of %" PRIu64 " samples, %lu overruns.\n",
+            recorded, length, stream.overruns);
+    rp_Release();
+    return stream.overruns > 0 ? 4 : 0;
+}
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+
+
+/**
+ * Items are used round robin: the producer fills item `head`, the
+ * writer thread consumes item `tail`.  `nfilled` items between tail
+ * and head are waiting to be written.
+ */
+struct pipeline {
+    struct pipeline_item *items;
+    size_t nslots;
+    size_t head, tail, nfilled;
+    bool finished;
+    pipeline_consumer_t consumer;
+    void *ctx;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;  // signalled when an item was submitted
+    pthread_cond_t freed;   // signalled when an item was written
+};
+
+
+static void *pipeline_writer(void *arg) {
+    struct pipeline *p = (struct pipeline *)arg;
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (p->nfilled == 0 && !p->finished)
+            pthread_cond_wait(&p->filled, &p->lock);
+        if (p->nfilled == 0) break;
+        struct pipeline_item *item = &p->items[p->tail];
+        pthread_mutex_unlock(&p->lock);
+
+        p->consumer(item, p->ctx);
+
+        pthread_mutex_lock(&p->lock);
+        p->tail = (p->tail + 1) % p->nslots;
+        p->nfilled--;
+        pthread_cond_signal(&p->freed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+
+struct pipeline *pipeline_create(
+        size_t nslots, uint32_t bufsize,
+        pipeline_consumer_t consumer, void *ctx) {
+    struct pipeline *p = (struct pipeline *)calloc(1, sizeof(struct pipeline));
+    if (p == NULL) return NULL;
+    p->items = (struct pipeline_item *)calloc(nslots, sizeof(struct pipeline_item));
+    if (p->items == NULL) {
+        free(p);
+        return NULL;
+    }
+    p->nslots = nslots;
+    p->consumer = consumer;
+    p->ctx = ctx;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->filled, NULL);
+    pthread_cond_init(&p->freed, NULL);
+
+    for (size_t i = 0; i < nslots; i++) {
+        p->items[i].buf1 = (float *)malloc(bufsize * sizeof(float));
+        p->items[i].buf2 = (float *)malloc(bufsize * sizeof(float));
+        if (p->items[i].buf1 == NULL || p->items[i].buf2 == NULL) {
+            p->finished = true;
+            pipeline_finish(p);
+            return NULL;
+        }
+    }
+
+    if (pthread_create(&p->thread, NULL, pipeline_writer, p) != 0) {
+        p->finished = true;
+        pipeline_finish(p);
+        return NULL;
+    }
+    return p;
+}
+
+
+struct pipeline_item *pipeline_next(struct pipeline *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->nfilled == p->nslots)
+        pthread_cond_wait(&p->freed, &p->lock);
+    struct pipeline_item *item = &p->items[p->head];
+    pthread_mutex_unlock(&p->lock);
+    return item;
+}
+
+
+void pipeline_submit(struct pipeline *p, struct pipeline_item *item) {
+    pthread_mutex_lock(&p->lock);
+    p->head = (p->head + 1) % p->nslots;
+    p->nfilled++;
+    pthread_cond_signal(&p->filled);
+    pthread_mutex_unlock(&p->lock);
+}
+
+
+void pipeline_finish(struct pipeline *p) {
+    pthread_mutex_lock(&p->lock);
+    bool running = !p->finished;
+    p->finished = true;
+    pthread_cond_signal(&p->filled);
+    pthread_mutex_unlock(&p->lock);
+    if (running)
+        pthread_join(p->thread, NULL);
+
+    for (size_t i = 0; i < p->nslots; i++) {
+        free(p->items[i].buf1);
+        free(p->items[i].buf2);
+    }
+    pthread_cond_destroy(&p->freed);
+    pthread_cond_destroy(&p->filled);
+    pthread_mutex_destroy(&p->lock);
+    free(p->items);
+    free(p);
+}
@@ -0,0 +1,67 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Number of metadata values per pipeline item.
+#define PIPELINE_NMETA 8
+
+
+/**
+ * Acquired data of one sweep point: both channel buffers and
+ * metadata, e.g. samplerate and sweep parameters.
+ */
+struct pipeline_item {
+    long index;                    // running index of sweep point
+    long point;                    // program specific, e.g. point in nested order
+    float meta[PIPELINE_NMETA];    // program specific metadata
+    uint32_t size1, size2;         // number of valid samples
+    float *buf1, *buf2;            // buffers for CH1 and CH2
+};
+
+
+/**
+ * Called on the writer thread for each item, in the order of
+ * submission.
+ */
+typedef void (*pipeline_consumer_t)(const struct pipeline_item *item, void *ctx);
+
+
+struct pipeline;
+
+
+/**
+ * Create a bounded pool of `nslots` items with buffers of `bufsize`
+ * samples per channel and start the writer thread.  All memory is
+ * allocated here.  With two slots, the next point can be acquired
+ * while the previous one is written (double buffering).
+ *
+ * @return NULL on failure.
+ */
+struct pipeline *pipeline_create(
+    size_t nslots, uint32_t bufsize,
+    pipeline_consumer_t consumer, void *ctx);
+
+
+/**
+ * Get a free item to fill with data.  Blocks while all items are
+ * waiting to be written.
+ */
+struct pipeline_item *pipeline_next(struct pipeline *pipeline);
+
+
+/**
+ * Hand filled item obtained by `pipeline_next` to the writer thread.
+ */
+void pipeline_submit(struct pipeline *pipeline, struct pipeline_item *item);
+
+
+/**
+ * Wait until all submitted items are written, stop the writer thread
+ * and free all memory.
+ */
+void pipeline_finish(struct pipeline *pipeline);
+
+#endif // __PIPELINE_H
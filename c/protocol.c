@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include "protocol.h"
+
+
+_Static_assert(sizeof(struct protocol_request) == 44,
+               "request must not contain padding");
+_Static_assert(sizeof(struct protocol_message) == 16,
+               "message header must not contain padding");
+_Static_assert(sizeof(struct protocol_point) == 32,
+               "point must not contain padding");
+
+// Pending connections of a listening socket
+#define PROTOCOL_BACKLOG 4
+
+
+static void set_nodelay(int fd) {
+    int one = 1;
+    // Fails harmlessly for Unix sockets.
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+
+/**
+ * Socket for `address`, bound (listen) or connected.
+ */
+static int protocol_socket(const char *address, bool listen) {
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un sa = {.sun_family = AF_UNIX};
+        if (strlen(address + 5) >= sizeof(sa.sun_path)) {
+            fprintf(stderr, "Socket path too long.\n");
+            return -1;
+        }
+        strcpy(sa.sun_path, address + 5);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        if (listen) unlink(sa.sun_path);
+        int r = listen ? bind(fd, (struct sockaddr *)&sa, sizeof(sa))
+            : connect(fd, (struct sockaddr *)&sa, sizeof(sa));
+        if (r < 0) {
+            perror(address);
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // [HOST:]PORT
+    char host[256] = "";
+    const char *port = address;
+    const char *colon = strrchr(address, ':');
+    if (colon != NULL) {
+        size_t len = colon - address;
+        if (len >= sizeof(host)) len = sizeof(host) - 1;
+        memcpy(host, address, len);
+        host[len] = '\0';
+        port = colon + 1;
+    }
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    if (listen) hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *ai;
+    int err = getaddrinfo(host[0] ? host : NULL, port, &hints, &ai);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = ai; a != NULL; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        if (listen) {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+        } else if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            set_nodelay(fd);
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    if (fd < 0) perror(address);
+    return fd;
+}
+
+
+int protocol_listen(const char *address) {
+    int fd = protocol_socket(address, true);
+    if (fd >= 0 && listen(fd, PROTOCOL_BACKLOG) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int protocol_connect(const char *address) {
+    return protocol_socket(address, false);
+}
+
+int protocol_accept(int listener) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd >= 0) set_nodelay(fd);
+    return fd;
+}
+
+
+bool protocol_write(
+        FILE *stream, uint32_t id, uint16_t type, int16_t status,
+        const void *payload, uint32_t size) {
+    struct protocol_message m = {
+        .magic = PROTOCOL_MESSAGE_MAGIC,
+        .id = id,
+        .type = type,
+        .status = status,
+        .size = size,
+    };
+    if (fwrite(&m, sizeof(m), 1, stream) != 1) return false;
+    return payload == NULL || size == 0 || fwrite(payload, size, 1, stream) == 1;
+}
+
+bool protocol_read(FILE *stream, void *buf, size_t size) {
+    return size == 0 || fread(buf, size, 1, stream) == 1;
+}
@@ -0,0 +1,148 @@
+#ifndef __PROTOCOL_H
+#define __PROTOCOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**
+ * Binary protocol of the measurement server (measure_server.c): the
+ * client sends fixed size requests, the server answers each with a
+ * sequence of messages, the last one of type PROTOCOL_DONE.  Requests
+ * are handled one after the other.
+ *
+ * All fields are in native byte order, which is little endian on Red
+ * Pitaya as well as on x86 hosts.  The structs have no padding.
+ */
+
+// Magic numbers ("RPRQ" and "RPRE" when read as little endian bytes)
+#define PROTOCOL_REQUEST_MAGIC 0x51525052
+#define PROTOCOL_MESSAGE_MAGIC 0x45525052
+
+// TCP port of the server if none is given
+#define PROTOCOL_DEFAULT_PORT 5100
+
+
+// Jobs
+enum protocol_job {
+    // Answered right away, e.g. to measure the round trip time
+    PROTOCOL_PING = 1,
+    // `count` triggered full buffers of both channels
+    PROTOCOL_ACQUIRE = 2,
+    // Frequency sweep on OUT1, demodulated at the drive frequency
+    PROTOCOL_SWEEP = 3,
+};
+
+// Trigger of PROTOCOL_ACQUIRE
+#define PROTOCOL_TRIGGER_NOW 0
+#define PROTOCOL_TRIGGER_EXT 1
+
+// Flags
+#define PROTOCOL_FLAG_LOG 1    // log-scaled sweep
+
+
+/**
+ * Request, 44 bytes (python struct format "<IIIIIBBHfffff").
+ */
+struct protocol_request {
+    uint32_t magic;        // PROTOCOL_REQUEST_MAGIC
+    uint32_t job;          // enum protocol_job
+    uint32_t id;           // echoed in all messages of the answer
+    uint32_t decimation;   // 1, 8, 64, 1024, 8192, 65536, 0 for auto
+    uint32_t count;        // buffers (acquire) or points (sweep)
+    uint8_t format;        // FRAME_FORMAT_FLOAT32 or FRAME_FORMAT_INT16
+    uint8_t trigger;       // PROTOCOL_TRIGGER_*
+    uint16_t flags;        // PROTOCOL_FLAG_*
+    float start, stop;     // sweep range [Hz]
+    float amplitude;       // OUT1 sweep amplitude [V]
+    float settle;          // wait before each sweep point [s], <= 10
+    float reserved;        // 0
+};
+
+
+// Message types
+enum protocol_type {
+    // Payload: frame header and samples (see frame.h)
+    PROTOCOL_FRAME = 1,
+    // Payload: struct protocol_point
+    PROTOCOL_POINT = 2,
+    // End of the answer, no payload
+    PROTOCOL_DONE = 3,
+};
+
+// Status of PROTOCOL_DONE
+#define PROTOCOL_OK 0
+#define PROTOCOL_EINVAL -1      // invalid request
+#define PROTOCOL_ETRIGGER -2    // trigger lost, job aborted
+#define PROTOCOL_EWRITE -3      // client gone, job aborted (not sent)
+
+
+/**
+ * Message header, 16 bytes (python struct format "<IIHhI"), followed
+ * by `size` bytes of payload.
+ */
+struct protocol_message {
+    uint32_t magic;        // PROTOCOL_MESSAGE_MAGIC
+    uint32_t id;           // of the request
+    uint16_t type;         // enum protocol_type
+    int16_t status;        // PROTOCOL_OK or error
+    uint32_t size;         // payload bytes
+};
+
+
+/**
+ * Result of one sweep point, 32 bytes (python struct format "<8f").
+ * Amplitude, phase and DC offset of both channels at `freq`.
+ */
+struct protocol_point {
+    float freq;            // [Hz]
+    float samplerate;      // [Hz]
+    float amp[2];          // [V]
+    float phase[2];        // [rad]
+    float offset[2];       // [V]
+};
+
+
+/**
+ * Listen on `address`: `unix:PATH` for a Unix socket, otherwise
+ * `[HOST:]PORT` for TCP (all interfaces if HOST is missing).
+ *
+ * @return Listening socket, -1 on error (printed).
+ */
+int protocol_listen(const char *address);
+
+/**
+ * Connect to `address` (see `protocol_listen`, HOST defaults to the
+ * local host).  TCP connections are set to TCP_NODELAY.
+ *
+ * @return Connected socket, -1 on error (printed).
+ */
+int protocol_connect(const char *address);
+
+/**
+ * Accept the next client, with TCP_NODELAY for TCP.
+ *
+ * @return Connected socket, -1 on error.
+ */
+int protocol_accept(int listener);
+
+/**
+ * Write header and payload of one message to `stream`.  Does not
+ * flush.  With `payload` NULL only the header is written and the
+ * caller writes the `size` bytes of payload, e.g. with `frame_write`.
+ *
+ * @return true if the complete message was written.
+ */
+bool protocol_write(
+    FILE *stream, uint32_t id, uint16_t type, int16_t status,
+    const void *payload, uint32_t size);
+
+/**
+ * Read exactly `size` bytes.
+ *
+ * @return false on end of file or error.
+ */
+bool protocol_read(FILE *stream, void *buf, size_t size);
+
+#endif // __PROTOCOL_H
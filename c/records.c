@@ -0,0 +1,447 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/wait.h>
+#include <pthread.h>
+
+#include "records.h"
+
+
+// Exactly representable powers of ten
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define MAX_POWER_OF_TEN 22
+// Significant digits that fit into the 64 bit mantissa
+#define MAX_DIGITS 19
+
+
+float parse_float(const char *s, const char **end) {
+    const char *p = s;
+    while (*p == ' ' || *p == '\t') p++;
+    const char *start = p;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+
+    uint64_t mantissa = 0;
+    int ndigits = 0, nsignificant = 0, exponent = 0;
+    for (; *p >= '0' && *p <= '9'; p++, ndigits++) {
+        if (nsignificant < MAX_DIGITS) {
+            mantissa = 10 * mantissa + (*p - '0');
+            if (mantissa > 0) nsignificant++;
+        } else {
+            exponent++;
+        }
+    }
+    if (*p == '.') {
+        for (p++; *p >= '0' && *p <= '9'; p++, ndigits++) {
+            if (nsignificant < MAX_DIGITS) {
+                mantissa = 10 * mantissa + (*p - '0');
+                if (mantissa > 0) nsignificant++;
+                exponent--;
+            }
+        }
+    }
+    if (ndigits > 0 && (*p == 'e' || *p == 'E')) {
+        const char *e = p + 1;
+        bool negexp = *e == '-';
+        if (*e == '-' || *e == '+') e++;
+        if (*e >= '0' && *e <= '9') {
+            int value = 0;
+            for (; *e >= '0' && *e <= '9'; e++)
+                if (value < 10000) value = 10 * value + (*e - '0');
+            exponent += negexp ? -value : value;
+            p = e;
+        }
+    }
+
+    if (ndigits > 0 && exponent >= -MAX_POWER_OF_TEN && exponent <= MAX_POWER_OF_TEN) {
+        *end = p;
+        double value = exponent < 0 ? mantissa / powers_of_ten[-exponent]
+            : mantissa * powers_of_ten[exponent];
+        return negative ? -value : value;
+    }
+    // Rare cases, but nothing that strtod would find after blanks
+    // (e.g. the next line after a newline).
+    if (ndigits > 0 || (*start != '\0' && strchr("+-.iInN", *start) != NULL)) {
+        char *e;
+        double value = strtod(start, &e);
+        if (e != start) {
+            *end = e;
+            return value;
+        }
+    }
+    *end = s;
+    return 0;
+}
+
+
+bool record_parse(
+        const char *line, const char *lineend, int nindex,
+        struct record *r, float *samples, uint32_t maxsamples) {
+    const char *p = line, *next;
+    for (int i = 0; i < nindex; i++) {
+        parse_float(p, &next);
+        if (next == p) return false;
+        p = next;
+    }
+    float meta[RECORD_NMETA];
+    for (int k = 0; k < RECORD_NMETA; k++) {
+        meta[k] = parse_float(p, &next);
+        if (next == p || next > lineend) return false;
+        p = next;
+    }
+    r->samplerate = meta[0];
+    r->freq = meta[1];
+    r->amp = meta[2];
+    r->phase = meta[3];
+    r->ch2delay = meta[4];
+    r->ch = meta[5];
+    r->meta = line;
+    r->metalen = p - line;
+    if (!(r->samplerate > 0) || !isfinite(r->freq)) return false;
+
+    uint32_t n = 0;
+    while (n < maxsamples) {
+        float value = parse_float(p, &next);
+        if (next == p || next > lineend) break;
+        samples[n++] = value;
+        p = next;
+    }
+    r->nsamples = n;
+    return true;
+}
+
+
+/**
+ * Make room for `n` more bytes.
+ */
+static bool records_reserve(struct records_output *out, size_t n) {
+    if (out->size + n <= out->capacity) return true;
+    size_t capacity = out->capacity > 0 ? 2 * out->capacity : 4096;
+    while (capacity < out->size + n) capacity *= 2;
+    char *grown = (char *)realloc(out->data, capacity);
+    if (grown == NULL) return false;
+    out->data = grown;
+    out->capacity = capacity;
+    return true;
+}
+
+
+bool records_append(struct records_output *out, const void *data, size_t n) {
+    void *p = records_extend(out, n);
+    if (p == NULL) return false;
+    memcpy(p, data, n);
+    return true;
+}
+
+
+void *records_extend(struct records_output *out, size_t n) {
+    if (!records_reserve(out, n)) return NULL;
+    void *p = out->data + out->size;
+    out->size += n;
+    return p;
+}
+
+
+bool records_write_stream(const void *data, size_t n, void *ctx) {
+    return fwrite(data, 1, n, (FILE *)ctx) == n;
+}
+
+
+bool records_printf(struct records_output *out, const char *format, ...) {
+    va_list args;
+    while (true) {
+        size_t room = out->capacity - out->size;
+        va_start(args, format);
+        int n = vsnprintf(out->data + out->size, room, format, args);
+        va_end(args);
+        if (n < 0) return false;
+        if ((size_t)n < room) {
+            out->size += n;
+            return true;
+        }
+        if (!records_reserve(out, n + 1)) return false;
+    }
+}
+
+
+/**
+ * Chunks are used round robin by their running number: the reader
+ * fills chunk `nread`, workers claim chunks from `nclaimed` on and the
+ * writer writes chunk `nwritten` as soon as it is `done`.
+ */
+struct chunk {
+    char *text;                  // lines, terminated by '\0'
+    size_t size, capacity;
+    struct records_output out;
+    unsigned long records, skipped;
+    bool done;
+};
+
+struct records_job {
+    struct chunk *chunks;
+    size_t nchunks;
+    unsigned long nread, nclaimed, nwritten;
+    bool eof;       // no more chunks will be read
+    bool failed;    // sink failed
+
+    records_sink_t sink;
+    void *sinkctx;
+    int nindex;
+    record_handler_t handler;
+    void *ctx;
+    struct records_stats stats;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // broadcast on any change of state
+};
+
+
+static void process_chunk(struct records_job *job, struct chunk *c,
+                          float **samples, uint32_t *maxsamples) {
+    c->out.size = 0;
+    c->records = c->skipped = 0;
+    const char *p = c->text, *end = c->text + c->size;
+    while (p < end) {
+        const char *lineend = (const char *)memchr(p, '\n', end - p);
+        if (lineend == NULL) lineend = end;
+        if (lineend > p) {
+            // At most one number per two characters
+            uint32_t n = (lineend - p) / 2 + 1;
+            if (n > *maxsamples) {
+                float *grown = (float *)realloc(*samples, n * sizeof(float));
+                if (grown != NULL) {
+                    *samples = grown;
+                    *maxsamples = n;
+                }
+            }
+            struct record r;
+            if (record_parse(p, lineend, job->nindex, &r, *samples, *maxsamples)
+                    && job->handler(&r, *samples, &c->out, job->ctx))
+                c->records++;
+            else
+                c->skipped++;
+        }
+        p = lineend + 1;
+    }
+}
+
+
+static void *records_worker(void *arg) {
+    struct records_job *job = (struct records_job *)arg;
+    float *samples = NULL;
+    uint32_t maxsamples = 0;
+    pthread_mutex_lock(&job->lock);
+    while (true) {
+        while (job->nclaimed == job->nread && !job->eof)
+            pthread_cond_wait(&job->changed, &job->lock);
+        if (job->nclaimed == job->nread) break;
+        struct chunk *c = &job->chunks[job->nclaimed++ % job->nchunks];
+        pthread_mutex_unlock(&job->lock);
+
+        process_chunk(job, c, &samples, &maxsamples);
+
+        pthread_mutex_lock(&job->lock);
+        c->done = true;
+        pthread_cond_broadcast(&job->changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    free(samples);
+    return NULL;
+}
+
+
+static void *records_writer(void *arg) {
+    struct records_job *job = (struct records_job *)arg;
+    pthread_mutex_lock(&job->lock);
+    while (true) {
+        while (!(job->nwritten < job->nread && job->chunks[job->nwritten % job->nchunks].done)
+               && !(job->eof && job->nwritten == job->nread))
+            pthread_cond_wait(&job->changed, &job->lock);
+        if (job->nwritten == job->nread) break;
+        struct chunk *c = &job->chunks[job->nwritten % job->nchunks];
+        pthread_mutex_unlock(&job->lock);
+
+        bool written = c->out.size == 0 || job->sink(c->out.data, c->out.size, job->sinkctx);
+
+        pthread_mutex_lock(&job->lock);
+        if (!written) job->failed = true;
+        job->stats.records += c->records;
+        job->stats.skipped += c->skipped;
+        job->stats.bytes += c->size;
+        c->done = false;
+        job->nwritten++;
+        pthread_cond_broadcast(&job->changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+
+/**
+ * Fill chunk with the incomplete line `carry` left over from the last
+ * chunk and about RECORDS_CHUNK_SIZE bytes of input up to the last
+ * complete line, which is kept in `carry` for the next chunk.
+ *
+ * @return false on allocation failure.
+ */
+static bool read_chunk(FILE *in, struct chunk *c, struct records_output *carry, bool *eof) {
+    size_t capacity = carry->size + RECORDS_CHUNK_SIZE + 1;
+    if (c->capacity < capacity) {
+        char *grown = (char *)realloc(c->text, capacity);
+        if (grown == NULL) return false;
+        c->text = grown;
+        c->capacity = capacity;
+    }
+    memcpy(c->text, carry->data, carry->size);
+    c->size = carry->size;
+    carry->size = 0;
+
+    while (true) {
+        size_t room = c->capacity - 1 - c->size;
+        size_t got = fread(c->text + c->size, 1, room, in);
+        c->size += got;
+        if (got < room) {
+            *eof = true;
+            break;
+        }
+        size_t last = c->size;
+        while (last > 0 && c->text[last-1] != '\n') last--;
+        if (last > 0) {
+            if (!records_append(carry, c->text + last, c->size - last)) return false;
+            c->size = last;
+            break;
+        }
+        // No line end yet, continue the line in a larger chunk
+        char *grown = (char *)realloc(c->text, 2 * c->capacity);
+        if (grown == NULL) return false;
+        c->text = grown;
+        c->capacity *= 2;
+    }
+    c->text[c->size] = '\0';
+    return true;
+}
+
+
+bool records_process(
+        FILE *in, int nthreads, int nindex,
+        record_handler_t handler, void *ctx,
+        records_sink_t sink, void *sinkctx, struct records_stats *stats) {
+    if (nthreads < 1) nthreads = 1;
+    struct records_job job = {
+        .nchunks = 2 * nthreads,
+        .sink = sink,
+        .sinkctx = sinkctx,
+        .nindex = nindex,
+        .handler = handler,
+        .ctx = ctx,
+    };
+    job.chunks = (struct chunk *)calloc(job.nchunks, sizeof(struct chunk));
+    pthread_t *threads = (pthread_t *)calloc(nthreads + 1, sizeof(pthread_t));
+    if (job.chunks == NULL || threads == NULL) {
+        free(job.chunks);
+        free(threads);
+        return false;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    bool ok = true;
+    int nstarted = 0;
+    if (pthread_create(&threads[nstarted], NULL, records_writer, &job) == 0)
+        nstarted++;
+    else
+        ok = false;
+    while (ok && nstarted <= nthreads) {
+        if (pthread_create(&threads[nstarted], NULL, records_worker, &job) == 0)
+            nstarted++;
+        else
+            ok = false;
+    }
+
+    struct records_output carry = {0};
+    bool eof = !ok;
+    while (!eof) {
+        pthread_mutex_lock(&job.lock);
+        while (job.nread - job.nwritten == job.nchunks && !job.failed)
+            pthread_cond_wait(&job.changed, &job.lock);
+        bool failed = job.failed;
+        pthread_mutex_unlock(&job.lock);
+        if (failed) break;
+
+        struct chunk *c = &job.chunks[job.nread % job.nchunks];
+        if (!read_chunk(in, c, &carry, &eof)) {
+            ok = false;
+            break;
+        }
+        pthread_mutex_lock(&job.lock);
+        job.nread++;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    pthread_mutex_lock(&job.lock);
+    job.eof = true;
+    pthread_cond_broadcast(&job.changed);
+    pthread_mutex_unlock(&job.lock);
+    for (int i = 0; i < nstarted; i++)
+        pthread_join(threads[i], NULL);
+    ok = ok && !job.failed;
+
+    if (stats != NULL) *stats = job.stats;
+    for (size_t i = 0; i < job.nchunks; i++) {
+        free(job.chunks[i].text);
+        free(job.chunks[i].out.data);
+    }
+    free(carry.data);
+    free(job.chunks);
+    free(threads);
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+    return ok;
+}
+
+
+static bool is_gzip(const char *path) {
+    size_t n = strlen(path);
+    return n > 3 && strcmp(path + n - 3, ".gz") == 0;
+}
+
+
+FILE *records_open(const char *path) {
+    if (strcmp(path, "-") == 0) return stdin;
+    if (!is_gzip(path)) {
+        FILE *f = fopen(path, "r");
+        if (f == NULL) perror(path);
+        return f;
+    }
+    if (access(path, R_OK) != 0) {
+        perror(path);
+        return NULL;
+    }
+    // Quote path for the shell, ' as '\''
+    struct records_output cmd = {0};
+    bool ok = records_printf(&cmd, "exec gzip -dc -- '");
+    for (const char *p = path; *p && ok; p++)
+        ok = *p == '\'' ? records_printf(&cmd, "'\\''") : records_append(&cmd, p, 1);
+    ok = ok && records_printf(&cmd, "'");
+    FILE *f = ok ? popen(cmd.data, "r") : NULL;
+    if (f == NULL) perror("gzip");
+    free(cmd.data);
+    return f;
+}
+
+
+bool records_close(FILE *stream, const char *path) {
+    bool ok = !ferror(stream);
+    if (stream == stdin) return ok;
+    if (is_gzip(path)) {
+        int status = pclose(stream);
+        return ok && status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return fclose(stream) == 0 && ok;
+}
@@ -0,0 +1,156 @@
+#ifndef __RECORDS_H
+#define __RECORDS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// Metadata columns of a record, see `struct record`
+#define RECORD_NMETA 6
+// Size of the chunks of input text handed to worker threads
+#define RECORDS_CHUNK_SIZE (4 << 20)
+
+
+/**
+ * One line of the full buffer output of u1_drive1, as collected by
+ * run-chain.sh in output.gz:
+ *
+ *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH SAMPLES...
+ *
+ * optionally prefixed by `nindex` index columns (u1_drive1 --index).
+ * Lines with negative CH hold variances instead of samples.
+ */
+struct record {
+    float samplerate, freq, amp, phase, ch2delay;
+    int ch;
+    const char *meta;      // text of index and metadata columns
+    size_t metalen;        // without the separator after CH
+    uint32_t nsamples;     // number of parsed samples
+};
+
+
+/**
+ * Parse a decimal floating point number as printed by "%f" or "%e",
+ * much faster than `strtof`.  Leading blanks are skipped.  Numbers
+ * with more than 19 significant digits or exponents beyond +-22, as
+ * well as `inf` and `nan`, are handed to `strtod`.  The result is the
+ * same as from `strtof` within one unit in the last place.
+ *
+ * @param end Set to the first character after the number, or `s` if
+ *     there is none.
+ */
+float parse_float(const char *s, const char **end);
+
+
+/**
+ * Parse one line from `line` up to `lineend` (exclusive, without the
+ * newline).  Up to `maxsamples` samples are stored in `samples`.
+ *
+ * @return false if any metadata column is missing or invalid.
+ */
+bool record_parse(
+    const char *line, const char *lineend, int nindex,
+    struct record *r, float *samples, uint32_t maxsamples);
+
+
+/**
+ * Growable output of a record handler.
+ */
+struct records_output {
+    char *data;
+    size_t size, capacity;
+};
+
+/**
+ * Append `n` bytes.
+ *
+ * @return false if the allocation failed.
+ */
+bool records_append(struct records_output *out, const void *data, size_t n);
+
+/**
+ * Append `n` uninitialized bytes, e.g. to encode binary data in place.
+ *
+ * @return Pointer to the new bytes, NULL if the allocation failed.
+ */
+void *records_extend(struct records_output *out, size_t n);
+
+/**
+ * Append formatted text.
+ *
+ * @return false if the allocation failed.
+ */
+bool records_printf(struct records_output *out, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+
+/**
+ * Called on a worker thread for every record, with `samples` valid up
+ * to `r->nsamples`.  Output appended to `out` is written in the order
+ * of the input lines.
+ *
+ * @return false to count the record as skipped.
+ */
+typedef bool (*record_handler_t)(
+    const struct record *r, const float *samples,
+    struct records_output *out, void *ctx);
+
+
+/**
+ * Called on the writer thread with the output of consecutive records
+ * in input order.
+ *
+ * @return false on error, which stops reading.
+ */
+typedef bool (*records_sink_t)(const void *data, size_t n, void *ctx);
+
+/**
+ * Sink writing to the stream `ctx` (a FILE *).
+ */
+bool records_write_stream(const void *data, size_t n, void *ctx);
+
+
+struct records_stats {
+    unsigned long records;    // handled
+    unsigned long skipped;    // invalid or rejected by the handler
+    uint64_t bytes;           // input text
+};
+
+
+/**
+ * Process all lines of `in` on `nthreads` worker threads.
+ *
+ * The calling thread reads the input in chunks of about
+ * RECORDS_CHUNK_SIZE, cut at line ends.  Workers take whole chunks,
+ * parse their lines and call `handler`.  A writer thread hands the
+ * output of the chunks to `sink` in input order.  At most 2 * nthreads
+ * chunks are in flight, so memory use does not grow with the input.
+ *
+ * @return false on allocation or thread failure, or if the sink
+ *     failed.
+ */
+bool records_process(
+    FILE *in, int nthreads, int nindex,
+    record_handler_t handler, void *ctx,
+    records_sink_t sink, void *sinkctx, struct records_stats *stats);
+
+
+/**
+ * Open text records at `path`, or stdin for "-".  Files ending in
+ * `.gz` are decompressed by a `gzip -dc` child process, which runs
+ * in parallel to the parsing.
+ *
+ * @return NULL on error (printed).
+ */
+FILE *records_open(const char *path);
+
+/**
+ * Close stream opened by `records_open` for `path`.
+ *
+ * @return false if reading or decompression failed.
+ */
+bool records_close(FILE *stream, const char *path);
+
+#endif // __RECORDS_H
@@ -6,6 +6,11 @@
 # The same code is uploaded to all devices and upon compiling all
 # execept for the first devices are compiled with -DFOLLOW
 #
+# With READY_BUS=1 in the environment all devices are compiled with
+# -DREADY_BUS, then the leader fires as soon as all followers are
+# armed instead of after a fixed delay.  This needs the ready bus
+# wiring described in chain.h.
+#
 # Note: Since upload and compilation takes considerable time, it is
 # done only when any file in the directory has newer modification time
 # than this script file. This script file is `touch`ed for on every
@@ -73,7 +78,11 @@ LASTMOD=$(find . -type f -not -name run-chain.sh -not -name '#*' -printf '%T@ %p
               | sort -n | tail -1 | cut -f1 -d".")
 LASTRUN=$(date -r $(basename "$0") +%s)
 touch `basename "$0"`
-CHAINFLAG=""
+READYFLAG=""
+if [ -n "$READY_BUS" ]; then
+    READYFLAG="-DREADY_BUS"
+fi
+CHAINFLAG="$READYFLAG"
 if [ $LASTMOD -gt $LASTRUN ];
 then
     for RPIP in $IPs; do
@@ -88,10 +97,10 @@ then
 set -xe
 hostname
 cd measurements/
-make CHAINFLAG=$CHAINFLAG -B "$EXECNAME"
+make CHAINFLAG="$CHAINFLAG" -B "$EXECNAME"
 EOF
         { set +x; } 2> /dev/null # silently disable xtrace
-        CHAINFLAG="-DFOLLOW"
+        CHAINFLAG="-DFOLLOW $READYFLAG"
     done
 fi
 
@@ -5,13 +5,58 @@
  * Decimation factor for sampling rate is chosen such that the
  * waveform is sampled by at least 20 samples per period.
  *
- * Usage: ./run.sh IP scan_1channel.x F_START,STEPS,F_END [full]
+ * Usage: ./run.sh IP scan_1channel.x [OPTIONS] F_START,STEPS,F_END [full|dataset]
  *
  * Where start and end frequencies F_START and F_END are floats in
  * units of Hertz, and STEPS is an integer (steps between start and
  * end frequency on log scale).  Instead of range also a single number
- * can be supplied.  Use optional flag `full` to output
- * complete ADC buffers instead of demodulated data.
+ * or a list `list:F1,F2,...` can be supplied.  Use optional flag `full` to output
+ * complete ADC buffers instead of demodulated data.  Flag `dataset`
+ * writes the complete buffers as indexed binary dataset with int16
+ * samples (see dataset.h) with axis `f`, not with --refine,
+ * --multisine or --chirp.
+ *
+ * Options:
+ *
+ *     --settle TOL       Instead of waiting a fixed 10 ms after every
+ *                        frequency step, take short captures of a few
+ *                        periods until the transfer function CH2/CH1
+ *                        changes by less than the relative tolerance
+ *                        TOL (e.g. 1e-3) or the noise from one capture
+ *                        to the next.
+ *     --settle-max T     Give up waiting for settling after T seconds,
+ *                        default 1.
+ *     --refine N         Adaptive scan: after the given grid, add points
+ *                        between the neighbours where the transfer
+ *                        function CH2/CH1 changes most (in log amplitude
+ *                        and phase) until N points in total are taken.
+ *                        Points are printed in order of acquisition,
+ *                        sort by f (e.g. `sort -g`) for a spectrum.
+ *     --multisine K      Excite up to K frequencies at once with a
+ *                        multisine (arbitrary waveform, K <= 256) and
+ *                        demodulate all of them from one acquisition.
+ *                        Frequencies are rounded to whole periods per
+ *                        buffer and grouped by decimation factor, i.e.
+ *                        one acquisition per group of K tones.  Each
+ *                        tone gets only a fraction of the output
+ *                        amplitude (printed as crest factor), so the
+ *                        signal to noise ratio per tone is lower than
+ *                        with single sines.  Not with --refine.
+ *     --chirp lin|log    Excite with a linear or logarithmic chirp from
+ *                        F_START to F_END repeating once per buffer and
+ *                        compute the transfer function from the FFTs of
+ *                        both channels, H = <X2 X1*> / <|X1|^2>.
+ *                        Frequencies are rounded to FFT bins, i.e.
+ *                        multiples of samplerate/16384, with the
+ *                        samplerate chosen for F_END.  Not with
+ *                        --multisine or --refine.
+ *     --average N        Average the spectra of N chirp acquisitions,
+ *                        default 1.
+ *     --window rect|hann Window for the FFTs, default rect.  The chirp
+ *                        is periodic in the buffer, so it does not leak
+ *                        into other bins without window; a Hann window
+ *                        suppresses leakage of non-periodic disturbances
+ *                        but averages H over three neighbouring bins.
  *
  * Prints demodulated data to stdout in 13 columns
  * (whitespaces / column separators are tabs):
@@ -23,6 +68,10 @@
  * The global phase is not well defined and ph2 is (phase2-phase1)
  * ph22 is (phase22-phase1*2). dc1, dc2, and dc22 are the DC offsets
  * and err the reconstruction errors (sqrt of mean of squares of deviation) respectively.
+ * With --multisine the columns for double frequency are NAN and the
+ * reconstruction errors include all other tones.  With --chirp the
+ * columns for double frequency and the reconstruction errors are NAN,
+ * and A2 and A12 are |H| A1 and |H-1| A1 of the averaged spectra.
  * Output data comes with header.
  *
  * With flag `full` outputs
@@ -35,31 +84,590 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <math.h>
+#include <complex.h>
 
 #include "rp.h"
 
+#include "dataset.h"
 #include "demodulation.h"
+#include "fft.h"
+#include "pipeline.h"
+#include "sweep.h"
 #include "utility.h"
 
 
 #define HIGH_PASS_FILTER_SETTLING_TIME 10e3
+// Length of captures for settling detection [periods]
+#define SETTLE_PERIODS 8
+#define SETTLE_MIN_SAMPLES 64
+// Changes within this many standard deviations count as noise
+#define SETTLE_NOISE_SIGMAS 4
+// Smallest relative frequency step of adaptive refinement
+#define REFINE_MIN_STEP 1e-5
+#define MULTISINE_MAX_TONES 256
+
+
+// Tones of one multisine acquisition, periods per buffer.
+struct multisine_band {
+    rp_acq_decimation_t dec;
+    float samplerate;
+    int ntones;
+    int periods[MULTISINE_MAX_TONES];
+};
+
+// Chirp excitation and averaged spectra at the output bins.
+struct chirp {
+    rp_acq_decimation_t dec;
+    float samplerate;
+    bool logarithmic, hann;
+    int naverage;
+    int nbins, *bins;
+    struct fft *fft;
+    float *window, windowsum;        // NULL for rectangular window
+    float _Complex *X1, *X2;         // spectra of one acquisition
+    float *S11;                      // sums of |X1|^2 at bins
+    float _Complex *S21;             // sums of X2 X1* at bins
+    float dc1, dc2;
+};
+
+// Output settings, shared with the writer thread.
+struct output_options {
+    bool fulldata;
+    int nsteps;
+    const struct multisine_band *bands;
+    struct chirp *chirp;
+    struct dataset_writer *dataset;
+};
+
+// Adaptive settling, disabled if tolerance <= 0.
+struct settle_options {
+    float tolerance;
+    double maxtime;
+};
+
+// Acquisition state shared by all frequency steps.
+struct scan {
+    struct pipeline *pipeline;
+    struct settle_options settling;
+    float *settlebuf1, *settlebuf2;  // scratch buffers for settling
+    int unsettled;
+    float *waveform;                 // multisine samples
+};
+
+// Point of an adaptive scan with transfer function CH2/CH1.
+struct refine_point {
+    float f;
+    float _Complex h;
+};
+
+// Metadata of pipeline items, META_BAND is -1 for a single sine.
+// META_AVERAGE is the index of a chirp acquisition, -1 otherwise.
+enum { META_F, META_SAMPLERATE, META_BAND, META_CREST, META_AVERAGE };
+
+
+/**
+ * Demodulate at f and print one row of columns.  A `multisine` buffer
+ * holds whole periods of f, so all samples are demodulated, and the
+ * columns for CH2 at 2f are NAN.  The amplitudes A1, A2, A12 and A22
+ * are returned in `amplitudes`.
+ */
+static void print_row(
+        float f, float samplerate, const float *buf1, const float *buf2,
+        uint32_t n, bool multisine, float amplitudes[4]) {
+    // CH1, CH2 and CH2-CH1 at f in one pass, CH2 at 2f
+    struct phasor p1, p2, p12, p22 = {NAN, NAN, NAN};
+    if (multisine) {
+        demodulate_pair_periodic(buf1, buf2, n, f, samplerate, &p1, &p2, &p12);
+    } else {
+        demodulate_pair(buf1, buf2, n, f, samplerate, &p1, &p2, &p12);
+        p22 = demodulate_phasor(buf2, n, 2*f, samplerate);
+    }
+    float A1 = phasor_amplitude(p1), A2 = phasor_amplitude(p2);
+    float A12 = phasor_amplitude(p12), A22 = phasor_amplitude(p22);
+    // phase differences to CH1 in range [-pi, pi], at double
+    // frequency relative to twice the phase of CH1
+    float ph2 = phasor_phase_diff(p2, p1, 1);
+    float ph12 = phasor_phase_diff(p12, p1, 1);
+    float ph22 = phasor_phase_diff(p22, p1, 2);
+    printf("%e\t%f\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\n",
+           f, samplerate, A1, A2, A12, A22,
+           ph2, ph12, ph22,
+           p1.offset, p2.offset, p12.offset, p22.offset,
+           p1.residual, p2.residual, p12.residual, p22.residual);
+    amplitudes[0] = A1;
+    amplitudes[1] = A2;
+    amplitudes[2] = A12;
+    amplitudes[3] = A22;
+}
+
+
+/**
+ * Add spectra of one chirp acquisition, print the transfer function
+ * at all bins after the last one.
+ */
+static void write_chirp(struct chirp *c, const struct pipeline_item *item) {
+    const int average = item->meta[META_AVERAGE];
+    if (average == 0) {
+        memset(c->S11, 0, c->nbins * sizeof(float));
+        memset(c->S21, 0, c->nbins * sizeof(float _Complex));
+        c->dc1 = c->dc2 = 0;
+    }
+    fft_real_pair(c->fft, item->buf1, item->buf2, c->window, c->X1, c->X2);
+    for (int i = 0; i < c->nbins; i++) {
+        float _Complex x1 = c->X1[c->bins[i]], x2 = c->X2[c->bins[i]];
+        c->S11[i] += crealf(x1 * conjf(x1));
+        c->S21[i] += x2 * conjf(x1);
+    }
+    c->dc1 += crealf(c->X1[0]) / c->windowsum;
+    c->dc2 += crealf(c->X2[0]) / c->windowsum;
+    timing_mark(TIMING_ANALYSIS);
+    if (average < c->naverage - 1) return;
+
+    const float dc1 = c->dc1 / c->naverage, dc2 = c->dc2 / c->naverage;
+    for (int i = 0; i < c->nbins; i++) {
+        float f = c->bins[i] * c->samplerate / RP_BUFFER_SIZE;
+        float _Complex h = c->S21[i] / c->S11[i];
+        float A1 = 2 * sqrtf(c->S11[i] / c->naverage) / c->windowsum;
+        printf("%e\t%f\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\n",
+               f, c->samplerate, A1, cabsf(h) * A1, cabsf(h - 1) * A1, NAN,
+               cargf(h), cargf(h - 1), NAN,
+               dc1, dc2, dc2 - dc1, NAN,
+               NAN, NAN, NAN, NAN);
+    }
+}
+
+
+/**
+ * Demodulate and print data of one frequency step (or all tones of a
+ * multisine, or the spectra of a chirp) to stdout.  Runs on the writer thread of the pipeline
+ * while the next step is acquired.
+ */
+void write_point(const struct pipeline_item *item, void *ctx) {
+    const struct output_options *opts = (const struct output_options *)ctx;
+    const float f = item->meta[META_F], samplerate = item->meta[META_SAMPLERATE];
+    const float *buf1 = item->buf1, *buf2 = item->buf2;
+    const uint32_t s1 = item->size1, s2 = item->size2;
+    const uint32_t n = (s1 < s2)? s1 : s2;
+    const int band = item->meta[META_BAND];
+    timing_point(item->index);
+
+    const float progress = opts->nsteps > 1 ? 100.0*item->index/(opts->nsteps-1) : 100.0;
+    fprintf(stderr, "%3.0f%%  %6.1fkHz  ", progress, f/1e3);
+
+    if (! opts->fulldata && opts->chirp) {
+        write_chirp(opts->chirp, item);
+        fprintf(stderr, "chirp %d/%d\n", (int)item->meta[META_AVERAGE] + 1, opts->chirp->naverage);
+    } else if (! opts->fulldata && band >= 0) {
+        const struct multisine_band *b = &opts->bands[band];
+        float A[4];
+        for (int i = 0; i < b->ntones; i++)
+            print_row(b->periods[i] * samplerate / n, samplerate, buf1, buf2, n, true, A);
+        timing_mark(TIMING_ANALYSIS);
+        fprintf(stderr, "%3d tones  crest factor %.2f\n", b->ntones, item->meta[META_CREST]);
+    } else if (! opts->fulldata) {
+        float A[4];
+        print_row(f, samplerate, buf1, buf2, n, false, A);
+        timing_mark(TIMING_ANALYSIS);
+        fprintf(stderr, "%5.1f mV  %5.1f mV  %5.1f mV  %5.1f mV\n",
+                1e3*A[0], 1e3*A[1], 1e3*A[2], 1e3*A[3]);
+    } else if (opts->dataset) {
+        struct dataset_record meta = {.ch = 1, .samplerate = samplerate, .freq = f};
+        bool ok = dataset_write(opts->dataset, item->index, &meta, buf1, s1);
+        meta.ch = 2;
+        ok = dataset_write(opts->dataset, item->index, &meta, buf2, s2) && ok;
+        fprintf(stderr, ok ? "\n" : "writing dataset failed\n");
+    } else {
+        printf("%f\t%f\t1", f, samplerate);
+        for (uint32_t k = 0; k < s1; k++)
+            printf("\t%f", buf1[k]);
+        printf("\n%f\t%f\t2", f, samplerate);
+        for (uint32_t k = 0; k < s2; k++)
+            printf("\t%f", buf2[k]);
+        printf("\n");
+
+        fprintf(stderr, "\n");
+    }
+    timing_mark(TIMING_OUTPUT);
+    timing_done();
+}
+
+
+/** Length of settling captures at f, SETTLE_PERIODS periods. */
+static uint32_t settle_length(float f, float samplerate) {
+    uint32_t n = ceilf(SETTLE_PERIODS * samplerate / f);
+    if (n < SETTLE_MIN_SAMPLES) n = SETTLE_MIN_SAMPLES;
+    if (n > RP_BUFFER_SIZE) n = RP_BUFFER_SIZE;
+    return n;
+}
+
+
+/**
+ * Take captures of `n` samples with output running until the transfer
+ * function CH2/CH1 at `f` is stable, i.e. changes by less than the
+ * tolerance or the noise.  Captures are usually SETTLE_PERIODS periods
+ * long (see settle_length), so lower frequencies wait longer.
+ *
+ * @return false if not settled within the maximum time.
+ */
+static bool settle(
+        float f, uint32_t n, rp_acq_decimation_t dec, float samplerate,
+        const struct settle_options *opts, float *buf1, float *buf2) {
+    double start = monotonic_seconds();
+    float _Complex previous = NAN;
+    do {
+        acquire_2channels_now(dec, n, buf1, buf2);
+        struct phasor p1, p2, p21;
+        demodulate_pair(buf1, buf2, n, f, samplerate, &p1, &p2, &p21);
+        float _Complex h = phasor_ratio(p2, p1);
+        // Uncertainty of h from the residuals of both fits
+        float sigma = sqrtf(2.0f / n) * (p2.residual + cabsf(h) * p1.residual)
+            / phasor_amplitude(p1);
+        if (cabsf(h - previous) <= fmaxf(opts->tolerance * cabsf(h), SETTLE_NOISE_SIGMAS * sigma))
+            return true;
+        previous = h;
+    } while (monotonic_seconds() - start < opts->maxtime);
+    return false;
+}
+
+
+/**
+ * Enable the output, wait for settling (checked at `f` with captures
+ * of `n` samples) and acquire both channels into the next pipeline
+ * item.  The item is not submitted yet.
+ */
+static struct pipeline_item *acquire_step(
+        struct scan *scan, long index, float f, uint32_t n,
+        rp_acq_decimation_t dec, float samplerate) {
+    rp_GenOutEnable(RP_CH_1);
+    timing_mark(TIMING_CONFIGURE);
+    if (scan->settling.tolerance > 0) {
+        if (!settle(f, n, dec, samplerate, &scan->settling, scan->settlebuf1, scan->settlebuf2))
+            scan->unsettled++;
+    } else {
+        // wait for high-pass filter to settle
+        usleep(HIGH_PASS_FILTER_SETTLING_TIME);
+    }
+    timing_mark(TIMING_SETTLE);
+
+    struct pipeline_item *item = pipeline_next(scan->pipeline);
+    timing_mark(TIMING_READOUT);
+    item->index = index;
+    item->meta[META_F] = f;
+    item->meta[META_SAMPLERATE] = samplerate;
+    item->meta[META_BAND] = -1;
+    item->meta[META_AVERAGE] = -1;
+    item->size1 = item->size2 = RP_BUFFER_SIZE;
+    acquire_2channels(dec, item->buf1, &item->size1, item->buf2, &item->size2);
+    rp_GenOutDisable(RP_CH_1);
+    return item;
+}
+
+
+/**
+ * Acquire one frequency step and pass it to the writer thread.
+ *
+ * @param h If not NULL, set to the transfer function CH2/CH1 at f,
+ *     demodulated here for adaptive refinement.
+ */
+static void measure(struct scan *scan, long index, float f, float _Complex *h) {
+    float samplerate;
+    rp_acq_decimation_t dec = best_decimation_factor(f, &samplerate);
+    timing_point(index);
+
+    rp_GenFreq(RP_CH_1, f);
+    struct pipeline_item *item = acquire_step(
+        scan, index, f, settle_length(f, samplerate), dec, samplerate);
+
+    if (h) {
+        struct phasor p1, p2, p12;
+        uint32_t n = (item->size1 < item->size2) ? item->size1 : item->size2;
+        demodulate_pair(item->buf1, item->buf2, n, f, samplerate, &p1, &p2, &p12);
+        *h = phasor_ratio(p2, p1);
+    }
+    pipeline_submit(scan->pipeline, item);
+}
+
+
+/**
+ * Acquire all tones of a multisine band at once and pass them to the
+ * writer thread.  The waveform repeats once per buffer, so every tone
+ * has a whole number of periods in the acquisition.
+ */
+static void measure_multisine(
+        struct scan *scan, long index, int b, const struct multisine_band *band) {
+    timing_point(index);
+    float amplitude = multisine_arb_waveform(
+        band->periods, band->ntones, scan->waveform, BUFFER_LENGTH);
+    rp_GenWaveform(RP_CH_1, RP_WAVEFORM_ARBITRARY);
+    rp_GenArbWaveform(RP_CH_1, scan->waveform, BUFFER_LENGTH);
+    rp_GenFreq(RP_CH_1, band->samplerate / RP_BUFFER_SIZE);
+
+    // Settling is checked at the lowest tone over one whole waveform
+    // period, where the other tones are orthogonal.
+    float f = band->periods[0] * band->samplerate / RP_BUFFER_SIZE;
+    struct pipeline_item *item = acquire_step(
+        scan, index, f, RP_BUFFER_SIZE, band->dec, band->samplerate);
+    item->meta[META_BAND] = b;
+    item->meta[META_CREST] = 1 / (amplitude * sqrtf(band->ntones / 2.0f));
+    pipeline_submit(scan->pipeline, item);
+}
+
+
+static int compare_floats(const void *a, const void *b) {
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+/**
+ * Group the frequencies of the sweep into multisines of at most
+ * `maxtones` tones with the same decimation factor.  Frequencies are
+ * rounded to whole periods per buffer, duplicates are dropped.
+ *
+ * @return Number of bands allocated to `*bands`, 0 on failure.
+ */
+static int multisine_bands(struct sweep *sweep, int maxtones, struct multisine_band **bands) {
+    float *fs = (float *)malloc(sweep->npoints * sizeof(float));
+    *bands = (struct multisine_band *)malloc(sweep->npoints * sizeof(struct multisine_band));
+    if (fs == NULL || *bands == NULL) {
+        free(fs);
+        return 0;
+    }
+    long n = 0;
+    while (sweep_next(sweep))
+        fs[n++] = sweep_value(sweep, 0);
+    qsort(fs, n, sizeof(float), compare_floats);
+
+    int nbands = 0;
+    struct multisine_band *band = NULL;
+    for (long i = 0; i < n; i++) {
+        float samplerate;
+        rp_acq_decimation_t dec = best_decimation_factor(fs[i], &samplerate);
+        int periods = lroundf(fs[i] * RP_BUFFER_SIZE / samplerate);
+        if (periods < 1) periods = 1;
+        if (band && band->dec == dec && band->periods[band->ntones-1] == periods)
+            continue;
+        if (band == NULL || band->dec != dec || band->ntones >= maxtones) {
+            band = &(*bands)[nbands++];
+            band->dec = dec;
+            band->samplerate = samplerate;
+            band->ntones = 0;
+        }
+        band->periods[band->ntones++] = periods;
+    }
+    free(fs);
+    return nbands;
+}
+
+
+/**
+ * Acquire chirp responses for averaging, the spectra are computed on
+ * the writer thread.
+ */
+static void measure_chirp(struct scan *scan, long *index, const struct chirp *c) {
+    float k0 = c->bins[0], k1 = c->bins[c->nbins-1];
+    chirp_arb_waveform(k0, k1, c->logarithmic, scan->waveform, BUFFER_LENGTH);
+    rp_GenWaveform(RP_CH_1, RP_WAVEFORM_ARBITRARY);
+    rp_GenArbWaveform(RP_CH_1, scan->waveform, BUFFER_LENGTH);
+    rp_GenFreq(RP_CH_1, c->samplerate / RP_BUFFER_SIZE);
+
+    // Settling is checked at the lowest frequency over one whole
+    // waveform period, like for multisines.
+    float f = k0 * c->samplerate / RP_BUFFER_SIZE;
+    for (int a = 0; a < c->naverage; a++) {
+        timing_point(*index);
+        struct pipeline_item *item = acquire_step(
+            scan, *index, f, RP_BUFFER_SIZE, c->dec, c->samplerate);
+        item->meta[META_AVERAGE] = a;
+        pipeline_submit(scan->pipeline, item);
+        (*index)++;
+    }
+}
+
+
+/**
+ * Output bins of the sweep frequencies for a chirp from the lowest to
+ * the highest frequency, and buffers for the spectra.
+ *
+ * @return false on failure.
+ */
+static bool chirp_setup(struct sweep *sweep, struct chirp *c) {
+    float *fs = (float *)malloc(sweep->npoints * sizeof(float));
+    c->bins = (int *)malloc(sweep->npoints * sizeof(int));
+    c->fft = fft_create(RP_BUFFER_SIZE);
+    c->window = c->hann ? (float *)malloc(RP_BUFFER_SIZE * sizeof(float)) : NULL;
+    c->X1 = (float _Complex *)malloc((RP_BUFFER_SIZE/2 + 1) * sizeof(float _Complex));
+    c->X2 = (float _Complex *)malloc((RP_BUFFER_SIZE/2 + 1) * sizeof(float _Complex));
+    c->S11 = (float *)malloc(sweep->npoints * sizeof(float));
+    c->S21 = (float _Complex *)malloc(sweep->npoints * sizeof(float _Complex));
+    if (!fs || !c->bins || !c->fft || (c->hann && !c->window) || !c->X1 || !c->X2 || !c->S11 || !c->S21) {
+        free(fs);
+        return false;
+    }
+    long n = 0;
+    while (sweep_next(sweep))
+        fs[n++] = sweep_value(sweep, 0);
+    qsort(fs, n, sizeof(float), compare_floats);
+
+    c->dec = best_decimation_factor(fs[n-1], &c->samplerate);
+    c->nbins = 0;
+    for (long i = 0; i < n; i++) {
+        int k = lroundf(fs[i] * RP_BUFFER_SIZE / c->samplerate);
+        if (k < 1) k = 1;
+        if (c->nbins == 0 || c->bins[c->nbins-1] != k)
+            c->bins[c->nbins++] = k;
+    }
+    c->windowsum = c->hann ? hann_window(c->window, RP_BUFFER_SIZE) : RP_BUFFER_SIZE;
+    free(fs);
+    return true;
+}
+
+static void chirp_free(struct chirp *c) {
+    free(c->bins);
+    fft_free(c->fft);
+    free(c->window);
+    free(c->X1);
+    free(c->X2);
+    free(c->S11);
+    free(c->S21);
+}
+
+
+/**
+ * Change of the transfer function between neighbouring points as
+ * distance of log(h), i.e. log amplitude ratio and phase difference.
+ * Negative if the interval cannot be split.
+ */
+static float refine_score(const struct refine_point *a, const struct refine_point *b) {
+    if (b->f < a->f * (1 + REFINE_MIN_STEP)) return -1;
+    float _Complex r = b->h / a->h;
+    float d = hypotf(logf(cabsf(r)), cargf(r));
+    return isfinite(d) ? d : -1;
+}
+
+static int compare_refine_points(const void *a, const void *b) {
+    float fa = ((const struct refine_point *)a)->f;
+    float fb = ((const struct refine_point *)b)->f;
+    return (fa > fb) - (fa < fb);
+}
 
 
 int main(int argc, char **argv) {
+    // Parse options
+    struct scan scan = {NULL, {0, 1}, NULL, NULL, 0, NULL};
+    long budget = 0;
+    int maxtones = 0;
+    struct chirp chirp = {.naverage = 1};
+    bool chirped = false;
+    static const struct option options[] = {
+        {"settle", required_argument, NULL, 's'},
+        {"settle-max", required_argument, NULL, 'm'},
+        {"refine", required_argument, NULL, 'r'},
+        {"multisine", required_argument, NULL, 'k'},
+        {"chirp", required_argument, NULL, 'c'},
+        {"average", required_argument, NULL, 'a'},
+        {"window", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            scan.settling.tolerance = strtof(optarg, NULL);
+            break;
+        case 'm':
+            scan.settling.maxtime = strtod(optarg, NULL);
+            break;
+        case 'r':
+            budget = strtol(optarg, NULL, 10);
+            break;
+        case 'k':
+            maxtones = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            chirped = true;
+            if (strcmp(optarg, "log") == 0) chirp.logarithmic = true;
+            else if (strcmp(optarg, "lin") != 0) {
+                fprintf(stderr, "Invalid --chirp.\n");
+                exit(1);
+            }
+            break;
+        case 'a':
+            chirp.naverage = strtol(optarg, NULL, 10);
+            break;
+        case 'w':
+            if (strcmp(optarg, "hann") == 0) chirp.hann = true;
+            else if (strcmp(optarg, "rect") != 0) {
+                fprintf(stderr, "Invalid --window.\n");
+                exit(1);
+            }
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     // Parse arguments
     if (argc < 2 || argc > 3) {
         exit(1);
     }
-    float fstart, fend;
-    int nsteps;
-    if (!parse_cmd_line_range(argv[1], &fstart, &fend, &nsteps)) {
+    if (maxtones < 0 || maxtones > MULTISINE_MAX_TONES || (maxtones > 0 && budget > 0)) {
+        fprintf(stderr, "Invalid --multisine.\n");
+        exit(1);
+    }
+    if (chirp.naverage < 1 || (chirped && (maxtones > 0 || budget > 0))) {
+        fprintf(stderr, "Invalid --chirp or --average.\n");
+        exit(1);
+    }
+    struct output_options opts;
+    struct sweep sweep;
+    sweep_init(&sweep);
+    if (!sweep_axis(&sweep, "f", argv[1], SWEEP_LOG, 0)) {
         fprintf(stderr, "Invalid argument.\n");
         exit(1);
     }
-    bool fulldata = argc == 3;
+    opts.nsteps = (budget > sweep.npoints) ? budget : sweep.npoints;
+    opts.fulldata = argc == 3;
+    opts.dataset = NULL;
+    if (opts.fulldata && strcmp(argv[2], "dataset") == 0) {
+        if (budget > 0 || maxtones > 0 || chirped) {
+            fprintf(stderr, "Invalid dataset.\n");
+            exit(1);
+        }
+        opts.dataset = dataset_create(stdout, "scan_1channel", 0);
+        if (opts.dataset == NULL || !dataset_add_sweep(opts.dataset, &sweep)) {
+            fprintf(stderr, "Dataset setup failed!\n");
+            exit(2);
+        }
+    }
+    struct multisine_band *bands = NULL;
+    int nbands = 0;
+    if (maxtones > 0) {
+        nbands = multisine_bands(&sweep, maxtones, &bands);
+        if (nbands == 0) {
+            fprintf(stderr, "Multisine setup failed!\n");
+            exit(2);
+        }
+        opts.nsteps = nbands;
+    }
+    opts.bands = bands;
+    opts.chirp = NULL;
+    if (chirped) {
+        if (!chirp_setup(&sweep, &chirp)) {
+            fprintf(stderr, "Chirp setup failed!\n");
+            exit(2);
+        }
+        opts.chirp = &chirp;
+        opts.nsteps = chirp.naverage;
+    }
+
+    timing_init();
 
     // Initialize IO.
     if (rp_Init() != RP_OK) {
@@ -68,7 +676,7 @@ int main(int argc, char **argv) {
     }
     // Initialize outputs
     rp_GenReset();
-    rp_GenFreq(RP_CH_1, fstart);
+    rp_GenFreq(RP_CH_1, sweep_value(&sweep, 0));
     rp_GenAmp(RP_CH_1, 1);
     rp_GenOffset(RP_CH_1, 0);
     rp_GenWaveform(RP_CH_1, RP_WAVEFORM_SINE);
@@ -76,79 +684,77 @@ int main(int argc, char **argv) {
     // Trigger setup only needed in burst mode.
     // Actually, setting triggers overwrites the mode.
 
-    // Allocate data buffers
-    float *buf1 = (float*)malloc(RP_BUFFER_SIZE * sizeof(float));
-    float *buf2 = (float*)malloc(RP_BUFFER_SIZE * sizeof(float));
-    float *buf12 = (float*)malloc(RP_BUFFER_SIZE * sizeof(float));
+    // Double buffered data buffers: the next frequency step is
+    // acquired while the writer thread analyses the previous one.
+    scan.pipeline = pipeline_create(2, RP_BUFFER_SIZE, write_point, &opts);
+    if (scan.pipeline == NULL) {
+        fprintf(stderr, "Pipeline setup failed!\n");
+        exit(2);
+    }
 
-    if (! fulldata)
+    if (scan.settling.tolerance > 0) {
+        scan.settlebuf1 = (float *)malloc(RP_BUFFER_SIZE * sizeof(float));
+        scan.settlebuf2 = (float *)malloc(RP_BUFFER_SIZE * sizeof(float));
+    }
+    if (nbands > 0 || chirped)
+        scan.waveform = (float *)malloc(BUFFER_LENGTH * sizeof(float));
+    // Points sorted by frequency for adaptive refinement
+    struct refine_point *points = NULL;
+    if (opts.nsteps > sweep.npoints)
+        points = (struct refine_point *)malloc(opts.nsteps * sizeof(struct refine_point));
+
+    if (! opts.fulldata)
         printf("f\tsamplerate\tA1\tA2\tA12\tA22\tph2\tph12\tph22\tdc1\tdc2\tdc12\tdc22\terr1\terr2\terr12\terr22\n");
 
     // Scan
-    float samplerate;
-    for (int i = 0; i < nsteps; i++) {
-        float f = log_scale_steps(i, nsteps, fstart, fend);
-        rp_acq_decimation_t dec = best_decimation_factor(f, &samplerate);
-
-        fprintf(stderr, "%3.0f%%  %6.1fkHz  ", 100.0*i/(nsteps-1), f/1e3);
-
-        rp_GenFreq(RP_CH_1, f);
-        rp_GenOutEnable(RP_CH_1);
-        // wait for high-pass filter to settle
-        usleep(HIGH_PASS_FILTER_SETTLING_TIME);
-
-        uint32_t s1 = RP_BUFFER_SIZE, s2 = RP_BUFFER_SIZE;
-        acquire_2channels(dec, buf1, &s1, buf2, &s2);
-        rp_GenOutDisable(RP_CH_1);
-
-        for (uint32_t j = 0; j < RP_BUFFER_SIZE; j++) {
-            buf12[j] = buf2[j] - buf1[j];
-        }
+    long npoints = 0;
+    for (int b = 0; b < nbands; b++)
+        measure_multisine(&scan, npoints++, b, &bands[b]);
+    if (chirped)
+        measure_chirp(&scan, &npoints, &chirp);
+    while (nbands == 0 && !chirped && sweep_next(&sweep)) {
+        float f = sweep_value(&sweep, 0);
+        if (points) points[npoints].f = f;
+        measure(&scan, npoints, f, points ? &points[npoints].h : NULL);
+        npoints++;
+    }
 
-        if (! fulldata) {
-            float A1, A2, A12, A22;
-            float phase1, phase2, phase12, phase22, ph2, ph12, ph22;
-            float offset1, offset2, offset12, offset22;
-            float sd1, sd2, sd12, sd22;
-            demodulate(buf1, s1, f, samplerate, &A1, &phase1, &offset1);
-            demodulate(buf2, s2, f, samplerate, &A2, &phase2, &offset2);
-            demodulate(buf2, s2, 2*f, samplerate, &A22, &phase22, &offset22);
-            demodulate(buf12, (s1 < s2)? s1 : s2, f, samplerate, &A12, &phase12, &offset12);
-            sd1  = deviation_from_reconstruction(buf1, s1, samplerate, f, A1, phase1, offset1);
-            sd2  = deviation_from_reconstruction(buf2, s2, samplerate, f, A2, phase2, offset2);
-            sd22 = deviation_from_reconstruction(buf2, s2, samplerate, 2*f, A22, phase22, offset22);
-            sd12  = deviation_from_reconstruction(buf12, (s1 < s2)? s1 : s2, samplerate, f, A12, phase12, offset12);
-            // phase difference of CH2 - CH1 in range [-pi, pi]
-            ph2 = fmod(phase2 - phase1 + M_PI, 2*M_PI) - M_PI;
-            ph12 = fmod(phase12 - phase1 + M_PI, 2*M_PI) - M_PI;
-            // phase difference of CH1 and CH2 @ double frequency in range [-pi to pi]
-            ph22 = fmod(phase22 - fmod(phase1*2, 2*M_PI) + M_PI, 2*M_PI) - M_PI;
-            printf("%e\t%f\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\n",
-                   f, samplerate, A1, A2, A12, A22,
-                   ph2, ph12, ph22,
-                   offset1, offset2, offset12, offset22,
-                   sd1, sd2, sd12, sd22);
-
-            fprintf(stderr, "%5.1f mV  %5.1f mV  %5.1f mV  %5.1f mV\n",
-                    1e3*A1, 1e3*A2, 1e3*A12, 1e3*A22);
-        } else {
-            printf("%f\t%f\t1", f, samplerate);
-            for (uint32_t k = 0; k < s1; k++)
-                printf("\t%f", buf1[k]);
-            printf("\n%f\t%f\t2", f, samplerate);
-            for (uint32_t k = 0; k < s2; k++)
-                printf("\t%f", buf2[k]);
-            printf("\n");
-
-            fprintf(stderr, "\n");
+    // Refine where the transfer function changes most
+    if (points) qsort(points, npoints, sizeof(struct refine_point), compare_refine_points);
+    while (points && npoints < opts.nsteps) {
+        long best = -1;
+        float bestscore = 0;
+        for (long i = 0; i+1 < npoints; i++) {
+            float score = refine_score(&points[i], &points[i+1]);
+            if (score > bestscore) {
+                best = i;
+                bestscore = score;
+            }
         }
+        if (best < 0) break;
+        float f = sqrtf(points[best].f * points[best+1].f);
+        float _Complex h;
+        measure(&scan, npoints, f, &h);
+        memmove(&points[best+2], &points[best+1], (npoints-best-1) * sizeof(struct refine_point));
+        points[best+1] = (struct refine_point){f, h};
+        npoints++;
     }
 
-
-    free(buf1);
-    free(buf2);
-    free(buf12);
+    pipeline_finish(scan.pipeline);
+    if (opts.dataset && !dataset_finish(opts.dataset))
+        fprintf(stderr, "Writing dataset failed.\n");
+    timing_summary();
+    if (scan.unsettled > 0)
+        fprintf(stderr, "%d points not settled within %.3fs.\n",
+                scan.unsettled, scan.settling.maxtime);
+    free(points);
+    free(bands);
+    if (chirped) chirp_free(&chirp);
+    free(scan.waveform);
+    free(scan.settlebuf1);
+    free(scan.settlebuf2);
     rp_GenReset();
+    sweep_free(&sweep);
     rp_Release();
     return 0;
 }
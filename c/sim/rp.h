@@ -0,0 +1,189 @@
+/**
+ * Simulated Red Pitaya API (librp) for building and running the
+ * measurement programs on a plain Linux host.
+ *
+ * Declares the subset of `rp.h` used in this repository with the
+ * same names and signatures as librp for the FPGA image 0.94.  Build
+ * with `make SIM=1` to use this header and `rp_sim.c` instead of the
+ * real library.
+ *
+ * The simulation is configured with environment variables:
+ *
+ *     RPSIM_NOISE=V             Gaussian noise on both inputs [V rms],
+ *                               default 1e-3.
+ *     RPSIM_SIGNAL=F,A          External sine of frequency F [Hz] and
+ *                               amplitude A [V] on both inputs.
+ *     RPSIM_DUT=TYPE,...        Device under test between OUT1 and IN2:
+ *                               none (default), lowpass,FC,
+ *                               highpass,FC, resonance,F0,Q or
+ *                               notch,F0,Q.  IN1 sees OUT1 directly.
+ *     RPSIM_NONLINEAR=A2,A3,..  Polynomial distortion y + A2 y^2 +
+ *                               A3 y^3 + ... of the DUT output, which
+ *                               creates harmonics of the drive.
+ *     RPSIM_OUT2_COUPLING=G     Fraction of OUT2 added to IN2, default 0.
+ *     RPSIM_EXT_TRIGGER=MODE    External trigger input DIO0_P:
+ *                               `loopback` (default) is wired to
+ *                               DIO0_N, `auto,US` fires US microseconds
+ *                               after the program starts polling the
+ *                               trigger state like a chain leader would.
+ *     RPSIM_READ_US=US          Duration of reading one channel buffer,
+ *                               default 1500.
+ *     RPSIM_ARB_US=US           Duration of an arbitrary waveform
+ *                               upload, default 2000.
+ *     RPSIM_REG_US=US           Duration of other register accesses,
+ *                               default 2.
+ *     RPSIM_SEED=N              Seed of the noise generator.
+ *     RPSIM_BUS=FILE            Simulate a chain of devices, one process
+ *     RPSIM_DEVICE=K            each, which share the DIO lines through
+ *     RPSIM_DEVICES=N           the file FILE.  Device K=0 is the leader,
+ *                               its DIO0_N drives DIO0_P (external
+ *                               trigger) of all N devices.  Other lines
+ *                               of the same name are wired-AND with
+ *                               pull-up; devices which did not start
+ *                               yet hold them low.
+ *
+ * Samples are generated in (wall clock) real time at the selected
+ * decimation into a circular ADC buffer, so trigger waits, buffer
+ * fill times and stale buffer contents behave as on the device.
+ */
+
+#ifndef __RP_H
+#define __RP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define RP_OK 0
+// Failed to initialize or not initialized
+#define RP_EOOR 7
+// Invalid parameter value
+#define RP_EIPV 11
+
+// Number of samples in ADC buffer
+#define ADC_BUFFER_SIZE (16 * 1024)
+// Number of samples of arbitrary waveform buffer
+#define BUFFER_LENGTH (16 * 1024)
+
+
+typedef enum {
+    RP_LED0, RP_LED1, RP_LED2, RP_LED3,
+    RP_LED4, RP_LED5, RP_LED6, RP_LED7,
+    RP_DIO0_P, RP_DIO1_P, RP_DIO2_P, RP_DIO3_P,
+    RP_DIO4_P, RP_DIO5_P, RP_DIO6_P, RP_DIO7_P,
+    RP_DIO0_N, RP_DIO1_N, RP_DIO2_N, RP_DIO3_N,
+    RP_DIO4_N, RP_DIO5_N, RP_DIO6_N, RP_DIO7_N
+} rp_dpin_t;
+
+typedef enum {
+    RP_LOW,
+    RP_HIGH
+} rp_pinState_t;
+
+typedef enum {
+    RP_IN,
+    RP_OUT
+} rp_pinDirection_t;
+
+typedef enum {
+    RP_CH_1,
+    RP_CH_2
+} rp_channel_t;
+
+typedef enum {
+    RP_WAVEFORM_SINE,
+    RP_WAVEFORM_SQUARE,
+    RP_WAVEFORM_TRIANGLE,
+    RP_WAVEFORM_RAMP_UP,
+    RP_WAVEFORM_RAMP_DOWN,
+    RP_WAVEFORM_DC,
+    RP_WAVEFORM_PWM,
+    RP_WAVEFORM_ARBITRARY
+} rp_waveform_t;
+
+typedef enum {
+    RP_GEN_MODE_CONTINUOUS,
+    RP_GEN_MODE_BURST,
+    RP_GEN_MODE_STREAM
+} rp_gen_mode_t;
+
+typedef enum {
+    RP_GEN_TRIG_SRC_INTERNAL = 1,
+    RP_GEN_TRIG_SRC_EXT_PE = 2,
+    RP_GEN_TRIG_SRC_EXT_NE = 3,
+    RP_GEN_TRIG_GATED_BURST
+} rp_trig_src_t;
+
+typedef enum {
+    RP_DEC_1,
+    RP_DEC_8,
+    RP_DEC_64,
+    RP_DEC_1024,
+    RP_DEC_8192,
+    RP_DEC_65536
+} rp_acq_decimation_t;
+
+typedef enum {
+    RP_TRIG_SRC_DISABLED,
+    RP_TRIG_SRC_NOW,
+    RP_TRIG_SRC_CHA_PE,
+    RP_TRIG_SRC_CHA_NE,
+    RP_TRIG_SRC_CHB_PE,
+    RP_TRIG_SRC_CHB_NE,
+    RP_TRIG_SRC_EXT_PE,
+    RP_TRIG_SRC_EXT_NE,
+    RP_TRIG_SRC_AWG_PE,
+    RP_TRIG_SRC_AWG_NE
+} rp_acq_trig_src_t;
+
+typedef enum {
+    RP_TRIG_STATE_TRIGGERED,
+    RP_TRIG_STATE_WAITING
+} rp_acq_trig_state_t;
+
+
+int rp_Init(void);
+int rp_Release(void);
+
+int rp_DpinSetDirection(rp_dpin_t pin, rp_pinDirection_t direction);
+int rp_DpinGetDirection(rp_dpin_t pin, rp_pinDirection_t *direction);
+int rp_DpinSetState(rp_dpin_t pin, rp_pinState_t state);
+int rp_DpinGetState(rp_dpin_t pin, rp_pinState_t *state);
+
+int rp_GenReset(void);
+int rp_GenOutEnable(rp_channel_t channel);
+int rp_GenOutDisable(rp_channel_t channel);
+int rp_GenAmp(rp_channel_t channel, float amplitude);
+int rp_GenOffset(rp_channel_t channel, float offset);
+int rp_GenFreq(rp_channel_t channel, float frequency);
+int rp_GenPhase(rp_channel_t channel, float phase);
+int rp_GenWaveform(rp_channel_t channel, rp_waveform_t type);
+int rp_GenArbWaveform(rp_channel_t channel, float *waveform, uint32_t length);
+int rp_GenMode(rp_channel_t channel, rp_gen_mode_t mode);
+int rp_GenBurstCount(rp_channel_t channel, int num);
+int rp_GenTriggerSource(rp_channel_t channel, rp_trig_src_t src);
+int rp_GenTrigger(uint32_t channel);
+
+int rp_AcqReset(void);
+int rp_AcqStart(void);
+int rp_AcqStop(void);
+int rp_AcqSetGain(rp_channel_t channel, rp_pinState_t state);
+int rp_AcqSetDecimation(rp_acq_decimation_t decimation);
+int rp_AcqGetDecimation(rp_acq_decimation_t *decimation);
+int rp_AcqGetDecimationFactor(uint32_t *decimation);
+int rp_AcqGetSamplingRateHz(float *sampling_rate);
+int rp_AcqSetAveraging(bool enabled);
+int rp_AcqSetTriggerSrc(rp_acq_trig_src_t source);
+int rp_AcqGetTriggerSrc(rp_acq_trig_src_t *source);
+int rp_AcqGetTriggerState(rp_acq_trig_state_t *state);
+int rp_AcqSetTriggerDelay(int32_t decimated_data_num);
+int rp_AcqSetTriggerLevel(rp_channel_t channel, float voltage);
+int rp_AcqGetWritePointer(uint32_t *pos);
+int rp_AcqGetWritePointerAtTrig(uint32_t *pos);
+int rp_AcqGetBufSize(uint32_t *size);
+int rp_AcqGetOldestDataV(rp_channel_t channel, uint32_t *size, float *buffer);
+int rp_AcqGetOldestDataRaw(rp_channel_t channel, uint32_t *size, int16_t *buffer);
+int rp_AcqGetDataV(rp_channel_t channel, uint32_t pos, uint32_t *size, float *buffer);
+int rp_AcqGetDataRaw(rp_channel_t channel, uint32_t pos, uint32_t *size, int16_t *buffer);
+
+#endif // __RP_H
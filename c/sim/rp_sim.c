@@ -0,0 +1,922 @@
+/**
+ * Simulated Red Pitaya API, see sim/rp.h for the configuration.
+ *
+ * The simulation is event driven: every call first generates the ADC
+ * samples up to the current time with the generator, DIO and
+ * acquisition settings that were valid until now and only then
+ * applies its own change.  Samples are written into a circular buffer
+ * like the FPGA does, only the last buffer length (plus the time the
+ * DUT needs to settle) is actually computed when skipping ahead.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rp.h"
+
+#define BASE_SAMPLERATE 125e6
+#define NPINS (RP_DIO7_N+1)
+#define MAX_NONLINEAR 8
+// Level trigger hysteresis relative to full scale
+#define TRIGGER_HYSTERESIS 3e-3
+// Samples computed in front of the buffer to let the DUT settle.
+#define MAX_WARMUP (1 << 18)
+// Devices sharing a bus and trigger edges remembered on the bus
+#define MAX_DEVICES 16
+#define BUS_EDGES 64
+
+enum dut_type {
+    DUT_NONE,
+    DUT_LOWPASS,
+    DUT_HIGHPASS,
+    DUT_RESONANCE,
+    DUT_NOTCH
+};
+
+struct biquad {
+    double b0, b1, b2, a1, a2;
+    double x1, x2, y1, y2;
+};
+
+/**
+ * DIO lines shared by the simulated devices of a chain, a file mapped
+ * into all processes.  Each device only writes its own row, device 0
+ * additionally appends the edges of its DIO0_N, which drives the
+ * external trigger input of all devices.
+ */
+struct bus {
+    uint8_t active[MAX_DEVICES];
+    uint8_t direction[MAX_DEVICES][NPINS];
+    uint8_t state[MAX_DEVICES][NPINS];
+    uint64_t nedges;
+    struct {
+        double t;  // CLOCK_MONOTONIC [s]
+        uint8_t level;
+    } edges[BUS_EDGES];
+};
+
+struct generator {
+    bool enabled;
+    float amp, offset, freq, phase;
+    rp_waveform_t waveform;
+    rp_gen_mode_t mode;
+    int burstcount;
+    rp_trig_src_t trigsrc;
+    float arb[BUFFER_LENGTH];
+    uint32_t arblen;
+    // Waveform position is x0 + (t-tref)*freq periods for t >= tref,
+    // tref is INFINITY while waiting for a trigger.
+    double tref, x0;
+};
+
+static struct {
+    // Configuration
+    double noise;
+    double ext_f, ext_a;
+    enum dut_type dut;
+    double dut_f, dut_q;
+    double nonlinear[MAX_NONLINEAR];
+    int nnonlinear;
+    double out2_coupling;
+    double ext_auto;  // < 0 for loopback from DIO0_N
+    double read_us, arb_us, reg_us;
+    uint64_t rng;
+
+    double t0;
+
+    // Acquisition
+    rp_acq_decimation_t decimation;
+    int32_t trigger_delay;
+    rp_acq_trig_src_t trigsrc;
+    float trigger_level[2];
+    rp_pinState_t gain[2];
+    bool running;
+    double tstart;  // time of sample 0
+    bool triggered;
+    uint64_t karmed, ktrig, nwritten;
+    int16_t buf[2][ADC_BUFFER_SIZE];
+    // Level trigger armed by signal below (PE) or above (NE) the
+    // hysteresis band
+    bool armed_pe[2], armed_ne[2];
+    struct biquad filter;
+    uint64_t warmup;
+
+    struct generator gen[2];
+
+    rp_pinDirection_t direction[NPINS];
+    rp_pinState_t state[NPINS];
+    double ext_auto_at;
+
+    // Chain of devices, NULL if this is the only one
+    struct bus *bus;
+    int device, ndevices;
+    uint64_t nedges;  // edges of the bus processed
+    rp_pinState_t ext_level;  // of followers
+    double tlast;  // time of the last update
+} sim;
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9 - sim.t0;
+}
+
+/** Block for `us` microseconds, spinning for short times. */
+static void busy(double us) {
+    if (us <= 0) return;
+    if (us >= 100) {
+        usleep(us);
+        return;
+    }
+    double end = now() + us*1e-6;
+    while (now() < end);
+}
+
+static double env_double(const char *name, double def) {
+    const char *s = getenv(name);
+    return s && *s ? atof(s) : def;
+}
+
+/**
+ * Parse environment variable of the form WORD,NUM,NUM,...  Returns
+ * the number of values (up to `maxn`) and copies WORD to `word` (if
+ * not NULL).  Returns -1 if the variable is not set.
+ */
+static int env_list(
+        const char *name, char *word, size_t wordsize,
+        double *values, int maxn) {
+    const char *s = getenv(name);
+    if (!s || !*s) return -1;
+    char *copy = strdup(s);
+    char *save = NULL;
+    char *tok = strtok_r(copy, ",", &save);
+    if (word) {
+        snprintf(word, wordsize, "%s", tok ? tok : "");
+        tok = strtok_r(NULL, ",", &save);
+    }
+    int n = 0;
+    for (; tok && n < maxn; tok = strtok_r(NULL, ",", &save))
+        values[n++] = atof(tok);
+    free(copy);
+    return n;
+}
+
+static void configure() {
+    double values[MAX_NONLINEAR];
+    char word[32];
+
+    sim.noise = env_double("RPSIM_NOISE", 1e-3);
+    sim.ext_f = sim.ext_a = 0;
+    if (env_list("RPSIM_SIGNAL", NULL, 0, values, 2) == 2) {
+        sim.ext_f = values[0];
+        sim.ext_a = values[1];
+    }
+
+    sim.dut = DUT_NONE;
+    int n = env_list("RPSIM_DUT", word, sizeof(word), values, 2);
+    if (n >= 1 && strcmp(word, "lowpass") == 0) sim.dut = DUT_LOWPASS;
+    else if (n >= 1 && strcmp(word, "highpass") == 0) sim.dut = DUT_HIGHPASS;
+    else if (n >= 2 && strcmp(word, "resonance") == 0) sim.dut = DUT_RESONANCE;
+    else if (n >= 2 && strcmp(word, "notch") == 0) sim.dut = DUT_NOTCH;
+    else if (n >= 0 && strcmp(word, "none") != 0)
+        fprintf(stderr, "rpsim: ignoring invalid RPSIM_DUT\n");
+    sim.dut_f = n >= 1 ? values[0] : 0;
+    sim.dut_q = n >= 2 ? values[1] : 0;
+
+    sim.nnonlinear = env_list(
+        "RPSIM_NONLINEAR", NULL, 0, sim.nonlinear, MAX_NONLINEAR);
+    if (sim.nnonlinear < 0) sim.nnonlinear = 0;
+    sim.out2_coupling = env_double("RPSIM_OUT2_COUPLING", 0);
+
+    sim.ext_auto = -1;
+    n = env_list("RPSIM_EXT_TRIGGER", word, sizeof(word), values, 1);
+    if (n == 1 && strcmp(word, "auto") == 0)
+        sim.ext_auto = values[0]*1e-6;
+    else if (n >= 0 && strcmp(word, "loopback") != 0)
+        fprintf(stderr, "rpsim: ignoring invalid RPSIM_EXT_TRIGGER\n");
+
+    sim.read_us = env_double("RPSIM_READ_US", 1500);
+    sim.arb_us = env_double("RPSIM_ARB_US", 2000);
+    sim.reg_us = env_double("RPSIM_REG_US", 2);
+    sim.rng = env_double("RPSIM_SEED", 1);
+
+    sim.device = env_double("RPSIM_DEVICE", 0);
+    sim.ndevices = env_double("RPSIM_DEVICES", 1);
+    if (sim.device < 0 || sim.device >= MAX_DEVICES
+            || sim.ndevices < 1 || sim.ndevices > MAX_DEVICES) {
+        fprintf(stderr, "rpsim: ignoring invalid RPSIM_DEVICE(S)\n");
+        sim.device = 0;
+        sim.ndevices = 1;
+    }
+}
+
+/** Map the bus file RPSIM_BUS shared with the other devices. */
+static void bus_open() {
+    sim.bus = NULL;
+    const char *path = getenv("RPSIM_BUS");
+    if (!path || !*path) return;
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(struct bus)) != 0) {
+        perror("rpsim: RPSIM_BUS");
+        if (fd >= 0) close(fd);
+        return;
+    }
+    void *p = mmap(NULL, sizeof(struct bus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("rpsim: RPSIM_BUS");
+        return;
+    }
+    sim.bus = p;
+    sim.nedges = __atomic_load_n(&sim.bus->nedges, __ATOMIC_ACQUIRE);
+    sim.ext_level = RP_LOW;  // DIO0_N of device 0 after rp_Init
+    if (sim.nedges > 0)
+        sim.ext_level = sim.bus->edges[(sim.nedges - 1) % BUS_EDGES].level;
+}
+
+static bool bus_follower() {
+    return sim.bus && sim.device != 0;
+}
+
+/** Publish the own pin settings on the bus. */
+static void bus_publish(rp_dpin_t pin) {
+    if (!sim.bus) return;
+    __atomic_store_n(&sim.bus->direction[sim.device][pin], sim.direction[pin], __ATOMIC_RELEASE);
+    __atomic_store_n(&sim.bus->state[sim.device][pin], sim.state[pin], __ATOMIC_RELEASE);
+}
+
+/**
+ * Level of a shared line: wired-AND of all devices driving it with
+ * pull-up.  Devices which are not running yet hold it low.
+ */
+static rp_pinState_t bus_level(rp_dpin_t pin) {
+    for (int d = 0; d < sim.ndevices; d++) {
+        if (!__atomic_load_n(&sim.bus->active[d], __ATOMIC_ACQUIRE))
+            return RP_LOW;
+        if (__atomic_load_n(&sim.bus->direction[d][pin], __ATOMIC_ACQUIRE) == RP_OUT
+                && __atomic_load_n(&sim.bus->state[d][pin], __ATOMIC_ACQUIRE) == RP_LOW)
+            return RP_LOW;
+    }
+    return RP_HIGH;
+}
+
+/** Device 0 appends an edge of the trigger line at time t. */
+static void bus_edge(rp_pinState_t level, double t) {
+    if (!sim.bus || sim.device != 0) return;
+    uint64_t n = sim.bus->nedges;
+    sim.bus->edges[n % BUS_EDGES].t = t + sim.t0;
+    sim.bus->edges[n % BUS_EDGES].level = level;
+    __atomic_store_n(&sim.bus->nedges, n + 1, __ATOMIC_RELEASE);
+}
+
+
+/** splitmix64 */
+static uint64_t random_next() {
+    uint64_t z = (sim.rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/** Pair of independent standard normal numbers (Box-Muller). */
+static void random_gaussian(double *n1, double *n2) {
+    uint64_t r = random_next();
+    double u1 = ((r >> 32) + 1.0) / 4294967297.0;
+    double u2 = (r & 0xffffffff) / 4294967296.0;
+    double rad = sqrt(-2*log(u1));
+    *n1 = rad * cos(2*M_PI*u2);
+    *n2 = rad * sin(2*M_PI*u2);
+}
+
+
+static double samplerate() {
+    static const double factors[] = {1, 8, 64, 1024, 8192, 65536};
+    return BASE_SAMPLERATE / factors[sim.decimation];
+}
+
+/** Bilinear transform of the DUT at the current samplerate. */
+static void dut_design() {
+    struct biquad *b = &sim.filter;
+    double sr = samplerate();
+    double f = fmin(sim.dut_f, 0.49*sr);
+    memset(b, 0, sizeof(*b));
+    b->b0 = 1;
+    sim.warmup = 0;
+    if (sim.dut == DUT_LOWPASS || sim.dut == DUT_HIGHPASS) {
+        double k = tan(M_PI*f/sr);
+        b->a1 = (k-1) / (k+1);
+        b->b0 = sim.dut == DUT_LOWPASS ? k/(1+k) : 1/(1+k);
+        b->b1 = sim.dut == DUT_LOWPASS ? b->b0 : -b->b0;
+        sim.warmup = 8 * sr / (2*M_PI*f);
+    } else if (sim.dut == DUT_RESONANCE || sim.dut == DUT_NOTCH) {
+        double w0 = 2*M_PI*f/sr;
+        double alpha = sin(w0) / (2*sim.dut_q);
+        double a0 = 1 + alpha;
+        b->a1 = -2*cos(w0) / a0;
+        b->a2 = (1-alpha) / a0;
+        if (sim.dut == DUT_RESONANCE) {
+            b->b0 = alpha / a0;
+            b->b2 = -alpha / a0;
+        } else {
+            b->b0 = b->b2 = 1 / a0;
+            b->b1 = b->a1;
+        }
+        sim.warmup = 8 * sim.dut_q * sr / (M_PI*f);
+    }
+    if (sim.warmup > MAX_WARMUP) sim.warmup = MAX_WARMUP;
+}
+
+static double dut_step(double x) {
+    struct biquad *b = &sim.filter;
+    double y = b->b0*x + b->b1*b->x1 + b->b2*b->x2 - b->a1*b->y1 - b->a2*b->y2;
+    b->x2 = b->x1;
+    b->x1 = x;
+    b->y2 = b->y1;
+    b->y1 = y;
+
+    double p = y, out = y;
+    for (int i = 0; i < sim.nnonlinear; i++) {
+        p *= y;
+        out += sim.nonlinear[i] * p;
+    }
+    return out;
+}
+
+
+static double waveform_value(const struct generator *g, double x) {
+    double frac = x + g->phase/360;
+    frac -= floor(frac);
+    switch (g->waveform) {
+    case RP_WAVEFORM_SINE: return sin(2*M_PI*frac);
+    case RP_WAVEFORM_SQUARE:
+    case RP_WAVEFORM_PWM: return frac < 0.5 ? 1 : -1;
+    case RP_WAVEFORM_TRIANGLE: return 1 - 4*fabs(frac-0.5);
+    case RP_WAVEFORM_RAMP_UP: return 2*frac - 1;
+    case RP_WAVEFORM_RAMP_DOWN: return 1 - 2*frac;
+    case RP_WAVEFORM_DC: return 1;
+    case RP_WAVEFORM_ARBITRARY:
+        if (g->arblen == 0) return 0;
+        return g->arb[(uint32_t)(frac * g->arblen) % g->arblen];
+    }
+    return 0;
+}
+
+/**
+ * Output voltage at time t.  Before the trigger and after the burst
+ * the first sample of the waveform is output.
+ */
+static double generator_value(const struct generator *g, double t) {
+    if (!g->enabled) return 0;
+    double x = 0;
+    if (t >= g->tref) {
+        x = g->x0 + (t - g->tref) * g->freq;
+        if (g->mode == RP_GEN_MODE_BURST && g->burstcount > 0
+                && x >= g->burstcount)
+            x = 0;
+    }
+    return g->offset + g->amp * waveform_value(g, x);
+}
+
+static bool generator_waits_for_trigger(const struct generator *g) {
+    return g->trigsrc == RP_GEN_TRIG_SRC_EXT_PE
+        || g->trigsrc == RP_GEN_TRIG_SRC_EXT_NE;
+}
+
+
+static uint64_t acquisition_stop() {
+    int64_t post = ADC_BUFFER_SIZE/2 + (int64_t)sim.trigger_delay;
+    return sim.ktrig + (post > 0 ? post : 0);
+}
+
+/** Level triggers are accepted after the pre-trigger samples. */
+static uint64_t acquisition_pretrigger() {
+    int64_t pre = ADC_BUFFER_SIZE/2 - (int64_t)sim.trigger_delay;
+    return pre > 0 ? pre : 0;
+}
+
+static void acquisition_trigger(uint64_t k) {
+    if (!sim.running || sim.trigsrc == RP_TRIG_SRC_DISABLED) return;
+    sim.triggered = true;
+    sim.ktrig = k;
+    sim.trigsrc = RP_TRIG_SRC_DISABLED;
+}
+
+static uint64_t sample_index(double t) {
+    double k = ceil((t - sim.tstart) * samplerate());
+    return k > 0 ? k : 0;
+}
+
+static void level_disarm() {
+    sim.armed_pe[0] = sim.armed_pe[1] = false;
+    sim.armed_ne[0] = sim.armed_ne[1] = false;
+}
+
+static bool level_trigger(int ch, double v) {
+    double fullscale = sim.gain[ch] == RP_HIGH ? 20 : 1;
+    double level = sim.trigger_level[ch];
+    double hysteresis = TRIGGER_HYSTERESIS * fullscale;
+    bool pe = sim.armed_pe[ch] && v >= level;
+    bool ne = sim.armed_ne[ch] && v <= level;
+    if (v < level - hysteresis) sim.armed_pe[ch] = true;
+    if (v > level + hysteresis) sim.armed_ne[ch] = true;
+    rp_acq_trig_src_t src = sim.trigsrc;
+    return (ch == 0 && ((src == RP_TRIG_SRC_CHA_PE && pe)
+                        || (src == RP_TRIG_SRC_CHA_NE && ne)))
+        || (ch == 1 && ((src == RP_TRIG_SRC_CHB_PE && pe)
+                        || (src == RP_TRIG_SRC_CHB_NE && ne)));
+}
+
+/** Write ADC samples up to time t. */
+static void advance(double t) {
+    if (!sim.running) return;
+    double sr = samplerate();
+    uint64_t target = t > sim.tstart ? (t - sim.tstart) * sr : 0;
+    if (sim.triggered && target > acquisition_stop())
+        target = acquisition_stop();
+    if (target <= sim.nwritten) return;
+
+    uint64_t k = sim.nwritten;
+    // Skip time not covered by the buffer.  A level trigger is then
+    // found in the remaining samples only.
+    if (target - k > ADC_BUFFER_SIZE + sim.warmup) {
+        k = target - ADC_BUFFER_SIZE - sim.warmup;
+        dut_design();
+        level_disarm();
+    }
+    for (; k < target; k++) {
+        double tk = sim.tstart + k / sr;
+        double out1 = generator_value(&sim.gen[0], tk);
+        double out2 = generator_value(&sim.gen[1], tk);
+        double ext = sim.ext_a * sin(2*M_PI*sim.ext_f*tk);
+        double n1, n2;
+        random_gaussian(&n1, &n2);
+        double v[2] = {
+            out1 + ext + sim.noise*n1,
+            dut_step(out1) + ext + sim.out2_coupling*out2 + sim.noise*n2
+        };
+
+        if (k >= sim.karmed + acquisition_pretrigger()
+                && (level_trigger(0, v[0]) | level_trigger(1, v[1]))) {
+            acquisition_trigger(k);
+            if (target > acquisition_stop()) target = acquisition_stop();
+        }
+
+        for (int ch = 0; ch < 2; ch++) {
+            double fullscale = sim.gain[ch] == RP_HIGH ? 20 : 1;
+            double code = round(v[ch] / fullscale * 8192);
+            if (code > 8191) code = 8191;
+            if (code < -8192) code = -8192;
+            sim.buf[ch][k % ADC_BUFFER_SIZE] = code;
+        }
+    }
+    sim.nwritten = target;
+}
+
+
+static void generator_start(int ch, double t) {
+    struct generator *g = &sim.gen[ch];
+    g->tref = t;
+    g->x0 = 0;
+    if (ch == 0 && sim.trigsrc == RP_TRIG_SRC_AWG_PE)
+        acquisition_trigger(sample_index(t));
+}
+
+/** External trigger input DIO0_P changed at time t. */
+static void external_edge(bool falling, bool rising, double t) {
+    if ((falling && sim.trigsrc == RP_TRIG_SRC_EXT_NE)
+            || (rising && sim.trigsrc == RP_TRIG_SRC_EXT_PE))
+        acquisition_trigger(sample_index(t));
+    for (int ch = 0; ch < 2; ch++) {
+        struct generator *g = &sim.gen[ch];
+        if (g->enabled && isinf(g->tref)
+                && ((falling && g->trigsrc == RP_GEN_TRIG_SRC_EXT_NE)
+                    || (rising && g->trigsrc == RP_GEN_TRIG_SRC_EXT_PE)))
+            generator_start(ch, t);
+    }
+}
+
+static rp_pinState_t external_level() {
+    if (bus_follower())
+        return sim.ext_level;
+    if (sim.ext_auto < 0 && sim.direction[RP_DIO0_N] == RP_OUT)
+        return sim.state[RP_DIO0_N];
+    return RP_HIGH;
+}
+
+/**
+ * Trigger pulse of the simulated chain leader in `auto` mode, fired
+ * after the program started waiting for it.
+ */
+static void external_schedule(double t) {
+    if (sim.ext_auto >= 0 && isinf(sim.ext_auto_at))
+        sim.ext_auto_at = t + sim.ext_auto;
+}
+
+/**
+ * Followers apply the trigger edges of device 0 up to time t.  Edges
+ * seen late (after the last update) are applied at that time.
+ */
+static void bus_receive(double t) {
+    uint64_t n = __atomic_load_n(&sim.bus->nedges, __ATOMIC_ACQUIRE);
+    if (n - sim.nedges > BUS_EDGES) sim.nedges = n - BUS_EDGES;
+    for (; sim.nedges < n; sim.nedges++) {
+        double te = sim.bus->edges[sim.nedges % BUS_EDGES].t - sim.t0;
+        rp_pinState_t level = sim.bus->edges[sim.nedges % BUS_EDGES].level;
+        if (te > t) break;
+        if (te < sim.tlast) te = sim.tlast;
+        if (level == sim.ext_level) continue;
+        advance(te);
+        sim.ext_level = level;
+        external_edge(level == RP_LOW, level == RP_HIGH, te);
+    }
+}
+
+/** Bring the simulation up to the current time. */
+static double update() {
+    busy(sim.reg_us);
+    double t = now();
+    if (sim.ext_auto_at <= t) {
+        advance(sim.ext_auto_at);
+        external_edge(true, true, sim.ext_auto_at);
+        sim.ext_auto_at = INFINITY;
+    }
+    if (bus_follower())
+        bus_receive(t);
+    advance(t);
+    sim.tlast = t;
+    return t;
+}
+
+
+int rp_Init(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sim.t0 = ts.tv_sec + ts.tv_nsec*1e-9;
+    configure();
+    sim.ext_auto_at = INFINITY;
+    sim.tlast = 0;
+    bus_open();
+    // Default setting of digital IO pins is OUT, LOW
+    for (int i = 0; i < NPINS; i++) {
+        sim.direction[i] = RP_OUT;
+        sim.state[i] = RP_LOW;
+        bus_publish(i);
+    }
+    rp_GenReset();
+    rp_AcqReset();
+    if (sim.bus)
+        __atomic_store_n(&sim.bus->active[sim.device], 1, __ATOMIC_RELEASE);
+    return RP_OK;
+}
+
+int rp_Release(void) {
+    if (sim.bus) {
+        __atomic_store_n(&sim.bus->active[sim.device], 0, __ATOMIC_RELEASE);
+        munmap(sim.bus, sizeof(struct bus));
+        sim.bus = NULL;
+    }
+    return RP_OK;
+}
+
+
+int rp_DpinSetDirection(rp_dpin_t pin, rp_pinDirection_t direction) {
+    if (pin >= NPINS) return RP_EIPV;
+    double t = update();
+    rp_pinState_t before = external_level();
+    sim.direction[pin] = direction;
+    bus_publish(pin);
+    rp_pinState_t after = external_level();
+    if (before != after) {
+        external_edge(after == RP_LOW, after == RP_HIGH, t);
+        bus_edge(after, t);
+    }
+    return RP_OK;
+}
+
+int rp_DpinGetDirection(rp_dpin_t pin, rp_pinDirection_t *direction) {
+    if (pin >= NPINS) return RP_EIPV;
+    *direction = sim.direction[pin];
+    return RP_OK;
+}
+
+int rp_DpinSetState(rp_dpin_t pin, rp_pinState_t state) {
+    if (pin >= NPINS) return RP_EIPV;
+    double t = update();
+    rp_pinState_t before = external_level();
+    sim.state[pin] = state;
+    bus_publish(pin);
+    rp_pinState_t after = external_level();
+    if (before != after) {
+        external_edge(after == RP_LOW, after == RP_HIGH, t);
+        bus_edge(after, t);
+    }
+    return RP_OK;
+}
+
+int rp_DpinGetState(rp_dpin_t pin, rp_pinState_t *state) {
+    if (pin >= NPINS) return RP_EIPV;
+    update();
+    if (pin == RP_DIO0_P && sim.direction[pin] == RP_IN)
+        *state = external_level();
+    else if (sim.bus && pin != RP_DIO0_N && sim.direction[pin] == RP_IN)
+        *state = bus_level(pin);
+    else
+        *state = sim.state[pin];
+    return RP_OK;
+}
+
+
+int rp_GenReset(void) {
+    update();
+    for (int ch = 0; ch < 2; ch++) {
+        struct generator *g = &sim.gen[ch];
+        g->enabled = false;
+        g->amp = 1;
+        g->offset = 0;
+        g->freq = 1000;
+        g->phase = 0;
+        g->waveform = RP_WAVEFORM_SINE;
+        g->mode = RP_GEN_MODE_CONTINUOUS;
+        g->burstcount = 1;
+        g->trigsrc = RP_GEN_TRIG_SRC_INTERNAL;
+        g->arblen = 0;
+        g->tref = INFINITY;
+        g->x0 = 0;
+    }
+    return RP_OK;
+}
+
+int rp_GenOutEnable(rp_channel_t channel) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    double t = update();
+    struct generator *g = &sim.gen[channel];
+    if (g->enabled) return RP_OK;
+    // Disabling only mutes the output, a triggered burst goes on.
+    g->enabled = true;
+    if (isinf(g->tref) && !generator_waits_for_trigger(g))
+        generator_start(channel, t);
+    return RP_OK;
+}
+
+int rp_GenOutDisable(rp_channel_t channel) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gen[channel].enabled = false;
+    return RP_OK;
+}
+
+int rp_GenAmp(rp_channel_t channel, float amplitude) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gen[channel].amp = amplitude;
+    return RP_OK;
+}
+
+int rp_GenOffset(rp_channel_t channel, float offset) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gen[channel].offset = offset;
+    return RP_OK;
+}
+
+int rp_GenFreq(rp_channel_t channel, float frequency) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    double t = update();
+    // Phase accumulator continues with the new frequency.
+    struct generator *g = &sim.gen[channel];
+    if (t > g->tref) {
+        g->x0 += (t - g->tref) * g->freq;
+        g->x0 -= floor(g->x0);
+        g->tref = t;
+    }
+    g->freq = frequency;
+    return RP_OK;
+}
+
+int rp_GenPhase(rp_channel_t channel, float phase) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gen[channel].phase = phase;
+    return RP_OK;
+}
+
+int rp_GenWaveform(rp_channel_t channel, rp_waveform_t type) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gen[channel].waveform = type;
+    return RP_OK;
+}
+
+int rp_GenArbWaveform(rp_channel_t channel, float *waveform, uint32_t length) {
+    if (channel > RP_CH_2 || length > BUFFER_LENGTH) return RP_EIPV;
+    update();
+    memcpy(sim.gen[channel].arb, waveform, length*sizeof(float));
+    sim.gen[channel].arblen = length;
+    busy(sim.arb_us);
+    return RP_OK;
+}
+
+int rp_GenMode(rp_channel_t channel, rp_gen_mode_t mode) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gen[channel].mode = mode;
+    return RP_OK;
+}
+
+int rp_GenBurstCount(rp_channel_t channel, int num) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gen[channel].burstcount = num;
+    return RP_OK;
+}
+
+int rp_GenTriggerSource(rp_channel_t channel, rp_trig_src_t src) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    double t = update();
+    // Writing the trigger source re-arms the channel (assumed for the
+    // hardware, see gen_apply in generator.h).
+    struct generator *g = &sim.gen[channel];
+    g->trigsrc = src;
+    g->tref = INFINITY;
+    if (g->enabled && !generator_waits_for_trigger(g))
+        generator_start(channel, t);
+    return RP_OK;
+}
+
+int rp_GenTrigger(uint32_t channel) {
+    double t = update();
+    for (int ch = 0; ch < 2; ch++)
+        if ((channel & (1 << ch)) && sim.gen[ch].enabled)
+            generator_start(ch, t);
+    return RP_OK;
+}
+
+
+int rp_AcqReset(void) {
+    update();
+    sim.running = false;
+    sim.triggered = false;
+    sim.decimation = RP_DEC_1;
+    sim.trigger_delay = 0;
+    sim.trigsrc = RP_TRIG_SRC_DISABLED;
+    sim.trigger_level[0] = sim.trigger_level[1] = 0;
+    sim.gain[0] = sim.gain[1] = RP_LOW;
+    return RP_OK;
+}
+
+int rp_AcqStart(void) {
+    double t = update();
+    sim.running = true;
+    sim.triggered = false;
+    sim.tstart = t;
+    sim.nwritten = sim.karmed = 0;
+    level_disarm();
+    dut_design();
+    if (sim.trigsrc == RP_TRIG_SRC_NOW)
+        acquisition_trigger(0);
+    return RP_OK;
+}
+
+int rp_AcqStop(void) {
+    update();
+    sim.running = false;
+    return RP_OK;
+}
+
+int rp_AcqSetGain(rp_channel_t channel, rp_pinState_t state) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.gain[channel] = state;
+    return RP_OK;
+}
+
+int rp_AcqSetDecimation(rp_acq_decimation_t decimation) {
+    if (decimation > RP_DEC_65536) return RP_EIPV;
+    double t = update();
+    sim.decimation = decimation;
+    // Keep write pointer, continue at the new rate.
+    sim.tstart = t - sim.nwritten / samplerate();
+    dut_design();
+    return RP_OK;
+}
+
+int rp_AcqGetDecimation(rp_acq_decimation_t *decimation) {
+    *decimation = sim.decimation;
+    return RP_OK;
+}
+
+int rp_AcqGetDecimationFactor(uint32_t *decimation) {
+    *decimation = BASE_SAMPLERATE / samplerate();
+    return RP_OK;
+}
+
+int rp_AcqGetSamplingRateHz(float *sampling_rate) {
+    *sampling_rate = samplerate();
+    return RP_OK;
+}
+
+int rp_AcqSetAveraging(bool enabled) {
+    update();
+    return RP_OK;
+}
+
+int rp_AcqSetTriggerSrc(rp_acq_trig_src_t source) {
+    if (source > RP_TRIG_SRC_AWG_NE) return RP_EIPV;
+    double t = update();
+    sim.trigsrc = source;
+    sim.triggered = false;
+    sim.karmed = sim.nwritten;
+    level_disarm();
+    if (source == RP_TRIG_SRC_NOW)
+        acquisition_trigger(sample_index(t));
+    return RP_OK;
+}
+
+int rp_AcqGetTriggerSrc(rp_acq_trig_src_t *source) {
+    update();
+    *source = sim.trigsrc;
+    return RP_OK;
+}
+
+int rp_AcqGetTriggerState(rp_acq_trig_state_t *state) {
+    double t = update();
+    if (sim.trigsrc == RP_TRIG_SRC_EXT_PE || sim.trigsrc == RP_TRIG_SRC_EXT_NE)
+        external_schedule(t);
+    *state = sim.trigsrc == RP_TRIG_SRC_DISABLED
+        ? RP_TRIG_STATE_TRIGGERED : RP_TRIG_STATE_WAITING;
+    return RP_OK;
+}
+
+int rp_AcqSetTriggerDelay(int32_t decimated_data_num) {
+    update();
+    sim.trigger_delay = decimated_data_num;
+    return RP_OK;
+}
+
+int rp_AcqSetTriggerLevel(rp_channel_t channel, float voltage) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    sim.trigger_level[channel] = voltage;
+    return RP_OK;
+}
+
+int rp_AcqGetWritePointer(uint32_t *pos) {
+    update();
+    *pos = sim.nwritten % ADC_BUFFER_SIZE;
+    return RP_OK;
+}
+
+int rp_AcqGetWritePointerAtTrig(uint32_t *pos) {
+    update();
+    *pos = sim.ktrig % ADC_BUFFER_SIZE;
+    return RP_OK;
+}
+
+int rp_AcqGetBufSize(uint32_t *size) {
+    *size = ADC_BUFFER_SIZE;
+    return RP_OK;
+}
+
+int rp_AcqGetDataRaw(
+        rp_channel_t channel, uint32_t pos, uint32_t *size, int16_t *buffer) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    if (*size > ADC_BUFFER_SIZE) *size = ADC_BUFFER_SIZE;
+    for (uint32_t i = 0; i < *size; i++)
+        buffer[i] = sim.buf[channel][(pos + i) % ADC_BUFFER_SIZE];
+    busy(sim.read_us * *size / ADC_BUFFER_SIZE);
+    return RP_OK;
+}
+
+int rp_AcqGetDataV(
+        rp_channel_t channel, uint32_t pos, uint32_t *size, float *buffer) {
+    if (channel > RP_CH_2) return RP_EIPV;
+    update();
+    if (*size > ADC_BUFFER_SIZE) *size = ADC_BUFFER_SIZE;
+    float scale = (sim.gain[channel] == RP_HIGH ? 20.0 : 1.0) / 8192;
+    for (uint32_t i = 0; i < *size; i++)
+        buffer[i] = scale * sim.buf[channel][(pos + i) % ADC_BUFFER_SIZE];
+    busy(sim.read_us * *size / ADC_BUFFER_SIZE);
+    return RP_OK;
+}
+
+int rp_AcqGetOldestDataRaw(
+        rp_channel_t channel, uint32_t *size, int16_t *buffer) {
+    update();
+    return rp_AcqGetDataRaw(
+        channel, sim.nwritten % ADC_BUFFER_SIZE, size, buffer);
+}
+
+int rp_AcqGetOldestDataV(
+        rp_channel_t channel, uint32_t *size, float *buffer) {
+    update();
+    return rp_AcqGetDataV(
+        channel, sim.nwritten % ADC_BUFFER_SIZE, size, buffer);
+}
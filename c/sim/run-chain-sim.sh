@@ -0,0 +1,63 @@
+#!/bin/bash
+# Run a chain of simulated Red Pitayas on this host, like run-chain.sh
+# does on real devices.
+#
+# Usage (in c/): bash sim/run-chain-sim.sh [--ready] N EXECUTABLE [optional arguments]
+#
+# Builds the leader and follower variants of EXECUTABLE against the
+# simulated librp (with -DREADY_BUS for `--ready`) and starts N
+# processes in reverse order, which share their DIO lines through a
+# bus file (see sim/rp.h).  Outputs go to ../output_K.gz and
+# ../output.gz as for run-chain.sh.
+#
+# Other RPSIM_* variables are passed on, e.g. RPSIM_DEVICES=N+1
+# simulates a follower that never arms.
+
+# Exit on failure of any command
+set -e
+
+READYFLAG=""
+if [[ "$1" == "--ready" ]]; then
+    READYFLAG="-DREADY_BUS"
+    shift
+fi
+if [ "$#" -lt 2 ]; then
+    echo "Arguments: [--ready] N EXECUTABLE [optional arguments]"
+    exit 1
+fi
+N="$1"
+EXECNAME="$2"
+shift 2
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Build leader and follower in copies of the source directory
+for ROLE in leader follower; do
+    mkdir "$TMP/$ROLE"
+    cp -r . "$TMP/$ROLE/src"
+    CHAINFLAG="$READYFLAG"
+    [[ "$ROLE" == "follower" ]] && CHAINFLAG="-DFOLLOW $READYFLAG"
+    make -s -C "$TMP/$ROLE/src" SIM=1 CHAINFLAG="$CHAINFLAG" -B "$EXECNAME"
+done
+
+export RPSIM_BUS="$TMP/bus"
+export RPSIM_DEVICES="${RPSIM_DEVICES:-$N}"
+
+# Start in reverse order such that triggering device is started last.
+for IDX in $(seq $N -1 1); do
+    ROLE=follower
+    [ $IDX -eq 1 ] && ROLE=leader
+    RPSIM_DEVICE=$((IDX-1)) "$TMP/$ROLE/src/$EXECNAME" "$@" $((IDX*2-2)) \
+        | gzip -9 > ../output_$IDX.gz &
+    sleep 0.2s
+done
+
+# Kill background processes on Ctrl-C
+trap 'kill $(jobs -p); rm -rf "$TMP"' INT
+# Wait for background processes
+wait
+
+# Concatenate outputs into one file.
+shopt -s extglob
+zcat ../output_+([0-9]).gz | gzip -9 > ../output.gz
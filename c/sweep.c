@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sweep.h"
+#include "utility.h"
+
+
+void sweep_init(struct sweep *sweep) {
+    memset(sweep, 0, sizeof(*sweep));
+    sweep->npoints = 1;
+    sweep->index = -1;
+}
+
+void sweep_free(struct sweep *sweep) {
+    for (int a = 0; a < sweep->naxes; a++) {
+        free(sweep->axes[a].values);
+        sweep->axes[a].values = NULL;
+    }
+}
+
+
+/** Parse comma separated list of at least one float. */
+static int parse_list(const char *arg, float **values) {
+    int n = 1;
+    for (const char *c = arg; *c; c++)
+        if (*c == ',') n++;
+    *values = (float *)malloc(n * sizeof(float));
+    if (*values == NULL) return 0;
+    const char *p = arg;
+    for (int i = 0; i < n; i++) {
+        char *end;
+        (*values)[i] = strtof(p, &end);
+        if (end == p || (*end != ',' && *end != '\0')) {
+            free(*values);
+            *values = NULL;
+            return 0;
+        }
+        p = end + 1;
+    }
+    return n;
+}
+
+bool sweep_axis(
+        struct sweep *sweep, const char *name, const char *arg,
+        enum sweep_scale scale, float cost) {
+    if (sweep->naxes >= SWEEP_MAX_AXES) return false;
+    struct sweep_axis *axis = &sweep->axes[sweep->naxes];
+    memset(axis, 0, sizeof(*axis));
+    axis->name = name;
+    axis->cost = cost;
+
+    if (strncmp(arg, "lin:", 4) == 0) {
+        scale = SWEEP_LIN;
+        arg += 4;
+    } else if (strncmp(arg, "log:", 4) == 0) {
+        scale = SWEEP_LOG;
+        arg += 4;
+    } else if (strncmp(arg, "list:", 5) == 0) {
+        scale = SWEEP_LIST;
+        arg += 5;
+    }
+    axis->scale = scale;
+    if (scale == SWEEP_LIST) {
+        axis->npoints = parse_list(arg, &axis->values);
+    } else if (!parse_cmd_line_range(arg, &axis->start, &axis->end, &axis->npoints)) {
+        return false;
+    }
+    if (axis->npoints < 1) return false;
+    if (scale == SWEEP_LOG && (axis->start <= 0 || axis->end <= 0)) return false;
+
+    sweep->npoints *= axis->npoints;
+    sweep->loop[sweep->naxes] = sweep->naxes;
+    sweep->naxes++;
+    return true;
+}
+
+
+bool sweep_parse_order(const char *arg, enum sweep_order *order) {
+    if (strcmp(arg, "nested") == 0) *order = SWEEP_NESTED;
+    else if (strcmp(arg, "snake") == 0) *order = SWEEP_SNAKE;
+    else if (strcmp(arg, "grouped") == 0) *order = SWEEP_GROUPED;
+    else return false;
+    return true;
+}
+
+void sweep_order(struct sweep *sweep, enum sweep_order order) {
+    for (int l = 0; l < sweep->naxes; l++)
+        sweep->loop[l] = l;
+    sweep->snake = order != SWEEP_NESTED;
+    if (order != SWEEP_GROUPED) return;
+
+    // With snake order the axis in loop level l changes
+    // (N_l - 1) * N_0 * ... * N_{l-1} times.  Swapping two adjacent
+    // levels changes the total cost by (N_a - 1)(N_b - 1)(c_a - c_b),
+    // so sorting by cost, most expensive outermost, is optimal.
+    // Insertion sort keeps the declaration order for equal costs.
+    for (int l = 1; l < sweep->naxes; l++) {
+        int a = sweep->loop[l], k = l;
+        for (; k > 0 && sweep->axes[sweep->loop[k-1]].cost < sweep->axes[a].cost; k--)
+            sweep->loop[k] = sweep->loop[k-1];
+        sweep->loop[k] = a;
+    }
+}
+
+
+bool sweep_next(struct sweep *sweep) {
+    if (sweep->index < 0) {
+        for (int a = 0; a < sweep->naxes; a++) {
+            sweep->idx[a] = sweep->prev[a] = 0;
+            sweep->dir[a] = 1;
+        }
+        sweep->index = 0;
+        return true;
+    }
+    if (sweep->index + 1 >= sweep->npoints) {
+        sweep->index = sweep->npoints;
+        return false;
+    }
+    memcpy(sweep->prev, sweep->idx, sizeof(sweep->idx));
+    // Mixed radix counter, innermost loop first.  Snake order turns
+    // around at the ends instead of restarting, so only one axis
+    // changes by one step per point.
+    for (int l = sweep->naxes - 1; l >= 0; l--) {
+        int a = sweep->loop[l];
+        int n = sweep->axes[a].npoints;
+        int i = sweep->idx[a] + sweep->dir[a];
+        if (i >= 0 && i < n) {
+            sweep->idx[a] = i;
+            break;
+        }
+        if (sweep->snake)
+            sweep->dir[a] = -sweep->dir[a];
+        else
+            sweep->idx[a] = 0;
+    }
+    sweep->index++;
+    return true;
+}
+
+
+float sweep_value(const struct sweep *sweep, int axis) {
+    return sweep_axis_value(&sweep->axes[axis], sweep->idx[axis]);
+}
+
+float sweep_axis_value(const struct sweep_axis *a, int i) {
+    switch (a->scale) {
+    case SWEEP_LOG:
+        return log_scale_steps(i, a->npoints, a->start, a->end);
+    case SWEEP_LIST:
+        return a->values[i];
+    default:
+        return lin_scale_steps(i, a->npoints, a->start, a->end);
+    }
+}
+
+bool sweep_changed(const struct sweep *sweep, int axis) {
+    return sweep->index == 0 || sweep->idx[axis] != sweep->prev[axis];
+}
+
+long sweep_nested_index(const struct sweep *sweep) {
+    long index = 0;
+    for (int a = 0; a < sweep->naxes; a++)
+        index = index * sweep->axes[a].npoints + sweep->idx[a];
+    return index;
+}
@@ -0,0 +1,136 @@
+/**
+ * Sweep over the points of an N-dimensional parameter grid.
+ *
+ * Axes are declared from the command line arguments, then the points
+ * are visited with `sweep_next`:
+ *
+ *     struct sweep sweep;
+ *     sweep_init(&sweep);
+ *     sweep_axis(&sweep, "f", argv[1], SWEEP_LIN, 1);
+ *     sweep_axis(&sweep, "ch2delay", argv[2], SWEEP_LIN, 2000);
+ *     sweep_order(&sweep, SWEEP_GROUPED);
+ *     while (sweep_next(&sweep)) {
+ *         float f = sweep_value(&sweep, 0);
+ *         if (sweep_changed(&sweep, 1)) ...
+ *     }
+ *     sweep_free(&sweep);
+ *
+ * The order of the points is chosen independently of the order of
+ * declaration, e.g. to change expensive settings like arbitrary
+ * waveforms or the decimation as rarely as possible.  Every point
+ * carries its index along each axis (multi-index) to identify it in
+ * the output.
+ */
+
+#ifndef __SWEEP_H
+#define __SWEEP_H
+
+#include <stdbool.h>
+
+
+#define SWEEP_MAX_AXES 8
+
+
+enum sweep_scale {
+    SWEEP_LIN,   // START,NPOINTS,END linearly spaced
+    SWEEP_LOG,   // START,NPOINTS,END logarithmically spaced
+    SWEEP_LIST   // explicit values
+};
+
+enum sweep_order {
+    SWEEP_NESTED,   // first axis outermost, inner axes restart at their first value
+    SWEEP_SNAKE,    // like nested, but inner axes reverse direction instead of restarting
+    SWEEP_GROUPED   // snake with most expensive axes outermost
+};
+
+
+struct sweep_axis {
+    const char *name;
+    enum sweep_scale scale;
+    float start, end;
+    int npoints;
+    float *values;  // with SWEEP_LIST
+    float cost;     // relative cost of changing the value, e.g. in us
+};
+
+struct sweep {
+    struct sweep_axis axes[SWEEP_MAX_AXES];
+    int naxes;
+    long npoints;   // total number of points
+    long index;     // running index of the current point, -1 before the first
+
+    // Loop nesting, outermost first, and direction of each loop
+    int loop[SWEEP_MAX_AXES];
+    int dir[SWEEP_MAX_AXES];
+    bool snake;
+
+    int idx[SWEEP_MAX_AXES];   // multi-index of the current point
+    int prev[SWEEP_MAX_AXES];  // multi-index of the previous point
+};
+
+
+/**
+ * Initialize an empty sweep (a single point).
+ */
+void sweep_init(struct sweep *sweep);
+
+/**
+ * Free memory of list axes.
+ */
+void sweep_free(struct sweep *sweep);
+
+/**
+ * Add an axis parsed from a command line argument.  A single number
+ * is a fixed value, START,NPOINTS,END a range with the given `scale`
+ * (SWEEP_LIN or SWEEP_LOG) and the prefixes `lin:`, `log:` or `list:`
+ * override the scale, e.g. `log:1e3,31,1e6` or `list:1,2,5,10`.
+ * `cost` is the relative cost of changing the value for the ordering
+ * SWEEP_GROUPED.
+ *
+ * @return false on invalid argument or too many axes.
+ */
+bool sweep_axis(
+    struct sweep *sweep, const char *name, const char *arg,
+    enum sweep_scale scale, float cost);
+
+/**
+ * Parse the name of an order, `nested`, `snake` or `grouped`.
+ */
+bool sweep_parse_order(const char *arg, enum sweep_order *order);
+
+/**
+ * Choose the order of points.  Call after declaring all axes and
+ * before the first `sweep_next`, default is SWEEP_NESTED.
+ */
+void sweep_order(struct sweep *sweep, enum sweep_order order);
+
+/**
+ * Advance to the next point (the first point on the first call).
+ *
+ * @return false after the last point.
+ */
+bool sweep_next(struct sweep *sweep);
+
+/**
+ * Value of an axis at the current point.
+ */
+float sweep_value(const struct sweep *sweep, int axis);
+
+/**
+ * Value of an axis at index `i` along the axis.
+ */
+float sweep_axis_value(const struct sweep_axis *axis, int i);
+
+/**
+ * Value of an axis changed from the previous to the current point
+ * (always true at the first point).
+ */
+bool sweep_changed(const struct sweep *sweep, int axis);
+
+/**
+ * Index of the current point in nested order of declaration, like
+ * the running index of nested loops.
+ */
+long sweep_nested_index(const struct sweep *sweep);
+
+#endif // __SWEEP_H
@@ -13,6 +13,7 @@
 #include "rp.h"
 
 #include "demodulation.h"
+#include "utility.h"
 
 
 int main(int argc, char **argv){
@@ -67,12 +68,13 @@ int main(int argc, char **argv){
 
     // trigger and wait for full buffer
     rp_AcqSetTriggerSrc(RP_TRIG_SRC_NOW);
-    rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
-    while (1) {
-        rp_AcqGetTriggerState(&state);
-        if(state == RP_TRIG_STATE_TRIGGERED){
-            break;
-        }
+    struct trigger_wait trigger;
+    trigger_wait_init(&trigger, 1);
+    trigger.rearm = rearm_trigger_now;
+    trigger.retries = 3;
+    if (!wait_for_trigger(&trigger)) {
+        fprintf(stderr, "Acquisition not triggered!\n");
+        exit(3);
     }
     usleep(buffertime);
 
@@ -95,17 +97,14 @@ int main(int argc, char **argv){
 
     // Demodulate and print info to stderr
     float A, phase, offset, sd;
-    demodulate(buf1, bufsize1, freq, samplerate, &A, &phase, &offset);
-    sd = deviation_from_reconstruction(buf1, bufsize1, samplerate, freq, A, phase, offset);
+    demodulate_with_residual(buf1, bufsize1, freq, samplerate, &A, &phase, &offset, &sd);
     fprintf(stderr, "1: A = %f V,  phase = %f rad,  offset = %f V,  sd = %.2e (%.2f%%)\n", A, phase, offset, sd, 100*sd/A);
 
-    demodulate(buf2, bufsize2, freq, samplerate, &A, &phase, &offset);
-    sd = deviation_from_reconstruction(buf2, bufsize2, samplerate, freq, A, phase, offset);
+    demodulate_with_residual(buf2, bufsize2, freq, samplerate, &A, &phase, &offset, &sd);
     fprintf(stderr, "2: A = %f V,  phase = %f rad,  offset = %f V,  sd = %.2e (%.2f%%)  @ f = %.1e Hz\n",
             A, phase, offset, sd, 100*sd/A, freq);
 
-    demodulate(buf2, bufsize2, 2*freq, samplerate, &A, &phase, &offset);
-    sd = deviation_from_reconstruction(buf2, bufsize2, samplerate, 2*freq, A, phase, offset);
+    demodulate_with_residual(buf2, bufsize2, 2*freq, samplerate, &A, &phase, &offset, &sd);
     fprintf(stderr, "2: A = %f V,  phase = %f rad,  offset = %f V,  sd = %.2e (%.2f%%)  @ 2f = %.1e Hz\n",
             A, phase, offset, sd, 100*sd/A, 2*freq);
 
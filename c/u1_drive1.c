@@ -12,17 +12,49 @@
  * cmd line argument.  This trigger has an additional latency
  * of 0.2 to 0.3 microseconds.
  *
- * Usage: u1_drive1 FREQ AMPLITUDE PHASE CH2DELAY [CHNUMOFFSET]
+ * Usage: u1_drive1 [OPTIONS] FREQ AMPLITUDE PHASE CH2DELAY [CHNUMOFFSET]
  *
  * You may give ranges for any of the arguments by using
- * START,NPOINTS,END for e.g. FREQ.  CHNUMOFFSET is added to the
- * channel numbers to allow combining output from multiple Red
- * Pitayas.
+ * START,NPOINTS,END for e.g. FREQ, `log:START,NPOINTS,END` for log
+ * spacing or `list:V1,V2,...` for explicit values (see sweep.h).
+ * CHNUMOFFSET is added to the channel numbers to allow combining
+ * output from multiple Red Pitayas.
+ *
+ * Options:
+ *
+ *     --demod H1,H2,...  Demodulate on the Red Pitaya at the given
+ *                        harmonics of FREQ instead of printing buffers.
+ *     --keep N           With --demod, also print the full buffers of
+ *                        every Nth sweep point.
+ *     --average N        Trigger N times per sweep point and print only
+ *                        the mean buffers (or their demodulation).
+ *     --reject K         With --average, drop buffers that deviate from
+ *                        the running mean by more than K times the
+ *                        typical deviation (e.g. 5), default off.
+ *     --variance         With --average, print the variance of every
+ *                        sample after each buffer, with negative CH.
+ *     --order ORDER      Order of sweep points: `nested` (default, last
+ *                        argument innermost), `snake` (inner loops
+ *                        reverse instead of restarting) or `grouped`
+ *                        (snake, CH2 delay outermost because changing
+ *                        it needs a waveform upload).
+ *     --index            Prefix every line with the indices of FREQ,
+ *                        AMPLITUDE, PHASE and CH2DELAY in their ranges.
+ *     --dataset          Write the full buffers (and variances) to
+ *                        stdout as indexed binary dataset with int16
+ *                        samples (see dataset.h) instead of text.  Not
+ *                        with --demod.
  *
  * Output data format (tab separated) to stdout:
  *
  *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH SAMPLES...
  *
+ * With --demod, samples after the trigger are demodulated and for
+ * every harmonic H the amplitude A, phase PH (relative to trigger),
+ * DC offset and residual RES (see demodulation.h) are printed:
+ *
+ *     SAMPLERATE FREQ AMP PHASE CH2DELAY CH H1 A1 PH1 DC1 RES1 H2 A2 ...
+ *
  * Trigger position at sample 200
  *
  * Note: Default setting of digital IO pins is OUT, LOW.
@@ -32,40 +64,265 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <math.h>
 
 #include "rp.h"
 
+#include "average.h"
+#include "chain.h"
+#include "dataset.h"
 #include "demodulation.h"
+#include "generator.h"
+#include "pipeline.h"
+#include "sweep.h"
 #include "utility.h"
 
 
 #define RP_GEN_SAMPLERATE 125e6
+// Fixed wait for followers, timeout with ready bus (see chain.h)
 #define CHAIN_LEADER_DELAY_US 100000
+// Trigger timeout [s] and re-arms before giving up
+#define TRIGGER_TIMEOUT 1.0
+#define TRIGGER_RETRIES 3
+#define TRIGGER_SAMPLE 200
+// Rough cost of changing a sweep parameter
+#define COST_REGISTER_US 10
+#define COST_ARB_UPLOAD_US 2000
+
+
+// Sweep axes in order of the arguments.
+enum { AXIS_F, AXIS_AMP, AXIS_PHASE, AXIS_TTLCH2_DELAY, NAXES };
+
+// Output settings, shared with the writer thread.
+struct output_options {
+    int chnumoffset;
+    int harmonics[DEMOD_BANK_SIZE];
+    int nharmonics;
+    int keepevery;
+    int naverage;
+    bool printvariance;
+    struct average *average;
+    float *mean[2], *variance[2];    // results of average
+    bool printindex;
+    int npoints[NAXES];
+    struct dataset_writer *dataset;
+};
+
+// Metadata of pipeline items, META_AVERAGE is the index of the trigger
+// within the point.  The index of the point in nested order is passed
+// as item->point.
+enum { META_SAMPLERATE, META_F, META_AMP, META_PHASE, META_TTLCH2_DELAY, META_AVERAGE };
+
+
+/**
+ * Add buffers of one trigger to the average of its sweep point.
+ *
+ * @return true after the last trigger of the point.
+ */
+static bool accumulate(const struct output_options *opts, const struct pipeline_item *item) {
+    const int a = item->meta[META_AVERAGE];
+    struct average *avg = opts->average;
+    if (a == 0) average_reset(avg);
+    average_add(avg, item->buf1, item->size1, item->buf2, item->size2);
+    timing_mark(TIMING_ANALYSIS);
+    if (a < opts->naverage - 1) return false;
+    if (avg->rejected > 0)
+        fprintf(stderr, "Point %ld: %ld of %d buffers rejected.\n",
+                item->index, avg->rejected, opts->naverage);
+    return true;
+}
+
+
+/**
+ * Write buffer of channel `ch` (negative for variances) to the
+ * dataset.
+ */
+static void write_dataset(const struct output_options *opts, long point, const float *m,
+                          int ch, const float *buf, uint32_t size) {
+    const struct dataset_record meta = {
+        .ch = ch,
+        .samplerate = m[META_SAMPLERATE],
+        .freq = m[META_F],
+        .amp = m[META_AMP],
+        .phase = m[META_PHASE],
+        .ch2delay = m[META_TTLCH2_DELAY],
+    };
+    if (!dataset_write(opts->dataset, point, &meta, buf, size))
+        fprintf(stderr, "Writing dataset failed.\n");
+}
+
+
+/**
+ * Print data of one sweep point to stdout.  Runs on the writer thread
+ * of the pipeline while the next point is acquired.
+ */
+void write_point(const struct pipeline_item *item, void *ctx) {
+    const struct output_options *opts = (const struct output_options *)ctx;
+    const float *m = item->meta;
+    timing_point(item->index);
+    const float *bufs[2] = {item->buf1, item->buf2};
+    uint32_t sizes[2] = {item->size1, item->size2};
+    if (opts->naverage > 1) {
+        if (!accumulate(opts, item)) return;
+        for (int c = 0; c < 2; c++) {
+            sizes[c] = average_result(opts->average, c, opts->mean[c], opts->variance[c]);
+            bufs[c] = opts->mean[c];
+        }
+    }
+    bool fullbuffers = opts->nharmonics == 0
+        || (opts->keepevery > 0 && item->index % opts->keepevery == 0);
+    // Multi-index of the point from its index in nested order
+    int idx[NAXES];
+    long point = item->point;
+    for (int a = NAXES-1; a >= 0; a--) {
+        idx[a] = point % opts->npoints[a];
+        point /= opts->npoints[a];
+    }
+    for (int ch = 1; ch <= 2; ch++) {
+        const float *buf = bufs[ch-1];
+        uint32_t bufsize = sizes[ch-1];
+        if (fullbuffers && opts->dataset) {
+            write_dataset(opts, item->point, m, ch+opts->chnumoffset, buf, bufsize);
+            if (opts->printvariance)
+                write_dataset(opts, item->point, m, -(ch+opts->chnumoffset),
+                              opts->variance[ch-1], bufsize);
+            continue;
+        }
+        if (fullbuffers) {
+            if (opts->printindex)
+                printf("%d\t%d\t%d\t%d\t", idx[0], idx[1], idx[2], idx[3]);
+            printf("%f\t%f\t%f\t%f\t%f\t%d", m[META_SAMPLERATE], m[META_F], m[META_AMP],
+                   m[META_PHASE], m[META_TTLCH2_DELAY], ch+opts->chnumoffset);
+            for(uint32_t i = 0; i < bufsize; i++) {
+                printf("\t%f", buf[i]);
+            }
+            printf("\n");
+        }
+        if (fullbuffers && opts->printvariance) {
+            if (opts->printindex)
+                printf("%d\t%d\t%d\t%d\t", idx[0], idx[1], idx[2], idx[3]);
+            printf("%f\t%f\t%f\t%f\t%f\t%d", m[META_SAMPLERATE], m[META_F], m[META_AMP],
+                   m[META_PHASE], m[META_TTLCH2_DELAY], -(ch+opts->chnumoffset));
+            for(uint32_t i = 0; i < bufsize; i++) {
+                printf("\t%e", opts->variance[ch-1][i]);
+            }
+            printf("\n");
+        }
+        if (opts->nharmonics > 0 && bufsize > TRIGGER_SAMPLE) {
+            if (opts->printindex)
+                printf("%d\t%d\t%d\t%d\t", idx[0], idx[1], idx[2], idx[3]);
+            printf("%f\t%f\t%f\t%f\t%f\t%d", m[META_SAMPLERATE], m[META_F], m[META_AMP],
+                   m[META_PHASE], m[META_TTLCH2_DELAY], ch+opts->chnumoffset);
+            print_harmonics(buf + TRIGGER_SAMPLE, bufsize - TRIGGER_SAMPLE, m[META_F],
+                            m[META_SAMPLERATE], opts->harmonics, opts->nharmonics);
+            printf("\n");
+        }
+    }
+    timing_mark(TIMING_OUTPUT);
+    timing_done();
+}
 
 
 int main(int argc, char **argv) {
-    // Parse arguments
-    float f_start, f_end, amp_start, amp_end, phase_start, phase_end,
-        ttlCH2_start = 0, ttlCH2_end = 0;
-    int f_npoints, amp_npoints, phase_npoints, ttlCH2_npoints = 1;
-    int chnumoffset = 0;
+    // Parse options
+    struct output_options opts = {0};
+    opts.naverage = 1;
+    float reject = 0;
+    static const struct option options[] = {
+        {"demod", required_argument, NULL, 'd'},
+        {"keep", required_argument, NULL, 'k'},
+        {"average", required_argument, NULL, 'a'},
+        {"reject", required_argument, NULL, 'r'},
+        {"variance", no_argument, NULL, 'v'},
+        {"order", required_argument, NULL, 'o'},
+        {"index", no_argument, NULL, 'i'},
+        {"dataset", no_argument, NULL, 'D'},
+        {NULL, 0, NULL, 0}
+    };
+    enum sweep_order order = SWEEP_NESTED;
+    bool dataset = false;
+    int opt;
+    // "+": stop at first positional argument, which may be negative
+    while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            opts.nharmonics = parse_cmd_line_int_list(optarg, opts.harmonics, DEMOD_BANK_SIZE);
+            if (opts.nharmonics == 0) {
+                fprintf(stderr, "Invalid harmonics.\n");
+                exit(1);
+            }
+            break;
+        case 'k':
+            opts.keepevery = strtol(optarg, NULL, 10);
+            break;
+        case 'a':
+            opts.naverage = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            reject = strtof(optarg, NULL);
+            break;
+        case 'v':
+            opts.printvariance = true;
+            break;
+        case 'o':
+            if (!sweep_parse_order(optarg, &order)) {
+                fprintf(stderr, "Invalid order.\n");
+                exit(1);
+            }
+            break;
+        case 'i':
+            opts.printindex = true;
+            break;
+        case 'D':
+            dataset = true;
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (opts.naverage < 1 || (opts.printvariance && opts.naverage < 2)) {
+        fprintf(stderr, "Invalid --average.\n");
+        exit(1);
+    }
+    if (dataset && opts.nharmonics > 0) {
+        fprintf(stderr, "Invalid --dataset.\n");
+        exit(1);
+    }
+
+    // Parse arguments, a new CH2 delay costs a waveform upload.
+    struct sweep sweep;
+    sweep_init(&sweep);
     if (argc >= 5) {
-        if (!parse_cmd_line_range(argv[1], &f_start, &f_end, &f_npoints)
-            || !parse_cmd_line_range(argv[2], &amp_start, &amp_end, &amp_npoints)
-            || !parse_cmd_line_range(argv[3], &phase_start, &phase_end, &phase_npoints)
-            || !parse_cmd_line_range(argv[4], &ttlCH2_start, &ttlCH2_end, &ttlCH2_npoints)) {
+        if (!sweep_axis(&sweep, "f", argv[1], SWEEP_LIN, COST_REGISTER_US)
+            || !sweep_axis(&sweep, "amp", argv[2], SWEEP_LIN, COST_REGISTER_US)
+            || !sweep_axis(&sweep, "phase", argv[3], SWEEP_LIN, COST_REGISTER_US)
+            || !sweep_axis(&sweep, "ch2delay", argv[4], SWEEP_LIN, COST_ARB_UPLOAD_US)) {
             fprintf(stderr, "Invalid argument.\n");
             exit(1);
         }
+        for (int a = 0; a < NAXES; a++)
+            opts.npoints[a] = sweep.axes[a].npoints;
+        sweep_order(&sweep, order);
     }
     if (argc == 6) {
-        chnumoffset = strtol(argv[5], NULL, 10);
+        opts.chnumoffset = strtol(argv[5], NULL, 10);
     }
     if (argc < 5 || argc > 6) {
         fprintf(stderr, "Invalid number of arguments.\n");
         exit(1);
     }
+    if (dataset) {
+        opts.dataset = dataset_create(stdout, "u1_drive1", TRIGGER_SAMPLE);
+        if (opts.dataset == NULL || !dataset_add_sweep(opts.dataset, &sweep)) {
+            fprintf(stderr, "Dataset setup failed!\n");
+            exit(2);
+        }
+    }
+
+    timing_init();
 
     // Initialize IO.
     if (rp_Init() != RP_OK) {
@@ -83,11 +340,64 @@ int main(int argc, char **argv) {
     rp_DpinSetDirection(RP_DIO1_P, RP_OUT);
     rp_DpinSetState(RP_DIO0_N, RP_LOW);
     rp_DpinSetState(RP_DIO1_P, RP_LOW);
+    chain_init();
 
     float *trigwaveform = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    float ttl_delay = NAN;  // of the waveform in trigwaveform
+
+    // Generator settings, sweep parameters are filled in per point.
+    struct gen_cache generators = {0};
+    gen_cache_reset(&generators);
+    struct gen_config drive = {
+        .trigger = RP_GEN_TRIG_SRC_EXT_NE,
+        .waveform = RP_WAVEFORM_SINE,
+        .offset = 0,
+        .mode = RP_GEN_MODE_BURST,
+        .burst_count = -1,  // -1: continuous
+    };
+    struct gen_config ttl = {
+        .trigger = RP_GEN_TRIG_SRC_EXT_NE,
+        .waveform = RP_WAVEFORM_ARBITRARY,
+        .arb = trigwaveform,
+        .arb_length = ADC_BUFFER_SIZE,
+        .freq = RP_GEN_SAMPLERATE/ADC_BUFFER_SIZE,
+        .amp = 1,
+        .mode = RP_GEN_MODE_BURST,
+        .burst_count = 1,
+    };
 
-    uint32_t bufsize = ADC_BUFFER_SIZE;
-    float *buf = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+    // Leader re-fires a lost trigger, followers wait for the leader
+    // as long as it takes.
+    struct trigger_wait trigger;
+    trigger_wait_init(&trigger, TRIGGER_TIMEOUT);
+#ifdef FOLLOW
+    trigger.rearm = rearm_ext_trigger;
+    trigger.retries = -1;
+#else
+    trigger.rearm = refire_ext_trigger;
+    trigger.retries = TRIGGER_RETRIES;
+#endif
+
+    // Double buffered output: the next point is acquired while the
+    // writer thread prints the previous one.
+    struct pipeline *pipeline = pipeline_create(2, ADC_BUFFER_SIZE, write_point, &opts);
+    if (pipeline == NULL) {
+        fprintf(stderr, "Pipeline setup failed!\n");
+        exit(2);
+    }
+    struct average average;
+    if (opts.naverage > 1) {
+        if (!average_init(&average, ADC_BUFFER_SIZE, reject)) {
+            fprintf(stderr, "Average setup failed!\n");
+            exit(2);
+        }
+        opts.average = &average;
+        for (int c = 0; c < 2; c++) {
+            opts.mean[c] = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+            if (opts.printvariance)
+                opts.variance[c] = (float *)malloc(ADC_BUFFER_SIZE * sizeof(float));
+        }
+    }
 
     /* // print header
     printf("samplerate\tf\tamplitude\tphase\tch2delay\tch");
@@ -96,117 +406,115 @@ int main(int argc, char **argv) {
     }
     printf("\n"); */
 
-    int itotal = 0;
-    for (int f_i = 0; f_i < f_npoints; f_i++) {
-        float f = lin_scale_steps(f_i, f_npoints, f_start, f_end);
-        for (int amp_i = 0; amp_i < amp_npoints; amp_i++) {
-            float amp = lin_scale_steps(amp_i, amp_npoints, amp_start, amp_end);
-            for (int phase_i = 0; phase_i < phase_npoints; phase_i++) {
-                float phase = lin_scale_steps(phase_i, phase_npoints, phase_start, phase_end);
-                for (int ttlCH2_i = 0; ttlCH2_i < ttlCH2_npoints; ttlCH2_i++) {
-                    float ttlCH2_delay = lin_scale_steps(
-                        ttlCH2_i, ttlCH2_npoints, ttlCH2_start, ttlCH2_end);
-
-                    fprintf(stderr, "%3.0f%% %.2fkHz %.3fV %.1f° %.2fus\n",
-                            100.0*itotal/(f_npoints*amp_npoints*phase_npoints*ttlCH2_npoints-1),
-                            f/1e3, amp, phase, ttlCH2_delay*1e6);
-
-                    rp_DpinSetState(RP_DIO0_N, RP_HIGH);
-
-                    // Initialize driving outputs
-                    rp_GenReset();
-                    rp_GenTriggerSource(RP_CH_1, RP_GEN_TRIG_SRC_EXT_NE);
-                    rp_GenWaveform(RP_CH_1, RP_WAVEFORM_SINE);
-                    rp_GenFreq(RP_CH_1, f);
-                    rp_GenAmp(RP_CH_1, amp);
-                    rp_GenPhase(RP_CH_1, phase);
-                    rp_GenOffset(RP_CH_1, 0);
-                    rp_GenMode(RP_CH_1, RP_GEN_MODE_BURST);
-                    rp_GenBurstCount(RP_CH_1, -1); // -1: continuous
-
-                    // Initialize TTL line output
-                    ttl_arb_waveform(RP_GEN_SAMPLERATE, ttlCH2_delay, trigwaveform, ADC_BUFFER_SIZE);
-                    rp_GenTriggerSource(RP_CH_2, RP_GEN_TRIG_SRC_EXT_NE);
-                    rp_GenWaveform(RP_CH_2, RP_WAVEFORM_ARBITRARY);
-                    rp_GenArbWaveform(RP_CH_2, trigwaveform, ADC_BUFFER_SIZE);
-                    rp_GenFreq(RP_CH_2, RP_GEN_SAMPLERATE/ADC_BUFFER_SIZE);
-                    rp_GenAmp(RP_CH_2, 1);
-                    rp_GenMode(RP_CH_2, RP_GEN_MODE_BURST);
-                    rp_GenBurstCount(RP_CH_2, 1);
-                    // Enable output (first sample always high) before `usleep`
-                    // to let ringing dissipate.
-                    rp_GenOutEnable(RP_CH_2);
-
-                    // Setup both ADC channels
-                    rp_AcqReset();
-                    rp_AcqSetGain(RP_CH_1, RP_HIGH);
-                    rp_AcqSetGain(RP_CH_2, RP_HIGH);
-                    rp_AcqSetDecimation(RP_DEC_64);
-                    rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
-                    rp_AcqSetTriggerDelay(7992); // trigger at sample 200
-                    rp_AcqSetAveraging(1);
-                    rp_AcqStart();
-
-                    // Wait for "look ahead" buffer to fill up
-                    uint32_t buffertime = ADC_BUFFER_SIZE * 64 / 125; // us
-                    usleep(buffertime);
-
-                    // Fire trigger
-                    rp_GenOutEnable(RP_CH_1);
-#ifndef FOLLOW
-                    // Leader of a chain of Red Pitayas waits
-                    // so that others can catch up to here and are actually
-                    // also awaiting the next trigger signal.
-                    usleep(CHAIN_LEADER_DELAY_US);
-#endif
-                    rp_DpinSetState(RP_DIO0_N, RP_LOW);
-
-                    // Wait until acquisition trigger fired
-                    rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
-                    while (1) {
-                        rp_AcqGetTriggerState(&state);
-                        if(state == RP_TRIG_STATE_TRIGGERED){
-                            break;
-                        }
-                    }
-                    // Wait for delayed CH2 trigger
-                    usleep(ttlCH2_delay * 1e6);
-                    // Prevent CH2 trigger from returning to high
-                    rp_GenOutDisable(RP_CH_2);
-
-                    // Wait until ADC buffer is full
-                    usleep(buffertime);
-                    rp_GenOutDisable(RP_CH_1);
-
-                    // Retrieve data and print data to stdout
-                    float samplerate;
-                    rp_AcqGetSamplingRateHz(&samplerate);
-
-                    rp_AcqGetOldestDataV(RP_CH_1, &bufsize, buf);
-                    printf("%f\t%f\t%f\t%f\t%f\t%d", samplerate, f, amp, phase,
-                           ttlCH2_delay, 1+chnumoffset);
-                    for(uint32_t i = 0; i < bufsize; i++) {
-                        printf("\t%f", buf[i]);
-                    }
-                    printf("\n");
-                    
-                    rp_AcqGetOldestDataV(RP_CH_2, &bufsize, buf);
-                    printf("%f\t%f\t%f\t%f\t%f\t%d", samplerate, f, amp, phase,
-                           ttlCH2_delay, 2+chnumoffset);
-                    for(uint32_t i = 0; i < bufsize; i++) {
-                        printf("\t%f", buf[i]);
-                    }
-                    printf("\n");
-
-                    itotal ++;
-                }
+    // Exit status 3 if a trigger was lost, the points acquired so far
+    // are still written.
+    int status = 0;
+    while (status == 0 && sweep_next(&sweep)) {
+        float f = sweep_value(&sweep, AXIS_F);
+        float amp = sweep_value(&sweep, AXIS_AMP);
+        float phase = sweep_value(&sweep, AXIS_PHASE);
+        float ttlCH2_delay = sweep_value(&sweep, AXIS_TTLCH2_DELAY);
+
+        fprintf(stderr, "%3.0f%% %.2fkHz %.3fV %.1f° %.2fus\n",
+                100.0*sweep.index/(sweep.npoints-1),
+                f/1e3, amp, phase, ttlCH2_delay*1e6);
+        timing_point(sweep.index);
+
+        // Repeated triggers of one point are averaged by the writer
+        // thread.
+        for (int a = 0; a < opts.naverage; a++) {
+            rp_DpinSetState(RP_DIO0_N, RP_HIGH);
+
+            // Initialize driving outputs, only changed settings are written.
+            drive.freq = f;
+            drive.amp = amp;
+            drive.phase = phase;
+            gen_apply(&generators, RP_CH_1, &drive);
+
+            // Initialize TTL line output
+            if (ttlCH2_delay != ttl_delay) {
+                ttl_arb_waveform(RP_GEN_SAMPLERATE, ttlCH2_delay, trigwaveform, ADC_BUFFER_SIZE);
+                ttl_delay = ttlCH2_delay;
             }
+            gen_apply(&generators, RP_CH_2, &ttl);
+            // Enable output (first sample always high) before `usleep`
+            // to let ringing dissipate.
+            rp_GenOutEnable(RP_CH_2);
+
+            // Setup both ADC channels
+            rp_AcqReset();
+            rp_AcqSetGain(RP_CH_1, RP_HIGH);
+            rp_AcqSetGain(RP_CH_2, RP_HIGH);
+            rp_AcqSetDecimation(RP_DEC_64);
+            rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
+            rp_AcqSetTriggerDelay(7992); // trigger at sample 200
+            rp_AcqSetAveraging(1);
+            rp_AcqStart();
+
+            // Wait for "look ahead" buffer to fill up
+            uint32_t buffertime = ADC_BUFFER_SIZE * 64 / 125; // us
+            timing_mark(TIMING_CONFIGURE);
+            usleep(buffertime);
+            timing_mark(TIMING_LOOKAHEAD);
+
+            // Fire trigger
+            rp_GenOutEnable(RP_CH_1);
+            // Leader of a chain of Red Pitayas waits until the others
+            // are actually also awaiting the next trigger signal.
+            chain_ready(CHAIN_LEADER_DELAY_US);
+            rp_DpinSetState(RP_DIO0_N, RP_LOW);
+
+            // Wait until acquisition trigger fired
+            if (!wait_for_trigger(&trigger)) {
+                fprintf(stderr, "Trigger lost, stopping.\n");
+                status = 3;
+                break;
+            }
+            chain_busy();
+            timing_mark(TIMING_TRIGGER);
+            // Wait for delayed CH2 trigger
+            usleep(ttlCH2_delay * 1e6);
+            // Prevent CH2 trigger from returning to high
+            rp_GenOutDisable(RP_CH_2);
+
+            // Wait until ADC buffer is full
+            usleep(buffertime);
+            rp_GenOutDisable(RP_CH_1);
+            timing_mark(TIMING_FILL);
+
+            // Retrieve data and pass it to writer thread
+            struct pipeline_item *item = pipeline_next(pipeline);
+            item->index = sweep.index;
+            item->point = sweep_nested_index(&sweep);
+            item->meta[META_AVERAGE] = a;
+            rp_AcqGetSamplingRateHz(&item->meta[META_SAMPLERATE]);
+            item->meta[META_F] = f;
+            item->meta[META_AMP] = amp;
+            item->meta[META_PHASE] = phase;
+            item->meta[META_TTLCH2_DELAY] = ttlCH2_delay;
+            item->size1 = item->size2 = ADC_BUFFER_SIZE;
+            rp_AcqGetOldestDataV(RP_CH_1, &item->size1, item->buf1);
+            rp_AcqGetOldestDataV(RP_CH_2, &item->size2, item->buf2);
+            timing_mark(TIMING_READOUT);
+            pipeline_submit(pipeline, item);
         }
     }
 
+    pipeline_finish(pipeline);
+    if (opts.dataset && !dataset_finish(opts.dataset))
+        fprintf(stderr, "Writing dataset failed.\n");
+    timing_summary();
+    if (opts.naverage > 1) {
+        average_free(&average);
+        for (int c = 0; c < 2; c++) {
+            free(opts.mean[c]);
+            free(opts.variance[c]);
+        }
+    }
+    gen_cache_free(&generators);
     free(trigwaveform);
-    free(buf);
     rp_GenReset();
+    sweep_free(&sweep);
     rp_Release();
-    return 0;
+    return status;
 }
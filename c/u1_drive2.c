@@ -85,12 +85,13 @@ int main(int argc, char **argv) {
     // Fire trigger
     rp_DpinSetState(RP_DIO0_N, RP_LOW);
     // Wait until acquisition trigger fired
-    rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
-    while (1) {
-        rp_AcqGetTriggerState(&state);
-        if(state == RP_TRIG_STATE_TRIGGERED){
-            break;
-        }
+    struct trigger_wait trigger;
+    trigger_wait_init(&trigger, 1);
+    trigger.rearm = refire_ext_trigger;
+    trigger.retries = 3;
+    if (!wait_for_trigger(&trigger)) {
+        fprintf(stderr, "Trigger lost.\n");
+        exit(3);
     }
     usleep(buffertime);
 
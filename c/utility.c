@@ -1,9 +1,16 @@
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
 
+#include "demodulation.h"
 #include "utility.h"
 
 
@@ -50,42 +57,106 @@ rp_acq_decimation_t best_decimation_factor(float f, float *samplerate) {
 }
 
 
-void acquire_2channels(
-        const rp_acq_decimation_t decimation,
-        float *buf1, uint32_t *s1,
-        float *buf2, uint32_t *s2) {
+bool decimation_from_factor(long factor, rp_acq_decimation_t *decimation) {
+    static const long factors[] = {1, 8, 64, 1024, 8192, 65536};
+    static const rp_acq_decimation_t values[] = {
+        RP_DEC_1, RP_DEC_8, RP_DEC_64, RP_DEC_1024, RP_DEC_8192, RP_DEC_65536};
+    for (int i = 0; i < 6; i++) {
+        if (factors[i] == factor) {
+            *decimation = values[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Wait for a trigger with source NOW, exit the program if it does not
+ * fire.
+ */
+static void wait_for_trigger_now(void) {
+    static struct trigger_wait trigger;
+    static bool trigger_initialized = false;
+    if (!trigger_initialized) {
+        trigger_wait_init(&trigger, 1);
+        trigger.rearm = rearm_trigger_now;
+        trigger.retries = 3;
+        trigger_initialized = true;
+    }
+    if (!wait_for_trigger(&trigger)) {
+        fprintf(stderr, "Acquisition not triggered!\n");
+        exit(3);
+    }
+}
+
+/**
+ * Reset the acquisition and start writing both channels (high gain)
+ * to the ring buffer, with trigger disabled.
+ */
+static void start_2channels(const rp_acq_decimation_t decimation, int32_t delay) {
     // Resets trigger, but also defaults.
     rp_AcqReset();
 
     rp_AcqSetGain(RP_CH_1, RP_HIGH);
     rp_AcqSetGain(RP_CH_2, RP_HIGH);
     rp_AcqSetDecimation(decimation);
-    rp_AcqSetTriggerDelay(8192);
+    rp_AcqSetTriggerDelay(delay);
     rp_AcqSetAveraging(1);
     rp_AcqStart();
+}
+
+void acquire_2channels(
+        const rp_acq_decimation_t decimation,
+        float *buf1, uint32_t *s1,
+        float *buf2, uint32_t *s2) {
+    start_2channels(decimation, 8192);
 
     float samplerate;
     rp_AcqGetSamplingRateHz(&samplerate);
 
     // time frame of one buffer in us
     uint32_t buffertime = 1e6 * RP_BUFFER_SIZE / samplerate;
+    timing_mark(TIMING_CONFIGURE);
     // wait for "look ahead" buffer to fill up
     usleep(buffertime);
+    timing_mark(TIMING_LOOKAHEAD);
 
     // wait for trigger
     rp_AcqSetTriggerSrc(RP_TRIG_SRC_NOW);
-    rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
-    while (1) {
-        rp_AcqGetTriggerState(&state);
-        if(state == RP_TRIG_STATE_TRIGGERED){
-            break;
-        }
-    }
+    wait_for_trigger_now();
+    timing_mark(TIMING_TRIGGER);
     usleep(buffertime);
+    timing_mark(TIMING_FILL);
 
     // Retrieve data
     rp_AcqGetOldestDataV(RP_CH_1, s1, buf1);
     rp_AcqGetOldestDataV(RP_CH_2, s2, buf2);
+    timing_mark(TIMING_READOUT);
+}
+
+void acquire_2channels_now(
+        const rp_acq_decimation_t decimation, uint32_t n,
+        float *buf1, float *buf2) {
+    if (n > RP_BUFFER_SIZE) n = RP_BUFFER_SIZE;
+    rp_AcqSetGain(RP_CH_1, RP_HIGH);
+    rp_AcqSetGain(RP_CH_2, RP_HIGH);
+    rp_AcqSetDecimation(decimation);
+    // n samples after the trigger
+    rp_AcqSetTriggerDelay((int32_t)n - RP_BUFFER_SIZE/2);
+    rp_AcqSetAveraging(1);
+    rp_AcqStart();
+    rp_AcqSetTriggerSrc(RP_TRIG_SRC_NOW);
+    wait_for_trigger_now();
+
+    float samplerate;
+    rp_AcqGetSamplingRateHz(&samplerate);
+    usleep(1e6 * n / samplerate);
+
+    uint32_t pos, s1 = n, s2 = n;
+    rp_AcqGetWritePointerAtTrig(&pos);
+    rp_AcqGetDataV(RP_CH_1, pos, &s1, buf1);
+    rp_AcqGetDataV(RP_CH_2, pos, &s2, buf2);
 }
 
 
@@ -98,6 +169,58 @@ void ttl_arb_waveform(float samplerate, float delay, float *buf, uint32_t bufsiz
 }
 
 
+float multisine_arb_waveform(
+        const int *periods, int ntones,
+        float *buf, uint32_t bufsize) {
+    if (bufsize == 0 || ntones == 0) return 0;
+    memset(buf, 0, bufsize * sizeof(float));
+    // sin(2 pi k j / n + phi) from a table of one sine period
+    float *table = (float *)malloc(bufsize * sizeof(float));
+    if (table == NULL) return 0;
+    for (uint32_t j = 0; j < bufsize; j++)
+        table[j] = sin(2*M_PI*j / bufsize);
+    double sum = 0;
+    for (int i = 0; i < ntones; i++) {
+        // Schroeder phases for arbitrary tone spacing, like a chirp
+        // sweeping through the tones once per buffer
+        double phi = -2*M_PI * ((double)i * periods[i] - sum) / ntones;
+        sum += periods[i];
+        float c = cos(phi), s = sin(phi);
+        uint64_t k = periods[i];
+        for (uint32_t j = 0; j < bufsize; j++) {
+            uint64_t x = k * j;
+            buf[j] += c * table[x % bufsize] + s * table[(x + bufsize/4) % bufsize];
+        }
+    }
+    free(table);
+
+    float peak = 0;
+    for (uint32_t j = 0; j < bufsize; j++)
+        if (fabsf(buf[j]) > peak) peak = fabsf(buf[j]);
+    for (uint32_t j = 0; j < bufsize; j++)
+        buf[j] /= peak;
+    return 1 / peak;
+}
+
+
+void chirp_arb_waveform(
+        float k0, float k1, bool logarithmic,
+        float *buf, uint32_t bufsize) {
+    // Phase in periods at t = j / bufsize in [0, 1)
+    const double r = k1 / k0;
+    const bool lin = !logarithmic || fabs(r - 1) < 1e-6;
+    const double total = lin ? (k0 + k1) / 2 : k0 * (r - 1) / log(r);
+    // Stretch to whole periods, continuous when repeated
+    const double stretch = fmax(round(total), 1) / total;
+    for (uint32_t j = 0; j < bufsize; j++) {
+        double t = (double)j / bufsize;
+        double x = lin ? k0*t + (k1-k0)*t*t/2 : k0 * (pow(r, t) - 1) / log(r);
+        x *= stretch;
+        buf[j] = sin(2*M_PI * (x - floor(x)));
+    }
+}
+
+
 bool parse_cmd_line_range(const char *arg, float *start, float *end, int *npoints) {
     char *part2, *part3, *part4;
     *start = strtof(arg, &part2);
@@ -113,3 +236,458 @@ bool parse_cmd_line_range(const char *arg, float *start, float *end, int *npoint
     if (*part4 != '\0') return false;
     return true;
 }
+
+
+int parse_cmd_line_int_list(const char *arg, int *values, int maxn) {
+    int n = 0;
+    char *end;
+    while (n < maxn) {
+        values[n] = strtol(arg, &end, 10);
+        if (end == arg || values[n] <= 0) return 0;
+        n++;
+        if (*end == '\0') return n;
+        if (*end != ',') return 0;
+        arg = end + 1;
+    }
+    return 0;
+}
+
+
+void print_harmonics(
+        const float *signal, const size_t n, const float f, const float samplerate,
+        const int *harmonics, const int nharmonics) {
+    // Preceding output of the caller
+    timing_mark(TIMING_OUTPUT);
+    float A[nharmonics], phi[nharmonics], offset[nharmonics], residual[nharmonics];
+    demodulate_harmonics_with_residual(
+        signal, n, f, harmonics, nharmonics, samplerate, A, phi, offset, residual);
+    timing_mark(TIMING_ANALYSIS);
+    for (int k = 0; k < nharmonics; k++) {
+        printf("\t%d\t%e\t%e\t%e\t%e",
+               harmonics[k], A[k], phi[k], offset[k], residual[k]);
+    }
+}
+
+
+// Number of log2 histogram bins, the last one ends at ~67s.
+#define TIMING_NBINS 26
+// Points that may be timed at the same time (by different threads).
+#define TIMING_NPENDING 8
+
+static const char *timing_names[TIMING_NPHASES] = {
+    "configure", "settle", "lookahead", "trigger",
+    "fill", "readout", "analysis", "output"
+};
+
+struct timing_record {
+    long index;
+    double duration[TIMING_NPHASES];
+    unsigned long polls;
+};
+
+static struct {
+    FILE *file;
+    pthread_mutex_t lock;
+    struct timing_record pending[TIMING_NPENDING];
+    double tstart, tlast;
+    long npoints;
+    double sum[TIMING_NPHASES], min[TIMING_NPHASES], max[TIMING_NPHASES];
+    unsigned long polls;
+    unsigned long histogram[TIMING_NPHASES][TIMING_NBINS];
+} timing = {.file = NULL, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Current point and time of last mark in this thread.
+static __thread long timing_index = -1;
+static __thread double timing_last;
+
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static struct timing_record *timing_record(long index) {
+    struct timing_record *r = &timing.pending[index % TIMING_NPENDING];
+    if (r->index != index) {
+        memset(r, 0, sizeof(*r));
+        r->index = index;
+    }
+    return r;
+}
+
+void timing_init(void) {
+    const char *dest = getenv("RP_TIMING");
+    if (dest == NULL || *dest == '\0') return;
+    timing.file = strcmp(dest, "-") == 0 ? stderr : fopen(dest, "w");
+    if (timing.file == NULL) {
+        perror("RP_TIMING");
+        return;
+    }
+    for (int i = 0; i < TIMING_NPENDING; i++)
+        timing.pending[i].index = -1;
+    for (int p = 0; p < TIMING_NPHASES; p++)
+        timing.min[p] = INFINITY;
+    fprintf(timing.file, "# timing\tindex");
+    for (int p = 0; p < TIMING_NPHASES; p++)
+        fprintf(timing.file, "\t%s", timing_names[p]);
+    fprintf(timing.file, "\tpolls\t[us]\n");
+    timing.tstart = timing.tlast = monotonic_seconds();
+}
+
+void timing_point(long index) {
+    if (timing.file == NULL) return;
+    timing_index = index;
+    timing_last = monotonic_seconds();
+}
+
+void timing_mark(enum timing_phase phase) {
+    if (timing.file == NULL || timing_index < 0) return;
+    double now = monotonic_seconds();
+    pthread_mutex_lock(&timing.lock);
+    timing_record(timing_index)->duration[phase] += now - timing_last;
+    pthread_mutex_unlock(&timing.lock);
+    timing_last = now;
+}
+
+void timing_done(void) {
+    if (timing.file == NULL || timing_index < 0) return;
+    pthread_mutex_lock(&timing.lock);
+    struct timing_record *r = timing_record(timing_index);
+    fprintf(timing.file, "timing\t%ld", r->index);
+    for (int p = 0; p < TIMING_NPHASES; p++) {
+        double us = 1e6 * r->duration[p];
+        fprintf(timing.file, "\t%.0f", us);
+        timing.sum[p] += r->duration[p];
+        if (r->duration[p] < timing.min[p]) timing.min[p] = r->duration[p];
+        if (r->duration[p] > timing.max[p]) timing.max[p] = r->duration[p];
+        int bin = us < 1 ? 0 : (int)log2(us);
+        timing.histogram[p][bin < TIMING_NBINS ? bin : TIMING_NBINS-1]++;
+    }
+    fprintf(timing.file, "\t%lu\n", r->polls);
+    timing.polls += r->polls;
+    timing.npoints++;
+    timing.tlast = monotonic_seconds();
+    r->index = -1;
+    pthread_mutex_unlock(&timing.lock);
+    timing_index = -1;
+}
+
+void timing_summary(void) {
+    if (timing.file == NULL || timing.npoints == 0) return;
+    pthread_mutex_lock(&timing.lock);
+    double wall = timing.tlast - timing.tstart;
+    FILE *f = timing.file;
+    fprintf(f, "# %ld points, %.3f ms wall time per point, %.1f trigger polls per point\n",
+            timing.npoints, 1e3 * wall / timing.npoints,
+            (double)timing.polls / timing.npoints);
+    fprintf(f, "# phase\tmean[us]\tmin[us]\tmax[us]\tshare\n");
+    for (int p = 0; p < TIMING_NPHASES; p++) {
+        fprintf(f, "# %s\t%.0f\t%.0f\t%.0f\t%.1f%%\n", timing_names[p],
+                1e6 * timing.sum[p] / timing.npoints, 1e6 * timing.min[p],
+                1e6 * timing.max[p], 100 * timing.sum[p] / wall);
+    }
+    // Histogram columns from shortest to longest non-empty bin
+    int first = TIMING_NBINS, last = 0;
+    for (int p = 0; p < TIMING_NPHASES; p++) {
+        for (int b = 0; b < TIMING_NBINS; b++) {
+            if (timing.histogram[p][b] == 0) continue;
+            if (b < first) first = b;
+            if (b > last) last = b;
+        }
+    }
+    fprintf(f, "# histogram [us]");
+    for (int b = first; b <= last; b++)
+        fprintf(f, "\t<%lu", 2ul << b);
+    fprintf(f, "\n");
+    for (int p = 0; p < TIMING_NPHASES; p++) {
+        fprintf(f, "# %s", timing_names[p]);
+        for (int b = first; b <= last; b++)
+            fprintf(f, "\t%lu", timing.histogram[p][b]);
+        fprintf(f, "\n");
+    }
+    fflush(f);
+    pthread_mutex_unlock(&timing.lock);
+}
+
+
+/** Count trigger polls in the timing record of the current point. */
+static void timing_polls(unsigned long polls) {
+    if (timing.file == NULL || timing_index < 0) return;
+    pthread_mutex_lock(&timing.lock);
+    timing_record(timing_index)->polls += polls;
+    pthread_mutex_unlock(&timing.lock);
+}
+
+
+// Polls without sleeping before backing off
+#define TRIGGER_SPIN_POLLS 20
+#define TRIGGER_MIN_SLEEP_US 10
+#define TRIGGER_MAX_SLEEP_US 1000
+// Longest sleep on the interrupt fd before polling the state again
+#define TRIGGER_FD_MAX_MS 100
+
+void trigger_wait_init(struct trigger_wait *w, double timeout) {
+    memset(w, 0, sizeof(*w));
+    w->timeout = timeout;
+    w->fd = -1;
+    w->maxsleep = TRIGGER_MAX_SLEEP_US;
+    const char *dev = getenv("RP_TRIGGER_UIO");
+    if (dev == NULL || *dev == '\0') return;
+    w->fd = open(dev, O_RDWR);
+    if (w->fd < 0) perror("RP_TRIGGER_UIO");
+}
+
+/**
+ * Sleep until the interrupt fd is readable or `ms` passed.  Falls
+ * back to polling on errors.
+ */
+static void trigger_wait_fd(struct trigger_wait *w, int ms) {
+    // UIO: writing 1 (re-)enables the interrupt, reading returns the
+    // interrupt count.
+    uint32_t value = 1;
+    if (write(w->fd, &value, sizeof(value)) != sizeof(value)) {
+        perror("RP_TRIGGER_UIO");
+        close(w->fd);
+        w->fd = -1;
+        return;
+    }
+    struct pollfd p = {.fd = w->fd, .events = POLLIN};
+    int ready = poll(&p, 1, ms);
+    if (ready > 0 && read(w->fd, &value, sizeof(value)) == sizeof(value))
+        return;
+    if (ready < 0) {
+        perror("RP_TRIGGER_UIO");
+        close(w->fd);
+        w->fd = -1;
+    }
+}
+
+bool wait_for_trigger(struct trigger_wait *w) {
+    double start = monotonic_seconds(), attempt = start;
+    useconds_t sleep = 0;
+    rp_acq_trig_state_t state = RP_TRIG_STATE_WAITING;
+    w->polls = 0;
+    w->rearms = 0;
+    while (true) {
+        rp_AcqGetTriggerState(&state);
+        w->polls++;
+        double now = monotonic_seconds();
+        if (state == RP_TRIG_STATE_TRIGGERED) break;
+
+        if (w->timeout > 0 && now - attempt > w->timeout) {
+            if (w->rearm == NULL || w->rearms == w->retries) break;
+            w->rearms++;
+            fprintf(stderr, "Trigger timeout after %.3fs, re-arming (%d).\n",
+                    now - attempt, w->rearms);
+            w->rearm(w->ctx);
+            attempt = monotonic_seconds();
+            sleep = 0;
+            continue;
+        }
+
+        if (w->fd >= 0) {
+            double left = w->timeout > 0 ? w->timeout - (now - attempt) : INFINITY;
+            trigger_wait_fd(w, fmin(1e3 * left + 1, TRIGGER_FD_MAX_MS));
+        } else if (w->polls > TRIGGER_SPIN_POLLS) {
+            // Back off, but not beyond a quarter of the time waited.
+            sleep = (sleep == 0) ? TRIGGER_MIN_SLEEP_US : 2 * sleep;
+            if (sleep > w->maxsleep) sleep = w->maxsleep;
+            if (sleep > 0.25e6 * (now - start))
+                sleep = fmax(TRIGGER_MIN_SLEEP_US, 0.25e6 * (now - start));
+            usleep(sleep);
+        }
+    }
+    w->elapsed = monotonic_seconds() - start;
+    timing_polls(w->polls);
+    return state == RP_TRIG_STATE_TRIGGERED;
+}
+
+void rearm_trigger_now(void *ctx) {
+    rp_AcqSetTriggerSrc(RP_TRIG_SRC_NOW);
+}
+
+void rearm_ext_trigger(void *ctx) {
+    rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
+}
+
+void refire_ext_trigger(void *ctx) {
+    rp_AcqSetTriggerSrc(RP_TRIG_SRC_EXT_NE);
+    rp_DpinSetState(RP_DIO0_N, RP_HIGH);
+    rp_DpinSetState(RP_DIO0_N, RP_LOW);
+}
+
+
+// Reads of the write pointer for `acquisition_trigger_time`
+#define TRIGGER_TIME_READS 3
+
+double acquisition_trigger_time(float samplerate, uint32_t *written) {
+    // Keep the read taking the shortest time, e.g. not preempted.
+    double best = INFINITY, time = 0;
+    for (int i = 0; i < TRIGGER_TIME_READS; i++) {
+        uint32_t trig, pos;
+        double t0 = monotonic_seconds();
+        rp_AcqGetWritePointerAtTrig(&trig);
+        rp_AcqGetWritePointer(&pos);
+        double t1 = monotonic_seconds();
+        if (t1 - t0 < best) {
+            best = t1 - t0;
+            *written = (pos - trig) & (RP_BUFFER_SIZE - 1);
+            time = 0.5 * (t0 + t1) - *written / samplerate;
+        }
+    }
+    return time;
+}
+
+
+// Polling interval of a stream waiting for samples, at most
+#define STREAM_MAX_SLEEP (RP_BUFFER_SIZE / 4)
+// Smallest chunk worth reading before the requested samples are there
+#define STREAM_MIN_CHUNK (RP_BUFFER_SIZE / 8)
+
+bool stream_start(
+        struct stream *s, rp_acq_decimation_t decimation, bool raw,
+        rp_acq_trig_src_t source, uint32_t pretrigger, uint64_t length) {
+    memset(s, 0, sizeof(*s));
+    s->raw = raw;
+    if (raw) {
+        s->rawbuf = (int16_t *)malloc(RP_BUFFER_SIZE * sizeof(int16_t));
+        if (s->rawbuf == NULL) return false;
+    }
+
+    if (source == RP_TRIG_SRC_DISABLED) pretrigger = 0;
+    uint64_t post = length > pretrigger ? length - pretrigger : 0;
+    // Writing stops `delay` samples after the middle of the buffer.
+    int64_t delay = (length == 0 || post > INT32_MAX) ? INT32_MAX
+        : (int64_t)post - RP_BUFFER_SIZE/2;
+    start_2channels(decimation, delay);
+    rp_AcqGetSamplingRateHz(&s->samplerate);
+    s->end = length > 0 ? length : UINT64_MAX;
+
+    if (source == RP_TRIG_SRC_DISABLED) {
+        rp_AcqGetWritePointer(&s->pointer);
+        s->twritten = monotonic_seconds();
+        return true;
+    }
+    s->next = pretrigger;  // until the trigger is known
+    usleep(1e6 * pretrigger / s->samplerate);
+    rp_AcqSetTriggerSrc(source);
+    return true;
+}
+
+bool stream_wait_trigger(struct stream *s, struct trigger_wait *w) {
+    if (!wait_for_trigger(w)) return false;
+    uint32_t trig;
+    rp_AcqGetWritePointerAtTrig(&trig);
+    rp_AcqGetWritePointer(&s->pointer);
+    s->twritten = monotonic_seconds();
+    s->written = s->next + ((s->pointer - trig) & (RP_BUFFER_SIZE - 1));
+    s->next = 0;
+    return true;
+}
+
+/** Samples possibly written since the write pointer was read. */
+static double stream_elapsed(const struct stream *s, double t) {
+    return fmin((t - s->twritten) * s->samplerate, s->end - s->written);
+}
+
+/**
+ * Skip to the write pointer after an overrun, which is near the
+ * elapsed samples plus multiples of the buffer size.
+ */
+static void stream_overrun(struct stream *s, uint32_t d, double elapsed) {
+    double wraps = round((elapsed - d) / RP_BUFFER_SIZE);
+    s->written += d + (wraps > 0 ? (uint64_t)wraps * RP_BUFFER_SIZE : 0);
+    if (s->written > s->end) s->written = s->end;
+    s->lost += s->written - s->next;
+    s->next = s->written;
+    s->overruns++;
+}
+
+/**
+ * Read the write pointer.  `overrun` forces an overrun, e.g. if the
+ * last samples read were overwritten meanwhile.
+ *
+ * @return false on overrun.
+ */
+static bool stream_poll(struct stream *s, bool overrun) {
+    // The pointer is read between t and tread.
+    uint32_t pointer;
+    double t = monotonic_seconds();
+    rp_AcqGetWritePointer(&pointer);
+    double tread = monotonic_seconds();
+    uint32_t d = (pointer - s->pointer) & (RP_BUFFER_SIZE - 1);
+    double elapsed = stream_elapsed(s, t);
+    bool overwritten = s->written + stream_elapsed(s, tread)
+        > s->next + RP_BUFFER_SIZE - STREAM_GUARD;
+    s->pointer = pointer;
+    s->twritten = t;
+    if (overrun || overwritten) {
+        stream_overrun(s, d, elapsed);
+        return false;
+    }
+    s->written += d;
+    if (s->written > s->end) s->written = s->end;
+    return true;
+}
+
+/**
+ * Read `n` samples from `next` on.
+ *
+ * @return false if they may have been overwritten while reading.
+ */
+static bool stream_read(struct stream *s, float *buf1, float *buf2, uint32_t n) {
+    uint32_t pos = (s->pointer - (uint32_t)(s->written - s->next)) & (RP_BUFFER_SIZE - 1);
+    float *bufs[2] = {buf1, buf2};
+    rp_channel_t channels[2] = {RP_CH_1, RP_CH_2};
+    for (int c = 0; c < 2; c++) {
+        uint32_t size = n;
+        if (s->raw) {
+            rp_AcqGetDataRaw(channels[c], pos, &size, s->rawbuf);
+            for (uint32_t i = 0; i < n; i++)
+                bufs[c][i] = s->rawbuf[i];
+        } else {
+            rp_AcqGetDataV(channels[c], pos, &size, bufs[c]);
+        }
+    }
+    double elapsed = stream_elapsed(s, monotonic_seconds());
+    return s->written + elapsed <= s->next + RP_BUFFER_SIZE - STREAM_GUARD;
+}
+
+uint32_t stream_fill(struct stream *s, float *buf1, float *buf2, uint32_t n) {
+    uint32_t got = 0;
+    while (got < n && s->next < s->end) {
+        if (!stream_poll(s, false)) {
+            if (got > 0) break;
+            continue;
+        }
+        uint64_t avail = s->written - s->next;
+        uint32_t want = n - got;
+        uint32_t chunk = want < STREAM_MIN_CHUNK ? want : STREAM_MIN_CHUNK;
+        if (avail < chunk && s->written < s->end) {
+            uint32_t missing = chunk - avail;
+            usleep(1e6 * (missing < STREAM_MAX_SLEEP ? missing : STREAM_MAX_SLEEP)
+                   / s->samplerate);
+            continue;
+        }
+        uint32_t m = avail < want ? avail : want;
+        if (!stream_read(s, buf1 + got, buf2 + got, m)) {
+            stream_poll(s, true);
+            if (got > 0) break;
+            continue;
+        }
+        if (got == 0) {
+            s->first = s->next;
+            s->gap = s->next - s->expected;
+        }
+        s->next += m;
+        s->expected = s->next;
+        got += m;
+    }
+    return got;
+}
+
+void stream_stop(struct stream *s) {
+    rp_AcqStop();
+    free(s->rawbuf);
+    s->rawbuf = NULL;
+}
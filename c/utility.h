@@ -3,6 +3,7 @@
 #define __UTILITY_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "rp.h"
 
@@ -32,10 +33,19 @@ float lin_scale_steps(int i, int iend, float vmin, float vmax);
  */
 rp_acq_decimation_t best_decimation_factor(float f, float *samplerate);
 
+/**
+ * Hardware decimation for a decimation factor 1, 8, 64, 1024, 8192
+ * or 65536.
+ *
+ * @return false for other factors.
+ */
+bool decimation_from_factor(long factor, rp_acq_decimation_t *decimation);
+
 
 /**
  * Acquire complete buffer of both channels.  Triggered immediately
- * after fast input setup (trigger at beginning of buffer).
+ * after fast input setup (trigger at beginning of buffer).  Exits
+ * the program if the trigger does not fire.
  */
 void acquire_2channels(
         const rp_acq_decimation_t decimation,
@@ -43,6 +53,26 @@ void acquire_2channels(
         float *buf2, uint32_t *s2);
 
 
+/**
+ * Acquire only `n` samples of both channels, triggered immediately,
+ * e.g. for quick checks between full acquisitions.  The fast input
+ * setup of `acquire_2channels` is kept.
+ */
+void acquire_2channels_now(
+        const rp_acq_decimation_t decimation, uint32_t n,
+        float *buf1, float *buf2);
+
+
+/**
+ * Wall clock time [s] (CLOCK_MONOTONIC) of the last acquisition
+ * trigger, from the samples written since then, and these samples in
+ * `written`.  Valid within one buffer time after the trigger, and
+ * only while the acquisition is still running (later for a stopped
+ * acquisition).
+ */
+double acquisition_trigger_time(float samplerate, uint32_t *written);
+
+
 /**
  * Write step function to buffer: 1 before delay time, 0 after.
  * First sample guaranteed to be 1.
@@ -52,6 +82,29 @@ void ttl_arb_waveform(
     float *buf, uint32_t bufsize);
 
 
+/**
+ * Write a multisine to buffer: `ntones` sines with `periods[i]`
+ * periods per buffer (ascending), equal amplitudes and Schroeder
+ * phases for a low crest factor.  Scaled to peak 1.
+ *
+ * @return Amplitude of each tone in the scaled waveform.
+ */
+float multisine_arb_waveform(
+    const int *periods, int ntones,
+    float *buf, uint32_t bufsize);
+
+
+/**
+ * Write one period of a chirp with amplitude 1 to buffer.  The
+ * frequency sweeps from `k0` to `k1` periods per buffer, linearly or
+ * logarithmically, stretched slightly to a whole number of periods
+ * such that the waveform is continuous when repeated.
+ */
+void chirp_arb_waveform(
+    float k0, float k1, bool logarithmic,
+    float *buf, uint32_t bufsize);
+
+
 /**
  * Parse cmd line argument for ranges. A range may be given by a
  * single number (start and end a the same, npoints is 1), or three
@@ -60,4 +113,233 @@ void ttl_arb_waveform(
  */
 bool parse_cmd_line_range(const char *arg, float *start, float *end, int *npoints);
 
+
+/**
+ * Parse cmd line argument for a comma separated list of at most
+ * `maxn` positive integers, e.g. harmonic numbers like "1,2,3".
+ *
+ * @return Number of parsed values, 0 on invalid input.
+ */
+int parse_cmd_line_int_list(const char *arg, int *values, int maxn);
+
+
+/**
+ * Demodulate signal at harmonics of `f` and print columns
+ *
+ *     \tHARMONIC\tAMPLITUDE\tPHASE\tDC\tRESIDUAL
+ *
+ * for each harmonic to stdout (without newline).
+ */
+void print_harmonics(
+    const float *signal, const size_t n, const float f, const float samplerate,
+    const int *harmonics, const int nharmonics);
+
+
+
+/**
+ * Wall clock time [s] from CLOCK_MONOTONIC, for durations and
+ * deadlines.
+ */
+double monotonic_seconds(void);
+
+
+/**
+ * Phases of one sweep point for timing instrumentation.
+ */
+enum timing_phase {
+    TIMING_CONFIGURE,  // generator and acquisition setup
+    TIMING_SETTLE,     // waiting for the DUT to settle
+    TIMING_LOOKAHEAD,  // filling the pre-trigger part of the buffer
+    TIMING_TRIGGER,    // chain leader delay and waiting for trigger
+    TIMING_FILL,       // filling the buffer after the trigger
+    TIMING_READOUT,    // copying buffers (and waiting for a free slot)
+    TIMING_ANALYSIS,   // demodulation
+    TIMING_OUTPUT,     // formatting and writing to stdout
+    TIMING_NPHASES
+};
+
+/**
+ * Enable timing instrumentation if the environment variable
+ * RP_TIMING is set: to `-` for records on stderr or to a file name
+ * for a sidecar file.  Otherwise all timing functions return
+ * immediately.
+ *
+ * Per sweep point one record with the duration of every phase in
+ * microseconds and the number of trigger state polls (see
+ * `wait_for_trigger()`) is written:
+ *
+ *     timing INDEX CONFIGURE SETTLE LOOKAHEAD TRIGGER FILL READOUT ANALYSIS OUTPUT POLLS
+ */
+void timing_init(void);
+
+/**
+ * Start (or continue) timing of sweep point `index` in the calling
+ * thread.  Phases of one point may be timed in different threads,
+ * e.g. acquisition and output of a pipeline.
+ */
+void timing_point(long index);
+
+/**
+ * End phase `phase` of the current point of the calling thread.  It
+ * lasted since the previous mark or `timing_point()` in this thread.
+ */
+void timing_mark(enum timing_phase phase);
+
+/**
+ * Complete the current point of the calling thread and write its
+ * record.
+ */
+void timing_done(void);
+
+/**
+ * Write mean, min, max, share of wall time and a histogram (log2
+ * bins in microseconds) of all phases.
+ */
+void timing_summary(void);
+
+
+
+/**
+ * Settings and results of `wait_for_trigger()`, set up with
+ * `trigger_wait_init()`.
+ */
+struct trigger_wait {
+    // Timeout of one attempt [s], <= 0 to wait forever.
+    double timeout;
+    // Number of re-arms after a timeout, < 0 for unlimited.
+    int retries;
+    // Re-arm (and possibly fire) the trigger, NULL to give up on
+    // timeout.
+    void (*rearm)(void *ctx);
+    void *ctx;
+    // File descriptor becoming readable on trigger (UIO interrupt),
+    // -1 to poll only.
+    int fd;
+    // Longest backoff sleep [us], 1000 by default.
+    unsigned maxsleep;
+
+    // Results of the last wait
+    double elapsed;  // [s]
+    unsigned long polls;
+    int rearms;
+};
+
+/**
+ * Initialize trigger wait with given timeout [s] and no re-arming.
+ * If the environment variable RP_TRIGGER_UIO names a UIO device of
+ * an FPGA image with acquisition trigger interrupt, it is opened and
+ * used to sleep until the trigger.
+ */
+void trigger_wait_init(struct trigger_wait *w, double timeout);
+
+/**
+ * Wait until the acquisition trigger fired.
+ *
+ * Polls rp_AcqGetTriggerState() without sleeping for a few
+ * microseconds, then backs off with sleeps doubling from 10us up to
+ * `maxsleep`, but at most a quarter of the time already waited.  Short
+ * waits thus stay responsive while long waits (chain followers) leave
+ * the CPU to the writer thread.  With `fd` set, sleeps on the
+ * interrupt instead.
+ *
+ * After a timeout `rearm` is called and the wait starts over, up to
+ * `retries` times.
+ *
+ * @return true if triggered, false if all attempts timed out.
+ */
+bool wait_for_trigger(struct trigger_wait *w);
+
+/**
+ * Re-arm functions for `struct trigger_wait`: trigger immediately,
+ * wait for the next external trigger (negative edge), or wait for
+ * and fire the external trigger on DIO0_N as chain leader.
+ */
+void rearm_trigger_now(void *ctx);
+void rearm_ext_trigger(void *ctx);
+void refire_ext_trigger(void *ctx);
+
+
+/**
+ * Continuous acquisition of both channels, read from the ADC ring
+ * buffer while it is being written, for records much longer than one
+ * buffer.  Set up with `stream_start()`, read with `stream_fill()`.
+ *
+ * Samples are indexed from the first sample of the stream.  The write
+ * pointer only tells the position within the buffer, so the number of
+ * samples written since the last read is also estimated from the wall
+ * clock.  If the unread samples may have been overwritten (less than
+ * STREAM_GUARD samples of headroom), that is an overrun: the stream
+ * continues at the current write pointer and the lost samples are
+ * counted.  Blocks returned by `stream_fill()` never contain a gap.
+ *
+ * Samples have to be read at least as fast as they are written, e.g.
+ * up to about 2Msps (RP_DEC_64) for both channels on Red Pitaya.
+ */
+struct stream {
+    float samplerate;
+    bool raw;               // ADC counts instead of volts
+    int16_t *rawbuf;
+    uint64_t next;          // index of next sample to read
+    uint64_t written;       // index after the newest sample written
+    uint64_t end;           // index after the last sample of the record
+    uint32_t pointer;       // write pointer at `written`
+    double twritten;        // time the write pointer was read [s]
+    uint64_t expected;      // index after the last sample returned
+
+    // Results
+    uint64_t first;         // index of first sample of last block
+    uint64_t gap;           // samples lost right before the last block
+    unsigned long overruns;
+    uint64_t lost;          // all samples lost in overruns
+};
+
+// Headroom in the ring buffer [samples] below which the oldest unread
+// samples count as overwritten.
+#define STREAM_GUARD (RP_BUFFER_SIZE / 8)
+
+/**
+ * Start acquisition of both channels as in `acquire_2channels` for a
+ * stream of `length` samples (0 for unlimited).
+ *
+ * With trigger `source` RP_TRIG_SRC_DISABLED the stream starts at the
+ * current write pointer right away.  Otherwise the ring buffer is
+ * filled with `pretrigger` samples (< RP_BUFFER_SIZE - STREAM_GUARD)
+ * and the trigger armed; wait for it with `stream_wait_trigger()`.
+ * The trigger is then at sample `pretrigger` of the stream, and the
+ * acquisition stops after `length` samples (unlimited: 2**31 samples
+ * after the trigger).
+ *
+ * In `raw` mode samples are ADC counts (exact integers) instead of
+ * volts.
+ *
+ * @return false on allocation failure.
+ */
+bool stream_start(
+    struct stream *s, rp_acq_decimation_t decimation, bool raw,
+    rp_acq_trig_src_t source, uint32_t pretrigger, uint64_t length);
+
+/**
+ * Wait for the trigger armed by `stream_start()`, see
+ * `wait_for_trigger()`.  The trigger has to be seen within one buffer
+ * time.
+ *
+ * @return false if the trigger did not fire.
+ */
+bool stream_wait_trigger(struct stream *s, struct trigger_wait *w);
+
+/**
+ * Read the next up to `n` consecutive samples of both channels,
+ * sleeping while they are not yet written.  Returns fewer samples at
+ * the end of the record or at an overrun, so the block has no gap;
+ * `first` and `gap` describe it.
+ *
+ * @return Number of samples, 0 at the end of the record.
+ */
+uint32_t stream_fill(struct stream *s, float *buf1, float *buf2, uint32_t n);
+
+/**
+ * Stop the acquisition and free the stream.
+ */
+void stream_stop(struct stream *s);
+
 #endif // __UTILITY_H
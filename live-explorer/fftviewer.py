@@ -1,8 +1,10 @@
-"""Usage: python fftviewer.py IP1=IP2=IP3 FREQ1 FREQ2 FREQ3...
+"""Usage: python fftviewer.py [--float|--int16] IP1=IP2=IP3 FREQ1 FREQ2 FREQ3...
 
 As command line arguments supply in the first argument all IPs of the
 Red Pitayas separated by `=`.  In the following arguments specify
-center frequencies for the Fourier trafo plots.
+center frequencies for the Fourier trafo plots.  With `--float` or
+`--int16` the binary stream format of live-explorer.x is used instead
+of text.
 """
 
 import sys
@@ -14,7 +16,7 @@ from matplotlib import cm as colormaps
 from pyqtgraph.Qt import QtGui, QtCore
 import pyqtgraph as pg
 
-from rpchain import RPChain, RingBufferChain, RPBUFFERSIZE
+from rpchain import RPChain, RingBufferChain, RPBUFFERSIZE, MODES
 from gauss_laws import gauss_laws
 
 import signal
@@ -39,6 +41,10 @@ F_HI_FREQ = 100e3  # Hz
 SAMPLERATE = 125e6 / 64
 
 
+mode = 'text'
+if sys.argv[1].startswith('--'):
+    mode = sys.argv.pop(1)[2:]
+    assert mode in MODES
 rpips = sys.argv[1].split('=')
 fcenter = [float(fc) for fc in sys.argv[2:]]
 print(f"{len(rpips)} Red Pitayas:", rpips)
@@ -49,7 +55,7 @@ assert len(fcenter) == 0 or len(fcenter) == 2*len(rpips)
 if len(fcenter) == 0:
     fcenter = [50e3]*nchannels
 
-chain = RPChain()
+chain = RPChain(mode)
 chain.connect(rpips)
 print("Connected.")
 
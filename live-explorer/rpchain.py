@@ -2,24 +2,77 @@
 Run the same program on many RPs and read their outputs (line buffered).
 Assumes the output format
 
-    CH SAMPLES...
+    IDX CH SAMPLES...
 
-With RBBUFFERSIZE samples.  Also implements a ring buffer to keep all
-these samples.
+With RBBUFFERSIZE samples.  Alternatively the binary frames of
+live-explorer.x in `float` or `int16` mode are read (see c/frame.h).
+Also implements a ring buffer to keep all these samples.
 """
 
 import subprocess
 import select
+import struct
 import numpy as np
 
 
 RPBUFFERSIZE = 16384  # = 2**14
-SSHCMD = "sshpass -p root ssh -q -o StrictHostKeyChecking=no -o UserKnownHostsFile=/dev/null root@{IP} 'LD_LIBRARY_PATH=/opt/redpitaya/lib measurements/live-explorer.x'"
+SSHCMD = "sshpass -p root ssh -q -o StrictHostKeyChecking=no -o UserKnownHostsFile=/dev/null root@{IP} 'LD_LIBRARY_PATH=/opt/redpitaya/lib measurements/live-explorer.x {MODE}'"
+
+# Binary frame header, see c/frame.h
+FRAME_MAGIC = 0x52465052
+FRAME_HEADER = struct.Struct('<IIBBHIIIf')
+FRAME_DTYPES = {1: np.dtype('<i2'), 2: np.dtype('<f4')}
+MODES = ('text', 'float', 'int16')
+
+
+def _readexact(f, n):
+    """Read exactly n bytes from unbuffered file f, None on EOF."""
+    chunks = []
+    while n > 0:
+        chunk = f.read(n)
+        if not chunk:
+            return None
+        chunks.append(chunk)
+        n -= len(chunk)
+    return b''.join(chunks)
+
+
+def read_text_record(f):
+    """Read one text line.  Returns (idx, ch, samples) or None."""
+    line = f.readline()
+    if not line:
+        return None
+    values = line.split()
+    if len(values) != 2+RPBUFFERSIZE:
+        raise ValueError(f"invalid line ({len(values)} values)")
+    samples = np.array([float(x) for x in values[2:]])
+    return int(values[0]), int(values[1]), samples
+
+
+def read_binary_record(f):
+    """Read one binary frame.  Returns (idx, ch, samples) or None."""
+    header = _readexact(f, FRAME_HEADER.size)
+    if header is None:
+        return None
+    (magic, idx, ch, fmt, _, decimation,
+     trigger, nsamples, scale) = FRAME_HEADER.unpack(header)
+    if magic != FRAME_MAGIC or fmt not in FRAME_DTYPES:
+        raise ValueError(f"invalid frame header (magic {magic:#x})")
+    dtype = FRAME_DTYPES[fmt]
+    data = _readexact(f, nsamples * dtype.itemsize)
+    if data is None:
+        return None
+    samples = np.frombuffer(data, dtype=dtype)
+    if fmt == 1:
+        samples = samples * np.float32(scale)
+    return idx, ch, samples
 
 
 class RPChain:
-    def __init__(self):
-        # list of [(ip, subprocess, csv-reader)]
+    def __init__(self, mode='text'):
+        assert mode in MODES
+        self.mode = mode
+        # list of [(ip, subprocess)]
         self.connections = []
 
     def channelnum(self):
@@ -27,13 +80,24 @@ class RPChain:
 
     def connect(self, ips):
         for ip in ips[::-1]:
-            proc = subprocess.Popen(
-                SSHCMD.format(IP=ip), shell=True,
-                encoding='ascii', universal_newlines=True,
-                bufsize=1,  # line buffered
-                stdout=subprocess.PIPE)
+            if self.mode == 'text':
+                proc = subprocess.Popen(
+                    SSHCMD.format(IP=ip, MODE=self.mode), shell=True,
+                    encoding='ascii', universal_newlines=True,
+                    bufsize=1,  # line buffered
+                    stdout=subprocess.PIPE)
+            else:
+                proc = subprocess.Popen(
+                    SSHCMD.format(IP=ip, MODE=self.mode), shell=True,
+                    bufsize=0,  # unbuffered, such that select sees all data
+                    stdout=subprocess.PIPE)
             self.connections.insert(0, (ip, proc))
 
+    def read_record(self, f):
+        if self.mode == 'text':
+            return read_text_record(f)
+        return read_binary_record(f)
+
     def read(self, timeout=0):
         records = []  # list of (ch, samples)
         fds = [proc.stdout for ip, proc in self.connections]
@@ -42,13 +106,17 @@ class RPChain:
             for r in rlist:
                 idx = fds.index(r)
                 ip, proc = self.connections[idx]
-                values = [float(x) for x in r.readline().split()]
-                if len(values) != 2+16384:
-                    print(f"{ip} invalid line ({len(values)} values)")
-                else:
-                    ch = 2*idx + int(values[1])-1
-                    print(f"{ip}-{int(values[1])} {ch} valid, idx={values[0]}")
-                    records.append((ch, values[2:]))
+                try:
+                    record = self.read_record(r)
+                except ValueError as e:
+                    print(f"{ip} {e}")
+                    continue
+                if record is None:
+                    continue
+                frame, rpch, samples = record
+                ch = 2*idx + rpch-1
+                print(f"{ip}-{rpch} {ch} valid, idx={frame}")
+                records.append((ch, samples))
             rlist, _, _ = select.select(fds, [], [], 0)
         return records
 
@@ -70,7 +138,7 @@ class RingBufferChain:
     def read(self, timeout=0):
         records = self.rpchain.read(timeout)
         for idx, values in records:
-            values -= np.mean(values)
+            values = values - np.mean(values)
             ring = self.buffer[idx]
             ring = np.roll(ring, 1, axis=0)
             ring[0, :] = values
@@ -84,11 +152,69 @@ class RingBufferChain:
         return set(idx for idx, values in records)
 
 
+def synthetic_stream(mode, nframes, f=50e3, samplerate=125e6/64):
+    """Encode nframes of a noisy sine like live-explorer.x would."""
+    rng = np.random.default_rng(0)
+    t = np.arange(RPBUFFERSIZE) / samplerate
+    chunks = []
+    for idx in range(nframes):
+        ch = 2 - idx % 2
+        v = 0.5*np.sin(2*np.pi*f*t) + 0.01*rng.standard_normal(t.size)
+        if mode == 'text':
+            chunks.append(f"{idx//2}\t{ch}\t".encode('ascii'))
+            chunks.append('\t'.join(f"{x:.3f}" for x in v).encode('ascii'))
+            chunks.append(b'\n')
+        elif mode == 'float':
+            chunks.append(FRAME_HEADER.pack(
+                FRAME_MAGIC, idx//2, ch, 2, 0, 64, 200, v.size, 1))
+            chunks.append(v.astype('<f4').tobytes())
+        else:
+            scale = 20 / 8192
+            chunks.append(FRAME_HEADER.pack(
+                FRAME_MAGIC, idx//2, ch, 1, 0, 64, 200, v.size, scale))
+            chunks.append(np.round(v / scale).astype('<i2').tobytes())
+    return b''.join(chunks)
+
+
+def benchmark(stream, mode):
+    """Parse a recorded stream (bytes) and print the throughput."""
+    import io
+    import time
+    if mode == 'text':
+        f = io.TextIOWrapper(io.BytesIO(stream), encoding='ascii')
+        reader = read_text_record
+    else:
+        f = io.BytesIO(stream)
+        reader = read_binary_record
+    n = 0
+    start = time.perf_counter()
+    while reader(f) is not None:
+        n += 1
+    dt = time.perf_counter() - start
+    print(f"{mode:>6}: {n} frames, {len(stream)/n/1e3:7.1f} kB/frame,"
+          f" {n/dt:8.1f} frames/s, {len(stream)/dt/1e6:7.1f} MB/s")
+
+
 # Test with RPs listed as arguments for 1 second.
+#
+# With `--bench [FILE]` measure parsing throughput of a recorded
+# stream (text or binary, e.g. from `live-explorer.x float > FILE`) or
+# of synthetic streams in all modes without any RP connected.
 if __name__ == '__main__':
     import time
     import sys
-    chain = RPChain()
-    chain.connect(sys.argv[1:])
-    time.sleep(1)
-    chain.read()
+    if len(sys.argv) > 1 and sys.argv[1] == '--bench':
+        if len(sys.argv) > 2:
+            with open(sys.argv[2], 'rb') as f:
+                stream = f.read()
+            magic, = struct.unpack('<I', stream[:4])
+            fmt = stream[9] if magic == FRAME_MAGIC else 0
+            benchmark(stream, {0: 'text', 1: 'int16', 2: 'float'}[fmt])
+        else:
+            for mode in MODES:
+                benchmark(synthetic_stream(mode, 40), mode)
+    else:
+        chain = RPChain()
+        chain.connect(sys.argv[1:])
+        time.sleep(1)
+        chain.read()
@@ -0,0 +1,127 @@
+"""
+Read indexed binary datasets (see c/dataset.h), as written by
+u1_drive1 --dataset, oscilloscope_gpio --dataset, scan_1channel with
+flag `dataset` or converted from text by dataset_convert.x.
+
+The file is memory mapped, records are only read when accessed:
+
+    ds = RPDataset('output.rpds')
+    ds.axes                     # {'f': array([...]), ...}
+    i = ds.find(ds.point_index(3, 0, 0, 7), ch=1)
+    meta, samples = ds.record(i)
+    volts = ds.volts(i)
+
+If all records have the same number of samples, `ds.samples` is a
+(nrecords, nsamples) int16 view of all records and `ds.scales` their
+scales, so e.g. `ds.samples[ds.index['ch'] == 1]` selects channel 1.
+"""
+
+import struct
+import numpy as np
+
+
+# See c/dataset.h
+DATASET_MAGIC = 0x53445052
+DATASET_RECORD_MAGIC = 0x43525052
+DATASET_END_MAGIC = 0x45445052
+DATASET_VERSION = 1
+DATASET_NO_POINT = 0xffffffff
+
+HEADER = struct.Struct('<IHHII16s')
+RECORD = struct.Struct('<IIi6fI')
+AXIS = struct.Struct('<16sI4x')
+TRAILER = struct.Struct('<QQQHHI')
+ENTRY_DTYPE = np.dtype([('offset', '<u8'), ('point', '<u4'), ('ch', '<i4')])
+RECORD_FIELDS = ('samplerate', 'freq', 'amp', 'phase', 'ch2delay', 'scale')
+
+
+def _padded(n):
+    return (n + 7) // 8 * 8
+
+
+class RPDataset:
+    def __init__(self, path):
+        self.map = np.memmap(path, dtype=np.uint8, mode='r')
+        if len(self.map) < HEADER.size + TRAILER.size:
+            raise ValueError(f"{path}: too short for a dataset")
+        magic, version, _, self.trigger, _, program = HEADER.unpack_from(self.map, 0)
+        if magic != DATASET_MAGIC or version != DATASET_VERSION:
+            raise ValueError(f"{path}: invalid header (magic {magic:#x}, version {version})")
+        self.program = program.rstrip(b'\0').decode()
+        axes, index, nrecords, naxes, _, magic = TRAILER.unpack_from(
+            self.map, len(self.map) - TRAILER.size)
+        if magic != DATASET_END_MAGIC:
+            raise ValueError(f"{path}: invalid trailer, incomplete file?")
+
+        # Index as structured array, sorted copy for find()
+        self.index = np.frombuffer(self.map, dtype=ENTRY_DTYPE, count=nrecords, offset=index)
+        self._order = np.lexsort((self.index['ch'], self.index['point']))
+        self._keys = (self.index['point'].astype(np.int64)[self._order] << 32) \
+            + self.index['ch'][self._order]
+
+        self.axes = {}
+        offset = axes
+        for _ in range(naxes):
+            name, npoints = AXIS.unpack_from(self.map, offset)
+            offset += AXIS.size
+            self.axes[name.rstrip(b'\0').decode()] = np.frombuffer(
+                self.map, dtype='<f4', count=npoints, offset=offset)
+            offset = _padded(offset + 4 * npoints)
+        self.shape = tuple(len(v) for v in self.axes.values())
+
+        self.samples, self.scales = self._uniform()
+
+    def __len__(self):
+        return len(self.index)
+
+    def _uniform(self):
+        """Strided views of all samples and scales, or (None, None) if
+        the records differ in size."""
+        offsets = self.index['offset']
+        if len(offsets) == 0:
+            return None, None
+        nsamples = RECORD.unpack_from(self.map, int(offsets[0]))[1]
+        stride = RECORD.size + _padded(2 * nsamples)
+        if np.any(offsets != offsets[0] + stride * np.arange(len(offsets), dtype=np.uint64)):
+            return None, None
+        start = int(offsets[0])
+        samples = np.ndarray((len(offsets), nsamples), dtype='<i2', buffer=self.map,
+                             offset=start + RECORD.size, strides=(stride, 2))
+        scales = np.ndarray((len(offsets),), dtype='<f4', buffer=self.map,
+                            offset=start + 32, strides=(stride,))
+        return samples, scales
+
+    def record(self, i):
+        """Metadata dict and int16 samples (a view) of record i, volts
+        are meta['scale'] times the samples."""
+        offset = int(self.index['offset'][i])
+        magic, nsamples, ch, *values, _ = RECORD.unpack_from(self.map, offset)
+        if magic != DATASET_RECORD_MAGIC:
+            raise ValueError(f"invalid record {i}")
+        meta = dict(zip(RECORD_FIELDS, values), ch=ch, point=int(self.index['point'][i]))
+        samples = np.frombuffer(self.map, dtype='<i2', count=nsamples,
+                                offset=offset + RECORD.size)
+        return meta, samples
+
+    def volts(self, i):
+        meta, samples = self.record(i)
+        return samples * np.float32(meta['scale'])
+
+    def find(self, point, ch):
+        """Number of the record of channel ch at a sweep point, None if
+        there is none."""
+        key = (int(point) << 32) + int(ch)
+        k = np.searchsorted(self._keys, key)
+        if k < len(self._keys) and self._keys[k] == key:
+            return int(self._order[k])
+        return None
+
+    def point_index(self, *idx):
+        """Point of the given indices along the axes (first axis
+        outermost)."""
+        return int(np.ravel_multi_index(idx, self.shape))
+
+    def point_values(self, point):
+        """Axis values of a point, as dict."""
+        idx = np.unravel_index(point, self.shape)
+        return {name: float(v[k]) for (name, v), k in zip(self.axes.items(), idx)}